@@ -0,0 +1,274 @@
+#ifndef _analytical_model_h
+#define _analytical_model_h
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "scale_config.h"
+#include "topology_utils.h"
+#include "memory/dram.h"
+
+using namespace std;
+
+typedef struct
+{
+    int64_t num_folds;
+    int64_t fold_rows;
+    int64_t fill_drain_cycles;
+    int64_t demand_rows;
+
+    int64_t comp_cycles;
+    int64_t stall_cycles;
+    float util;
+    float mapping_eff;
+
+    int64_t llc_reads;
+    int64_t llc_read_misses;
+    int64_t llc_writes;
+    int64_t llc_write_misses;
+} AnalyticalLayerStats;
+
+// Closed-form estimate of one layer, without generating any address trace.
+// Fold counts and demand rows follow the SystolicCompute classes exactly;
+// LLC traffic assumes the demand of every fetch line is contiguous, misses
+// come from the reuse distance of each operand between passes, and a PE
+// stalls for whatever prefetch latency the demand rows cannot hide.
+class AnalyticalModel
+{
+public:
+    AnalyticalModel();
+    void set_params(Config *config, Topology *topology);
+    AnalyticalLayerStats run_layer(int64_t layer_id);
+
+private:
+    int64_t ceil_div(int64_t a, int64_t b) { return (a + b - 1) / b; }
+    int64_t get_llc_requests(int64_t elems);
+    int64_t get_footprint_lines(int64_t elems);
+    int64_t get_slice_lines(int64_t rows, int64_t row_elems) { return rows * ceil_div(row_elems * word_size, llcConfig.cache_line_size); }
+
+    Config *config;
+    Topology *topology;
+
+    int64_t arr_row;
+    int64_t arr_col;
+    int64_t bandwidth;
+    int64_t word_size;
+    int64_t batch_size;
+
+    LlcConfig llcConfig;
+    int64_t llc_lines;
+    int64_t miss_latency;
+};
+
+AnalyticalModel::AnalyticalModel()
+{
+    arr_row = 4;
+    arr_col = 4;
+    bandwidth = 32;
+    word_size = 4;
+    batch_size = 1;
+    llc_lines = 1;
+    miss_latency = 40;
+}
+
+void AnalyticalModel::set_params(Config *config, Topology *topology)
+{
+    this->config = config;
+    this->topology = topology;
+
+    auto arrayDims = config->get_array_dims();
+    arr_row = arrayDims.arr_h;
+    arr_col = arrayDims.arr_w;
+
+    bandwidth = config->get_bandwidth();
+    word_size = config->get_word_size();
+    batch_size = config->get_batch_size();
+
+    llcConfig = config->get_llc_config();
+    llc_lines = llcConfig.total_size_bytes / llcConfig.cache_line_size;
+
+    // Misses are taken to open a closed row, without bank or channel contention
+    DramConfig dramConfig = config->get_dram_config();
+    DRAM dram;
+    dram.set_params(dramConfig.num_channels, dramConfig.num_banks, dramConfig.row_buffer_bytes, llcConfig.cache_line_size,
+        dramConfig.row_hit_latency, dramConfig.row_miss_latency, dramConfig.row_conflict_latency, dramConfig.bytes_per_cycle);
+    miss_latency = dram.get_latency();
+}
+
+int64_t AnalyticalModel::get_llc_requests(int64_t elems)
+{
+    // One LLC call per fetch line, touching every cache line it spans
+    int64_t fetch_lines = ceil_div(elems, bandwidth);
+    int64_t lines_per_fetch = ceil_div(bandwidth * word_size, llcConfig.cache_line_size);
+    return fetch_lines * lines_per_fetch;
+}
+
+int64_t AnalyticalModel::get_footprint_lines(int64_t elems)
+{
+    return ceil_div(elems * word_size, llcConfig.cache_line_size);
+}
+
+AnalyticalLayerStats AnalyticalModel::run_layer(int64_t layer_id)
+{
+    AnalyticalLayerStats stats;
+
+    string dataflow = topology->get_layer_dataflow(layer_id);
+    int64_t layer_type = topology->get_layer_type(layer_id);
+    int64_t num_pe = topology->get_layer_pe_list(layer_id).size();
+
+    // Operand matrices: ifmap M x K, filter K x N, ofmap M x N
+    auto ofmap_dims = topology->get_layer_ofmap_dims(layer_id);
+    int64_t M = ofmap_dims.first * ofmap_dims.second * batch_size;
+    int64_t K = topology->get_layer_window_size(layer_id);
+    int64_t N = topology->get_layer_num_filters(layer_id);
+
+    // Distinct cache lines of each operand; the ifmap matrix repeats the
+    // overlapping windows, its footprint is the ifmap itself
+    auto ifmap_dims = topology->get_layer_ifmap_dims(layer_id);
+    int64_t ifmap_words = min(M * K, ifmap_dims.first * ifmap_dims.second * topology->get_layer_num_channels(layer_id) * batch_size);
+    int64_t ifmap_lines = get_footprint_lines(ifmap_words);
+    int64_t filter_lines = get_footprint_lines(K * N);
+    int64_t ofmap_lines = get_footprint_lines(M * N);
+
+    // Per PE: demand elements of each operand, how many passes are made over
+    // its footprint and how many lines are touched between two passes. Folds
+    // run column fold outer, row fold inner.
+    int64_t Sr, Sc, T;
+    int64_t row_fold, col_fold;
+    int64_t ifmap_elems, filter_elems, ofmap_elems;
+    int64_t ifmap_passes = 1, filter_passes = 1, ofmap_passes = 1;
+    int64_t ifmap_distance = 0, filter_distance = 0, ofmap_distance = 0;
+
+    if (layer_type == POOL) {
+        Sr = M; Sc = N; T = K;
+        row_fold = ceil_div(Sr, arr_row * num_pe);
+        col_fold = ceil_div(Sc, arr_col);
+        stats.fold_rows = arr_col - 1 + T;
+
+        int64_t Sr_pe = min(Sr, row_fold * arr_row);
+        ifmap_elems = Sr_pe * T * col_fold;
+        filter_elems = 0;
+        ofmap_elems = Sr_pe * Sc;
+
+        filter_lines = 0;
+        ifmap_lines = ceil_div(ifmap_lines, num_pe);
+        ofmap_lines = ceil_div(ofmap_lines, num_pe);
+        ifmap_passes = col_fold;
+        ifmap_distance = min(ifmap_lines, row_fold * get_slice_lines(arr_row, T));
+    } else if (dataflow == "os") {
+        Sr = M; Sc = N; T = K;
+        row_fold = ceil_div(Sr, arr_row);
+        col_fold = ceil_div(Sc, arr_col);
+        stats.fold_rows = arr_col - 1 + T;
+
+        ifmap_elems = Sr * T * col_fold;
+        filter_elems = T * Sc * row_fold;
+        ofmap_elems = Sr * Sc;
+
+        // ifmap fold: arr_row windows of T elements, filter fold: arr_col filters
+        ifmap_passes = col_fold;
+        ifmap_distance = min(ifmap_lines, row_fold * get_slice_lines(arr_row, T)) + get_slice_lines(arr_col, T);
+        filter_passes = row_fold;
+        filter_distance = get_slice_lines(arr_row, T) + get_slice_lines(arr_col, T);
+    } else if (dataflow == "is") {
+        Sr = K; Sc = M; T = N;
+        row_fold = ceil_div(Sr, arr_row);
+        col_fold = ceil_div(Sc, arr_col);
+        stats.fold_rows = arr_row + arr_col - 1 + T;
+
+        ifmap_elems = Sr * Sc;
+        filter_elems = Sr * T * col_fold;
+        ofmap_elems = Sc * T * row_fold;
+
+        // filter fold: arr_row window elements of T filters, ofmap fold: arr_col pixels
+        filter_passes = col_fold;
+        filter_distance = min(filter_lines, row_fold * get_slice_lines(T, arr_row)) + get_slice_lines(arr_col, T);
+        ofmap_passes = row_fold;
+        ofmap_distance = get_slice_lines(T, arr_row) + get_slice_lines(arr_col, T);
+    } else {
+        Sr = K; Sc = N; T = M;
+        row_fold = ceil_div(Sr, arr_row);
+        col_fold = ceil_div(Sc, arr_col * num_pe);
+        stats.fold_rows = arr_row + arr_col - 1 + T;
+
+        int64_t Sc_pe = min(Sc, col_fold * arr_col);
+        ifmap_elems = T * Sr * col_fold;
+        filter_elems = Sr * Sc_pe;
+        ofmap_elems = T * Sc_pe * row_fold;
+
+        filter_lines = get_footprint_lines(Sr * Sc_pe);
+        ofmap_lines = get_footprint_lines(T * Sc_pe);
+        // ifmap fold: arr_row window elements of T pixels, ofmap fold: arr_col filters of T pixels
+        ifmap_passes = col_fold;
+        ifmap_distance = min(ifmap_lines, row_fold * get_slice_lines(T, arr_row)) + get_slice_lines(T, arr_col);
+        ofmap_passes = row_fold;
+        ofmap_distance = get_slice_lines(T, arr_row) + get_slice_lines(T, arr_col);
+    }
+
+    stats.num_folds = row_fold * col_fold;
+    stats.fill_drain_cycles = stats.num_folds * (stats.fold_rows - T);
+    stats.demand_rows = stats.num_folds * stats.fold_rows;
+
+    // LLC traffic of one PE
+    int64_t ifmap_requests = get_llc_requests(ifmap_elems);
+    int64_t filter_requests = get_llc_requests(filter_elems);
+    int64_t ofmap_requests = get_llc_requests(ofmap_elems);
+
+    // The first pass over an operand misses once per line; later passes hit
+    // unless the lines touched in between overflow the LLC, in which case
+    // the cyclic pattern thrashes and every request misses
+    auto get_misses = [&](int64_t requests, int64_t lines, int64_t passes, int64_t distance) {
+        if (llcConfig.is_always_hit)
+            return (int64_t)0;
+        int64_t first_pass_requests = ceil_div(requests, passes);
+        int64_t misses = min(first_pass_requests, lines);
+        if (distance > llc_lines)
+            misses += requests - first_pass_requests;
+        return misses;
+    };
+    int64_t ifmap_misses = get_misses(ifmap_requests, ifmap_lines, ifmap_passes, ifmap_distance);
+    int64_t filter_misses = get_misses(filter_requests, filter_lines, filter_passes, filter_distance);
+    int64_t ofmap_misses = get_misses(ofmap_requests, ofmap_lines, ofmap_passes, ofmap_distance);
+
+    // Prefetch latency of each buffer against the demand rows hiding it
+    auto get_latency = [&](int64_t requests, int64_t misses) {
+        if (llcConfig.is_bypassing)
+            return ceil_div(requests, 2) * llcConfig.hit_latency;
+        if (llcConfig.num_mshr > 0) {
+            // Misses of one fetch line overlap up to the MSHR count
+            int64_t lines_per_fetch = ceil_div(bandwidth * word_size, llcConfig.cache_line_size);
+            int64_t overlap = min((int64_t)llcConfig.num_mshr, max(lines_per_fetch, (int64_t)1));
+            return requests * llcConfig.hit_latency + ceil_div(misses, overlap) * miss_latency;
+        }
+        return (requests - misses) * llcConfig.hit_latency + misses * miss_latency;
+    };
+    int64_t stall_cycles = 0;
+    stall_cycles = max(stall_cycles, get_latency(ifmap_requests, ifmap_misses) - stats.demand_rows);
+    stall_cycles = max(stall_cycles, get_latency(filter_requests, filter_misses) - stats.demand_rows);
+    stall_cycles = max(stall_cycles, get_latency(ofmap_requests, ofmap_misses) - stats.demand_rows);
+
+    // Every PE of the layer runs the same folds, reports sum over the PEs
+    int64_t ofmap_hit_latency = 1;
+    stats.stall_cycles = stall_cycles * num_pe;
+    stats.comp_cycles = (stats.demand_rows + stall_cycles + ofmap_hit_latency) * num_pe;
+
+    int64_t num_compute = topology->get_layer_num_ofmap_px(layer_id) * K;
+    stats.util = (float)(num_compute * 100) / (stats.comp_cycles * arr_row * arr_col);
+    if (layer_type == POOL)
+        stats.mapping_eff = (float)(Sr * Sc * 100) / (row_fold * num_pe * arr_row * col_fold * arr_col);
+    else if (dataflow == "os" || dataflow == "is")
+        stats.mapping_eff = (float)(Sr * Sc * 100) / (row_fold * arr_row * col_fold * arr_col);
+    else
+        stats.mapping_eff = (float)(Sr * Sc * 100) / (row_fold * arr_row * col_fold * num_pe * arr_col);
+
+    stats.llc_reads = (ifmap_requests + filter_requests) * num_pe;
+    stats.llc_read_misses = (ifmap_misses + filter_misses) * num_pe;
+    stats.llc_writes = ofmap_requests * num_pe;
+    stats.llc_write_misses = ofmap_misses * num_pe;
+
+    return stats;
+}
+
+#endif
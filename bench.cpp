@@ -0,0 +1,271 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sys/resource.h>
+
+#include "scale_sim.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Simulator benchmarks, one per process so the peak RSS belongs to it.
+// Usage:
+//   bench_sim llc_read|read_buffer|operand_matrix|demand [topology config [layer_id]]
+//   bench_sim e2e topology config
+// Every benchmark prints one line with its throughput, in simulated cycles
+// per host second where the benchmark simulates time, and the peak RSS.
+
+char default_topology[] = "./topologies/cado/alexnet_1024_1_1_comp.csv";
+char default_config[] = "./configs/alexnet/alexnet_c1024_1_1_ws.cfg";
+
+double get_peak_rss_mb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+void report(string name, double seconds, int64_t sim_cycles, int64_t ops, string op_name)
+{
+    printf("bench %-16s %10.3f s", name.c_str(), seconds);
+    if (sim_cycles > 0)
+        printf("  %14ld sim cycles  %14.0f sim cycles/s", sim_cycles, sim_cycles / seconds);
+    if (ops > 0)
+        printf("  %14.0f %s/s", ops / seconds, op_name.c_str());
+    printf("  peak RSS %.1f MB\n", get_peak_rss_mb());
+}
+
+// Logs of the simulator classes are not part of what is measured
+class QuietCout
+{
+public:
+    QuietCout() : null_stream("/dev/null") { cout_buf = cout.rdbuf(null_stream.rdbuf()); }
+    ~QuietCout() { cout.rdbuf(cout_buf); }
+
+private:
+    ofstream null_stream;
+    streambuf *cout_buf;
+};
+
+SystolicCompute* create_compute_system(Topology *topology, int64_t layer_id, string dataflow)
+{
+    if (topology->get_layer_type(layer_id) == POOL)
+        return new SystolicPoolOs();
+    if (dataflow == "os")
+        return new SystolicComputeOs();
+    if (dataflow == "is")
+        return new SystolicComputeIs();
+    return new SystolicComputeWs();
+}
+
+// Strided sweeps over twice the LLC capacity, a mix of hits and conflict misses
+void bench_llc_read(Config *config)
+{
+    LlcConfig llcConfig = config->get_llc_config();
+    DramConfig dramConfig = config->get_dram_config();
+    DRAM dram;
+    dram.set_params(dramConfig.num_channels, dramConfig.num_banks, dramConfig.row_buffer_bytes, llcConfig.cache_line_size,
+        dramConfig.row_hit_latency, dramConfig.row_miss_latency, dramConfig.row_conflict_latency, dramConfig.bytes_per_cycle);
+    LLC llc;
+    {
+        QuietCout quiet;
+        llc.set_params(&dram, llcConfig.total_size_bytes, llcConfig.cache_line_size, llcConfig.hit_latency,
+            llcConfig.set_associativity, llcConfig.partition, llcConfig.is_always_hit, llcConfig.is_bypassing);
+        llc.set_num_mshr(llcConfig.num_mshr);
+    }
+
+    int64_t bandwidth = config->get_bandwidth();
+    int64_t word_size = config->get_word_size();
+    int64_t footprint = 2 * llcConfig.total_size_bytes;
+    int64_t num_lines = footprint / (bandwidth * word_size);
+
+    AddressWindow addr_window(0, footprint);
+    vector<compact_addr_t> arena;
+    for (int64_t i = 0; i < num_lines * bandwidth; i++)
+        arena.push_back(addr_window.encode(i * word_size));
+
+    int64_t cycle = 0;
+    int64_t num_calls = 0;
+    auto start = high_resolution_clock::now();
+    for (int pass = 0; pass < 16; pass++) {
+        for (int64_t line_id = 0; line_id < num_lines; line_id++) {
+            FetchLine line = {arena.data() + line_id * bandwidth, bandwidth, addr_window};
+            cycle = llc.service_read(line, cycle, 0, (line_id + 1) % 2);
+            num_calls++;
+        }
+    }
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+    report("llc_read", seconds, cycle, num_calls, "calls");
+}
+
+// The ifmap demand of one layer through a ReadBuffer backed by the LLC
+void bench_read_buffer(Config *config, Topology *topology, int64_t layer_id)
+{
+    QuietCout quiet;
+
+    LlcConfig llcConfig = config->get_llc_config();
+    DramConfig dramConfig = config->get_dram_config();
+    DRAM dram;
+    dram.set_params(dramConfig.num_channels, dramConfig.num_banks, dramConfig.row_buffer_bytes, llcConfig.cache_line_size,
+        dramConfig.row_hit_latency, dramConfig.row_miss_latency, dramConfig.row_conflict_latency, dramConfig.bytes_per_cycle);
+    LLC llc;
+    llc.set_params(&dram, llcConfig.total_size_bytes, llcConfig.cache_line_size, llcConfig.hit_latency,
+        llcConfig.set_associativity, llcConfig.partition, llcConfig.is_always_hit, llcConfig.is_bypassing);
+    llc.set_num_mshr(llcConfig.num_mshr);
+
+    OperandMatrix operand_matrix;
+    operand_matrix.set_params(config, topology, layer_id);
+    OperandView ifmap_view = operand_matrix.get_ifmap_view();
+    OperandView filter_view = operand_matrix.get_filter_view();
+    OperandView ofmap_view = operand_matrix.get_ofmap_view();
+
+    SystolicCompute *compute_system = create_compute_system(topology, layer_id, topology->get_layer_dataflow(layer_id));
+    compute_system->set_params(config, ifmap_view, filter_view, ofmap_view, 1);
+    compute_system->set_addr_window(operand_matrix.get_addr_window());
+    SystolicDemandStream ifmap_stream(compute_system, Operand::IFMAP, 0);
+
+    ReadBuffer read_buffer(false);
+    read_buffer.set_params(&llc, config->get_mem_sizes().ifmap_kb, config->get_word_size(), 0.5, config->get_bandwidth());
+
+    auto start = high_resolution_clock::now();
+    read_buffer.set_fetch_stream(&ifmap_stream);
+    int64_t num_rows = ifmap_stream.get_num_rows();
+    int64_t cycle = 0;
+    for (int64_t i = 0; i < num_rows; i++)
+        cycle = read_buffer.service_read(i, cycle, 0, false);
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+
+    report("read_buffer", seconds, cycle, num_rows, "rows");
+}
+
+// Address generation of all three operand matrices of one layer
+void bench_operand_matrix(Config *config, Topology *topology, int64_t layer_id)
+{
+    QuietCout quiet;
+
+    auto start = high_resolution_clock::now();
+    OperandMatrix operand_matrix;
+    operand_matrix.set_params(config, topology, layer_id);
+    OperandView views[3] = {operand_matrix.get_ifmap_view(), operand_matrix.get_filter_view(), operand_matrix.get_ofmap_view()};
+
+    int64_t num_addrs = 0;
+    int64_t checksum = 0;
+    for (auto &view : views) {
+        for (int64_t row = 0; row < view.shape()[0]; row++)
+            for (int64_t col = 0; col < view.shape()[1]; col++)
+                checksum += view(row, col);
+        num_addrs += view.shape()[0] * view.shape()[1];
+    }
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+
+    report("operand_matrix", seconds, 0, num_addrs, "addrs");
+    if (checksum == 0)
+        printf("empty operand matrices\n");
+}
+
+// Fold demand of every operand of one layer, for each dataflow
+void bench_demand(Config *config, Topology *topology, int64_t layer_id)
+{
+    string dataflows[3] = {"os", "ws", "is"};
+    for (auto &dataflow : dataflows) {
+        int64_t num_rows = 0;
+        double seconds = 0;
+        {
+            QuietCout quiet;
+
+            OperandMatrix operand_matrix;
+            operand_matrix.set_params(config, topology, layer_id);
+            OperandView ifmap_view = operand_matrix.get_ifmap_view();
+            OperandView filter_view = operand_matrix.get_filter_view();
+            OperandView ofmap_view = operand_matrix.get_ofmap_view();
+
+            auto start = high_resolution_clock::now();
+            SystolicCompute *compute_system = create_compute_system(topology, layer_id, dataflow);
+            compute_system->set_params(config, ifmap_view, filter_view, ofmap_view, 1);
+
+            PaddedDemand fold_buf;
+            Operand operands[3] = {Operand::IFMAP, Operand::FILTER, Operand::OFMAP};
+            for (auto operand : operands) {
+                for (int64_t fold_id = 0; fold_id < compute_system->get_num_folds(); fold_id++) {
+                    compute_system->get_fold_demand(operand, 0, fold_id, fold_buf);
+                    num_rows += compute_system->get_fold_rows();
+                }
+            }
+            seconds = duration<double>(high_resolution_clock::now() - start).count();
+        }
+        report("demand_" + dataflow, seconds, 0, num_rows, "rows");
+    }
+}
+
+void bench_e2e(char *topology_file, char *config_file)
+{
+    int64_t total_cycles = 0;
+    double seconds = 0;
+    {
+        QuietCout quiet;
+
+        auto start = high_resolution_clock::now();
+        Config config;
+        config.read_conf_file(config_file);
+        Topology topology;
+        topology.load_arrays(&config, topology_file, config.is_prefetch_demand());
+
+        Simulator simulator;
+        simulator.set_params(&config, &topology, topology_file, false);
+        simulator.run();
+        seconds = duration<double>(high_resolution_clock::now() - start).count();
+
+        // Cycles are reported cumulatively, the last layer holds the total
+        vector<ComputeStats> comp_items = simulator.get_layer_compute_stats();
+        if (!comp_items.empty())
+            total_cycles = comp_items.back().comp_cycles;
+    }
+
+    string name = topology_file;
+    name = name.substr(name.find_last_of('/') + 1);
+    report("e2e " + name, seconds, total_cycles, 0, "");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " llc_read|read_buffer|operand_matrix|demand|e2e [topology config [layer_id]]" << endl;
+        return 1;
+    }
+
+    string bench = argv[1];
+    char *topology_file = (argc > 2) ? argv[2] : default_topology;
+    char *config_file = (argc > 3) ? argv[3] : default_config;
+    int64_t layer_id = (argc > 4) ? atol(argv[4]) : 2;
+
+    if (bench == "e2e") {
+        bench_e2e(topology_file, config_file);
+        return 0;
+    }
+
+    Config config;
+    Topology topology;
+    {
+        QuietCout quiet;
+        config.read_conf_file(config_file);
+        topology.load_arrays(&config, topology_file, config.is_prefetch_demand());
+    }
+    layer_id = min(layer_id, topology.get_num_layers() - 1);
+
+    if (bench == "llc_read")
+        bench_llc_read(&config);
+    else if (bench == "read_buffer")
+        bench_read_buffer(&config, &topology, layer_id);
+    else if (bench == "operand_matrix")
+        bench_operand_matrix(&config, &topology, layer_id);
+    else if (bench == "demand")
+        bench_demand(&config, &topology, layer_id);
+    else {
+        cout << "Unknown benchmark " << bench << endl;
+        return 1;
+    }
+
+    return 0;
+}
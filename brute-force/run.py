@@ -24,29 +24,28 @@ from subprocess import Popen, PIPE
 
 from scipy.stats import gmean
 
-def run_scale(csv_file):
+def run_sweep(csv_file):
+    # One in-process run covers every per-layer dataflow combination, the
+    # Dataflow column of csv_file is overridden for each CONV layer
     root_path = os.getenv("CADOSys_ROOT")
     run_cmd = root_path
     run_cmd += '/scale '
     run_cmd += csv_file
     run_cmd += ' '
     run_cmd += root_path
-    run_cmd += '/configs/alexnet/alexnet_c512_1_1_ws.cfg > '
-    log_file = csv_file.replace('/config/', '/output/')
-    log_file = log_file.replace('.csv', '.log')
-    run_cmd += log_file
+    run_cmd += '/configs/alexnet/alexnet_c512_1_1_ws.cfg'
+    run_cmd += ' --sweep=./output/sweep.csv > ./output/sweep.log'
     os.system(run_cmd)
 
 
 def main():
     csv_file_list = []
     root_directory = './config/'
-    for csv_file in os.listdir(root_directory):
+    for csv_file in sorted(os.listdir(root_directory)):
         if csv_file.endswith(".csv"):
             csv_file_list.append(os.path.join(root_directory, csv_file))
-    for csv_file in csv_file_list:
-        print(csv_file)
-        run_scale(csv_file)
+    print(csv_file_list[0])
+    run_sweep(csv_file_list[0])
 
 if __name__ == '__main__':
     main()
\ No newline at end of file
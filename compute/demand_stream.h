@@ -0,0 +1,154 @@
+#ifndef _demand_stream_h
+#define _demand_stream_h
+
+#include <xtensor/xarray.hpp>
+#include <xtensor/xio.hpp>
+#include <xtensor/xview.hpp>
+
+#include <vector>
+
+using namespace std;
+
+#include "../memory/address_window.h"
+
+enum class Operand
+{
+    IFMAP,
+    FILTER,
+    OFMAP
+};
+
+// Demand matrix that keeps its null padding as run-lengths. Rows before
+// block_start and from block_end on are all null and not stored; the rows in
+// between are stored densely, -1 where they carry no request.
+class PaddedDemand
+{
+public:
+    PaddedDemand();
+    // Trims the leading and trailing null rows of a dense matrix
+    PaddedDemand(const xt::xarray<int64_t> &matrix);
+    // A num_rows x num_cols matrix, null except for block_rows rows from block_start
+    void reset(int64_t num_rows, int64_t num_cols, int64_t block_start, int64_t block_rows);
+
+    int64_t get_num_rows() const { return num_rows; }
+    int64_t get_num_cols() const { return num_cols; }
+    int64_t get_num_elems() const { return num_rows * num_cols; }
+    int64_t get_block_start() const { return block_start; }
+    int64_t get_block_end() const { return block_start + visible_rows; }
+    // Row-major elements of the block
+    const int64_t *get_block_data() const { return block.data(); }
+    int64_t get_block_elems() const { return visible_rows * num_cols; }
+
+    // Any element, -1 in the padding
+    int64_t get(int64_t row, int64_t col) const;
+    // Element of the block, to fill it in
+    int64_t &operator()(int64_t row, int64_t col) { return block[(row - block_start) * num_cols + col]; }
+
+private:
+    int64_t num_rows;
+    int64_t num_cols;
+    int64_t block_start;
+    int64_t block_rows;
+    // Block rows that lie inside the matrix; the rest is filled but never read
+    int64_t visible_rows;
+    vector<int64_t> block;
+};
+
+PaddedDemand::PaddedDemand()
+{
+    num_rows = 0;
+    num_cols = 0;
+    block_start = 0;
+    block_rows = 0;
+    visible_rows = 0;
+}
+
+PaddedDemand::PaddedDemand(const xt::xarray<int64_t> &matrix)
+{
+    int64_t rows = matrix.dimension() == 2 ? matrix.shape()[0] : 0;
+    int64_t cols = matrix.dimension() == 2 ? matrix.shape()[1] : 0;
+    auto is_null_row = [&](int64_t row) {
+        for (int64_t col = 0; col < cols; col++) {
+            if (matrix(row, col) != -1)
+                return false;
+        }
+        return true;
+    };
+
+    int64_t start = 0;
+    while (start < rows && is_null_row(start))
+        start++;
+    int64_t end = rows;
+    while (end > start && is_null_row(end - 1))
+        end--;
+
+    reset(rows, cols, start, end - start);
+    for (int64_t row = start; row < end; row++)
+        for (int64_t col = 0; col < cols; col++)
+            (*this)(row, col) = matrix(row, col);
+}
+
+void PaddedDemand::reset(int64_t num_rows, int64_t num_cols, int64_t block_start, int64_t block_rows)
+{
+    this->num_rows = num_rows;
+    this->num_cols = num_cols;
+    this->block_start = block_start;
+    this->block_rows = max(block_rows, (int64_t)0);
+    visible_rows = max(min(block_start + this->block_rows, num_rows) - block_start, (int64_t)0);
+    block.assign(this->block_rows * num_cols, -1);
+}
+
+int64_t PaddedDemand::get(int64_t row, int64_t col) const
+{
+    if (row < block_start || row >= get_block_end())
+        return -1;
+    return block[(row - block_start) * num_cols + col];
+}
+
+// Pull-based source of demand rows. A layer's demand matrix is the vertical
+// concatenation of get_num_folds() folds of get_fold_rows() rows each, so a
+// consumer only ever has to hold one fold at a time.
+class DemandStream
+{
+public:
+    virtual ~DemandStream() {}
+    virtual int64_t get_num_folds() = 0;
+    virtual int64_t get_fold_rows() = 0;
+    // Number of consecutive folds after which the access pattern repeats
+    virtual int64_t get_fold_period() { return 1; }
+    // Either fills fold_buf and returns it, or returns a reference to storage
+    // owned by the stream. fold_buf is scratch space owned by the caller.
+    virtual const PaddedDemand& get_fold(int64_t fold_id, PaddedDemand &fold_buf) = 0;
+    // Every non-null address of the stream lies inside this window
+    virtual AddressWindow get_addr_window() = 0;
+
+    int64_t get_num_rows() { return get_num_folds() * get_fold_rows(); }
+};
+
+// Adapter that exposes an already materialized demand matrix as a single fold.
+class MatrixDemandStream : public DemandStream
+{
+public:
+    MatrixDemandStream() { matrix = NULL; }
+    void set_matrix(PaddedDemand *matrix) { this->matrix = matrix; }
+    int64_t get_num_folds() { return 1; }
+    int64_t get_fold_rows() { return matrix->get_num_rows(); }
+    const PaddedDemand& get_fold(int64_t fold_id, PaddedDemand &fold_buf) { return *matrix; }
+    AddressWindow get_addr_window();
+
+private:
+    PaddedDemand *matrix;
+};
+
+AddressWindow MatrixDemandStream::get_addr_window()
+{
+    AddressWindow addr_window;
+    const int64_t *block = matrix->get_block_data();
+    for (int64_t i = 0; i < matrix->get_block_elems(); i++) {
+        if (block[i] != -1)
+            addr_window.merge(AddressWindow(block[i], block[i]));
+    }
+    return addr_window;
+}
+
+#endif
@@ -5,8 +5,34 @@
 #include <xtensor/xio.hpp>
 #include <xtensor/xview.hpp>
 
+#include <array>
+#include <algorithm>
+
 #include "../scale_config.h"
 #include "../topology_utils.h"
+#include "demand_stream.h"
+
+class OperandMatrix;
+
+// Read-only (row, col) view of one operand matrix. Addresses are computed on
+// access from the layer parameters held by the OperandMatrix, the matrix
+// itself is never stored.
+class OperandView
+{
+public:
+    OperandView();
+    OperandView(OperandMatrix *operand_matrix, Operand operand, int64_t rows, int64_t cols);
+
+    int64_t operator()(int64_t row, int64_t col) const;
+    const array<size_t, 2>& shape() const { return dims; }
+    // Dense copy of the view, for code that needs xtensor expressions
+    xt::xarray<int64_t> to_array() const;
+
+private:
+    OperandMatrix *operand_matrix;
+    Operand operand;
+    array<size_t, 2> dims;
+};
 
 class OperandMatrix
 {
@@ -14,20 +40,31 @@ public:
     OperandMatrix();
     ~OperandMatrix();
     void set_params(Config *config, Topology *topology, int64_t layer_id);
+
+    OperandView get_ifmap_view() { return OperandView(this, Operand::IFMAP, ofmap_px_per_filt * batch_size, conv_window_size); }
+    OperandView get_filter_view() { return OperandView(this, Operand::FILTER, conv_window_size, num_filters); }
+    OperandView get_ofmap_view() { return OperandView(this, Operand::OFMAP, ofmap_px_per_filt * batch_size, num_filters); }
+
+    // Dense matrices, materialized from the views on first use
     xt::xarray<int64_t>& get_ifmap_matrix();
     xt::xarray<int64_t>& get_filter_matrix();
     xt::xarray<int64_t>& get_ofmap_matrix();
 
-private:
-    void create_ifmap_matrix();
-    void create_filter_matrix();
-    void create_ofmap_matrix();
-    void create_operand_matrices();
+    // Byte range covering the addresses of all three operands
+    AddressWindow get_addr_window();
 
-    int64_t calc_ifmap_elem_addr(int64_t i, int64_t j, int input_index);
+    int64_t calc_ifmap_elem_addr(int64_t i, int64_t j);
     int64_t calc_filter_elem_addr(int64_t i, int64_t j);
     int64_t calc_ofmap_elem_addr(int64_t i, int64_t j);
 
+private:
+    void create_addr_tables();
+    void create_gemm_addr_tables(int64_t num_rows, int64_t per_input_size);
+    // Source layer whose ifmap holds row; the rows left over when the sources
+    // do not divide them evenly belong to the last one
+    int64_t get_ifmap_source(int64_t row, int64_t per_input_size);
+    void create_operand_matrices();
+
     Config *config;
     Topology *topology;
     int64_t layer_id;
@@ -41,6 +78,13 @@ private:
     int64_t row_stride;
     int64_t col_stride;
 
+    // GEMM layers index A and B directly instead of through conv windows
+    bool is_gemm;
+    bool ifmap_col_major;
+    // Element steps of the filter matrix in words, from its layout
+    int64_t filter_row_step;
+    int64_t filter_col_step;
+
     int64_t batch_size;
     int64_t word_size;
 
@@ -53,6 +97,17 @@ private:
     int64_t filter_offset;
     int64_t ofmap_offset;
 
+    // The ifmap address splits into a part that depends on the ofmap pixel
+    // (row) and one that depends on the window element (col); the bounds
+    // check needs the ifmap coordinates of both
+    vector<int64_t> ifmap_row_addr;
+    vector<int64_t> ifmap_row_i_row;
+    vector<int64_t> ifmap_row_i_col;
+    vector<int64_t> ifmap_col_addr;
+    vector<int64_t> ifmap_col_c_row;
+    vector<int64_t> ifmap_col_c_col;
+    int64_t ifmap_row_limit;
+
     xt::xarray<int64_t> ifmap_addr_matrix;
     xt::xarray<int64_t> filter_addr_matrix;
     xt::xarray<int64_t> ofmap_addr_matrix;
@@ -98,14 +153,23 @@ void OperandMatrix::set_params(Config *config, Topology *topology, int64_t layer
     this->ofmap_px_per_filt = this->ofmap_rows * this->ofmap_cols;
     this->conv_window_size = this->topology->get_layer_window_size(this->layer_id);
 
+    this->is_gemm = this->topology->is_layer_gemm(this->layer_id);
+    this->ifmap_col_major = this->topology->is_layer_ifmap_col_major(this->layer_id);
+    if (this->topology->is_layer_filter_col_major(this->layer_id)) {
+        this->filter_row_step = 1;
+        this->filter_col_step = this->conv_window_size;
+    } else {
+        this->filter_row_step = this->num_filters;
+        this->filter_col_step = 1;
+    }
+
     auto offsetinfo = this->topology->get_layer_offsets(this->layer_id);
     this->ifmap_offset = offsetinfo.ifmap_offset;
     this->filter_offset = offsetinfo.filter_offset;
     this->ofmap_offset = offsetinfo.ofmap_offset;
 
-    this->ifmap_addr_matrix = xt::ones<int64_t>({this->ofmap_px_per_filt * this->batch_size, this->conv_window_size});
-    this->filter_addr_matrix = xt::ones<int64_t>({this->conv_window_size, this->num_filters});
-    this->ofmap_addr_matrix = xt::ones<int64_t>({this->ofmap_px_per_filt * this->batch_size, this->num_filters});
+    create_addr_tables();
+    matrices_ready_flag = false;
 
     for (int i = 0; i < this->ifmap_offset.size(); i++) {
         cout << "ifmap_offset is " << this->ifmap_offset[i] << ", ";
@@ -142,96 +206,120 @@ void OperandMatrix::create_operand_matrices()
 {
     if (!params_set_flag)
         cout << "Parameters not set yet. Run set_params(). Exiting!!!" << endl;
-    create_ifmap_matrix();
-    create_filter_matrix();
-    create_ofmap_matrix();
+    ifmap_addr_matrix = get_ifmap_view().to_array();
+    filter_addr_matrix = get_filter_view().to_array();
+    ofmap_addr_matrix = get_ofmap_view().to_array();
     matrices_ready_flag = true;
 }
 
-void OperandMatrix::create_ifmap_matrix()
+void OperandMatrix::create_addr_tables()
 {
-    uint64_t per_input_size = batch_size * ofmap_px_per_filt / ifmap_offset.size();
-    for (int64_t row_idx = 0; row_idx < batch_size * ofmap_px_per_filt; row_idx++)
-    {
-        for (int64_t col_idx = 0; col_idx < conv_window_size; col_idx++)
-        {
-            ifmap_addr_matrix(row_idx, col_idx) = calc_ifmap_elem_addr(row_idx, col_idx, row_idx / per_input_size);
-        }
+    int64_t num_rows = batch_size * ofmap_px_per_filt;
+    int64_t per_input_size = max(num_rows / (int64_t)ifmap_offset.size(), (int64_t)1);
+    int64_t channel = num_input_channels;
+
+    if (is_gemm) {
+        create_gemm_addr_tables(num_rows, per_input_size);
+        return;
     }
-}
 
-void OperandMatrix::create_filter_matrix()
-{
-    for (int64_t row_idx = 0; row_idx < conv_window_size; row_idx++)
+    ifmap_row_addr.resize(num_rows);
+    ifmap_row_i_row.resize(num_rows);
+    ifmap_row_i_col.resize(num_rows);
+    for (int64_t i = 0; i < num_rows; i++)
     {
-        for (int64_t col_idx = 0; col_idx < num_filters; col_idx++)
-        {
-            filter_addr_matrix(row_idx, col_idx) = calc_filter_elem_addr(row_idx, col_idx);
-        }
+        int64_t i_row = (i / ofmap_cols) * row_stride;
+        int64_t i_col = (i % ofmap_cols) * col_stride;
+        int64_t window_addr = i_row * ifmap_cols * channel + i_col * channel;
+
+        ifmap_row_addr[i] = window_addr * word_size + ifmap_offset[get_ifmap_source(i, per_input_size)];
+        ifmap_row_i_row[i] = i_row;
+        ifmap_row_i_col[i] = i_col;
     }
-}
 
-void OperandMatrix::create_ofmap_matrix()
-{
-    for (int64_t row_idx = 0; row_idx < batch_size * ofmap_px_per_filt; row_idx++)
+    ifmap_col_addr.resize(conv_window_size);
+    ifmap_col_c_row.resize(conv_window_size);
+    ifmap_col_c_col.resize(conv_window_size);
+    for (int64_t j = 0; j < conv_window_size; j++)
     {
-        for (int64_t col_idx = 0; col_idx < num_filters; col_idx++)
-        {
-            ofmap_addr_matrix(row_idx, col_idx) = calc_ofmap_elem_addr(row_idx, col_idx);
-        }
+        int64_t c_row = j / (filter_cols * channel);
+        int64_t k = j % (filter_cols * channel);
+        int64_t c_col = k / channel;
+        int64_t c_ch = k % channel;
+        int64_t internal_address = c_row * (ifmap_cols * channel) + c_col * channel + c_ch;
+
+        ifmap_col_addr[j] = internal_address * word_size;
+        ifmap_col_c_row[j] = c_row;
+        ifmap_col_c_col[j] = c_col;
     }
+
+    ifmap_row_limit = ifmap_rows * batch_size;
 }
 
-int64_t OperandMatrix::calc_ifmap_elem_addr(int64_t i, int64_t j, int input_index)
+// Every element of A is in bounds, the tables only hold the row and column
+// strides of its layout. Each source layer holds its own A of per_input_size
+// rows.
+void OperandMatrix::create_gemm_addr_tables(int64_t num_rows, int64_t per_input_size)
 {
-    int64_t offset = ifmap_offset[input_index];
-    int64_t filter_col = filter_cols;
-    int64_t r_stride = row_stride;
-    int64_t c_stride = col_stride;
-    int64_t Ew = ofmap_cols;
-    int64_t channel = num_input_channels;
-
-    int64_t ofmap_row = i / Ew;
-    int64_t ofmap_col = i % Ew;
+    int64_t row_step = ifmap_col_major ? 1 : conv_window_size;
+    int64_t col_step = ifmap_col_major ? per_input_size : 1;
+
+    ifmap_row_addr.resize(num_rows);
+    ifmap_row_i_row.assign(num_rows, 0);
+    ifmap_row_i_col.assign(num_rows, 0);
+    for (int64_t i = 0; i < num_rows; i++) {
+        int64_t source = get_ifmap_source(i, per_input_size);
+        ifmap_row_addr[i] = (i - source * per_input_size) * row_step * word_size + ifmap_offset[source];
+    }
 
-    int64_t i_row = ofmap_row * r_stride;
-    int64_t i_col = ofmap_col * c_stride;
+    ifmap_col_addr.resize(conv_window_size);
+    ifmap_col_c_row.assign(conv_window_size, 0);
+    ifmap_col_c_col.assign(conv_window_size, 0);
+    for (int64_t j = 0; j < conv_window_size; j++)
+        ifmap_col_addr[j] = j * col_step * word_size;
 
-    int64_t window_addr = i_row * ifmap_cols * channel + i_col * channel;
+    ifmap_row_limit = num_rows;
+}
 
-    int64_t c_row = j / (filter_col * channel);
-    int64_t k = j % (filter_col * channel);
-    int64_t c_col = k / channel;
-    int64_t c_ch = k % channel;
-    int64_t ifmap_px_addr = -1;
+int64_t OperandMatrix::get_ifmap_source(int64_t row, int64_t per_input_size)
+{
+    return min(row / per_input_size, (int64_t)ifmap_offset.size() - 1);
+}
 
-    // cout << c_row << ", " << i_row << ", " << ifmap_rows << endl;
-    // cout << c_col << ", " << i_col << ", " << ifmap_cols << endl;
+AddressWindow OperandMatrix::get_addr_window()
+{
+    AddressWindow addr_window;
+    int64_t num_rows = batch_size * ofmap_px_per_filt;
+    if (num_rows == 0 || conv_window_size == 0 || num_filters == 0)
+        return addr_window;
+
+    // Row and column parts are added, their extremes bound every ifmap address
+    auto row_range = minmax_element(ifmap_row_addr.begin(), ifmap_row_addr.end());
+    auto col_range = minmax_element(ifmap_col_addr.begin(), ifmap_col_addr.end());
+    addr_window.merge(AddressWindow(*row_range.first + *col_range.first, *row_range.second + *col_range.second));
+    // Filter addresses grow with both indices in either layout
+    addr_window.merge(AddressWindow(calc_filter_elem_addr(0, 0), calc_filter_elem_addr(conv_window_size - 1, num_filters - 1)));
+    addr_window.merge(AddressWindow(calc_ofmap_elem_addr(0, 0), calc_ofmap_elem_addr(num_rows - 1, num_filters - 1)));
+    return addr_window;
+}
 
-    if ((c_row + i_row >= ifmap_rows * batch_size) || (c_col + i_col >= ifmap_cols))
-    {
-        ifmap_px_addr = -1;
-    }
-    else
-    {
-        int64_t internal_address = c_row * (ifmap_cols * channel) + c_col * channel + c_ch;
-        ifmap_px_addr = (internal_address + window_addr) * word_size + offset;
-    }
-    return ifmap_px_addr;
+inline int64_t OperandMatrix::calc_ifmap_elem_addr(int64_t i, int64_t j)
+{
+    // Window elements that fall outside the ifmap are not fetched
+    if ((ifmap_col_c_row[j] + ifmap_row_i_row[i] >= ifmap_row_limit) || (ifmap_col_c_col[j] + ifmap_row_i_col[i] >= ifmap_cols))
+        return -1;
+    return ifmap_row_addr[i] + ifmap_col_addr[j];
 }
 
-int64_t OperandMatrix::calc_filter_elem_addr(int64_t i, int64_t j)
+inline int64_t OperandMatrix::calc_filter_elem_addr(int64_t i, int64_t j)
 {
     int64_t offset = filter_offset;
-    int64_t filter_row = filter_rows;
-    int64_t filter_col = filter_cols;
-    int64_t channel = num_input_channels;
-    int64_t internal_address = j * filter_row * filter_col * channel + i;
+    int64_t internal_address = i * filter_row_step + j * filter_col_step;
     int64_t filter_px_addr = internal_address * word_size + offset;
     return filter_px_addr;
 }
 
-int64_t OperandMatrix::calc_ofmap_elem_addr(int64_t i, int64_t j)
+inline int64_t OperandMatrix::calc_ofmap_elem_addr(int64_t i, int64_t j)
 {
     int64_t offset = ofmap_offset;
     int64_t num_filt = num_filters;
@@ -247,4 +335,36 @@ int64_t OperandMatrix::calc_ofmap_elem_addr(int64_t i, int64_t j)
     return ofmap_px_addr;
 }
 
+OperandView::OperandView()
+{
+    operand_matrix = NULL;
+    operand = Operand::IFMAP;
+    dims = {0, 0};
+}
+
+OperandView::OperandView(OperandMatrix *operand_matrix, Operand operand, int64_t rows, int64_t cols)
+{
+    this->operand_matrix = operand_matrix;
+    this->operand = operand;
+    dims = {(size_t)rows, (size_t)cols};
+}
+
+inline int64_t OperandView::operator()(int64_t row, int64_t col) const
+{
+    if (operand == Operand::IFMAP)
+        return operand_matrix->calc_ifmap_elem_addr(row, col);
+    else if (operand == Operand::FILTER)
+        return operand_matrix->calc_filter_elem_addr(row, col);
+    return operand_matrix->calc_ofmap_elem_addr(row, col);
+}
+
+xt::xarray<int64_t> OperandView::to_array() const
+{
+    xt::xarray<int64_t> matrix = xt::ones<int64_t>({dims[0], dims[1]});
+    for (int64_t row_idx = 0; row_idx < dims[0]; row_idx++)
+        for (int64_t col_idx = 0; col_idx < dims[1]; col_idx++)
+            matrix(row_idx, col_idx) = (*this)(row_idx, col_idx);
+    return matrix;
+}
+
 #endif
\ No newline at end of file
@@ -9,27 +9,81 @@
 #include "../scale_config.h"
 #include "../topology_utils.h"
 
+#include "demand_stream.h"
+#include "operand_matrix.h"
 #include "../memory/double_buffer_scratchpad_mem.h"
 
 class SystolicCompute {
 public:
     SystolicCompute();
-    // ~SystolicCompute() {}
-    virtual void set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe) = 0;
+    virtual ~SystolicCompute() {}
+    virtual void set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe) = 0;
 
     virtual xt::xarray<int64_t> get_ifmap_prefetch_matrices() = 0;
     virtual xt::xarray<int64_t> get_filter_prefetch_matrices() = 0;
 
-    virtual vector<xt::xarray<int64_t>> get_ifmap_demand_matrices() = 0;
-    virtual vector<xt::xarray<int64_t>> get_filter_demand_matrices() = 0;
-    virtual vector<xt::xarray<int64_t>> get_ofmap_demand_matrices() = 0;
+    // Demand is generated one fold at a time; fold_id runs over [0, get_num_folds())
+    // for every PE and each fold has get_fold_rows() rows.
+    virtual int64_t get_num_folds() = 0;
+    virtual int64_t get_fold_rows() = 0;
+    // Folds run over the row folds of one column fold after the other; the
+    // row folds of the next column fold repeat the same accesses, translated
+    virtual int64_t get_fold_period() = 0;
+    virtual void get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand) = 0;
+
+    int get_num_pe() { return num_pe; }
+    // Merged into any addresses the dataflow adds itself in set_params
+    void set_addr_window(AddressWindow addr_window) { this->addr_window.merge(addr_window); }
+    AddressWindow get_addr_window() { return addr_window; }
 
     virtual float get_avg_mapping_efficiency() = 0;
     virtual float get_avg_compute_utilization() = 0;
+
+protected:
+    int num_pe;
+    AddressWindow addr_window;
+
+    // Only the block_rows rows from block_start can hold requests
+    void reset_fold_demand(PaddedDemand &fold_demand, int64_t rows, int64_t cols, int64_t block_start, int64_t block_rows);
 };
 
 SystolicCompute::SystolicCompute() {
+    num_pe = 1;
+}
+
+void SystolicCompute::reset_fold_demand(PaddedDemand &fold_demand, int64_t rows, int64_t cols, int64_t block_start, int64_t block_rows)
+{
+    fold_demand.reset(rows, cols, block_start, block_rows);
+}
+
+// One operand of one PE, pulled fold by fold from a SystolicCompute.
+class SystolicDemandStream : public DemandStream
+{
+public:
+    SystolicDemandStream(SystolicCompute *compute_system, Operand operand, int pe);
+    int64_t get_num_folds() { return compute_system->get_num_folds(); }
+    int64_t get_fold_rows() { return compute_system->get_fold_rows(); }
+    int64_t get_fold_period() { return compute_system->get_fold_period(); }
+    const PaddedDemand& get_fold(int64_t fold_id, PaddedDemand &fold_buf);
+    AddressWindow get_addr_window() { return compute_system->get_addr_window(); }
+
+private:
+    SystolicCompute *compute_system;
+    Operand operand;
+    int pe;
+};
+
+SystolicDemandStream::SystolicDemandStream(SystolicCompute *compute_system, Operand operand, int pe)
+{
+    this->compute_system = compute_system;
+    this->operand = operand;
+    this->pe = pe;
+}
 
+const PaddedDemand& SystolicDemandStream::get_fold(int64_t fold_id, PaddedDemand &fold_buf)
+{
+    compute_system->get_fold_demand(operand, pe, fold_id, fold_buf);
+    return fold_buf;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -13,7 +13,6 @@ class SystolicComputeIs : public SystolicCompute
 public:
     SystolicComputeIs();
     ~SystolicComputeIs() {
-        cout << "~SystolicComputeIs()" << endl;
         // delete(ifmap_op_mat.data());
         // delete(filter_op_mat.data());
         // delete(ofmap_op_mat.data());
@@ -39,14 +38,15 @@ public:
         // filter_demand_matrix = xt::ones<int64_t>({1, 1});
         // ofmap_demand_matrix = xt::ones<int64_t>({1, 1});
     }
-    void set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe);
+    void set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe);
 
     xt::xarray<int64_t> get_ifmap_prefetch_matrices();
     xt::xarray<int64_t> get_filter_prefetch_matrices();
 
-    vector<xt::xarray<int64_t>> get_ifmap_demand_matrices();
-    vector<xt::xarray<int64_t>> get_filter_demand_matrices();
-    vector<xt::xarray<int64_t>> get_ofmap_demand_matrices();
+    int64_t get_num_folds();
+    int64_t get_fold_rows();
+    int64_t get_fold_period();
+    void get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand);
 
     // int get_arr_row() { return arr_row; }
     // int get_arr_col() { return arr_col; }
@@ -58,23 +58,20 @@ public:
     float get_avg_compute_utilization();
 
 private:
+    void get_ifmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+    void get_filter_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+    void get_ofmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+    void calc_fold_stats();
+
     xt::xarray<int64_t> skew_matrix(xt::xarray<int64_t> input_matrix_np);
     Config *config;
-    xt::xarray<int64_t> ifmap_op_mat;
-    xt::xarray<int64_t> filter_op_mat;
-    xt::xarray<int64_t> ofmap_op_mat;
-
-    xt::xarray<int64_t> ifmap_op_mat_trans;
+    OperandView ifmap_op_mat;
+    OperandView filter_op_mat;
+    OperandView ofmap_op_mat;
 
     xt::xarray<int64_t> ifmap_prefetch_matrix;
     xt::xarray<int64_t> filter_prefetch_matrix;
 
-    xt::xarray<int64_t> ifmap_demand_matrix;
-    xt::xarray<int64_t> filter_demand_matrix;
-    xt::xarray<int64_t> ofmap_demand_matrix;
-
-    int num_pe;
-
     int ifmap_col;
     int filter_row;
 
@@ -103,7 +100,7 @@ SystolicComputeIs::SystolicComputeIs()
     ofmap_writes = 0;
 }
 
-void SystolicComputeIs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe)
+void SystolicComputeIs::set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe)
 {
     this->config = config;
     this->ifmap_op_mat = ifmap_op_mat;
@@ -114,8 +111,6 @@ void SystolicComputeIs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op
     ifmap_col = this->ifmap_op_mat.shape()[1];
     filter_row = this->filter_op_mat.shape()[0];
 
-    ifmap_op_mat_trans = xt::transpose(ifmap_op_mat);
-
     Sr = ifmap_op_mat.shape()[1];
     Sc = ifmap_op_mat.shape()[0];
     T = filter_op_mat.shape()[1];
@@ -128,6 +123,8 @@ void SystolicComputeIs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op
     col_fold = (Sc + arr_col - 1) / arr_col;
 
     cout << "row_fold " << row_fold << ", col_fold " << col_fold << endl;
+
+    calc_fold_stats();
 }
 
 xt::xarray<int64_t> SystolicComputeIs::get_ifmap_prefetch_matrices()
@@ -138,6 +135,8 @@ xt::xarray<int64_t> SystolicComputeIs::get_ifmap_prefetch_matrices()
 
     cout << "get_ifmap_prefetch_matrices()" << endl;
     cout << "ifmap_op_mat shape is " << ifmap_op_mat.shape()[0] << ", " << ifmap_op_mat.shape()[1] << endl;
+    // The prefetch matrices are built from whole operands
+    xt::xarray<int64_t> ifmap_op_mat_trans = xt::transpose(ifmap_op_mat.to_array());
     cout << "ifmap_op_mat_trans shape is " << ifmap_op_mat_trans.shape()[0] << ", " << ifmap_op_mat_trans.shape()[1] << endl;
 
     for (int fc = 0; fc < col_fold; fc++)
@@ -168,6 +167,7 @@ xt::xarray<int64_t> SystolicComputeIs::get_filter_prefetch_matrices()
 {
     cout << "get_filter_prefetch_matrices()" << endl;
     cout << "filter_op_mat shape is " << filter_op_mat.shape()[0] << ", " << filter_op_mat.shape()[1] << endl;
+    xt::xarray<int64_t> filter_mat = filter_op_mat.to_array();
 
     int basic_iter = filter_op_mat.shape()[1];
     filter_prefetch_matrix = xt::ones<int64_t>({basic_iter * row_fold, arr_col});
@@ -181,7 +181,7 @@ xt::xarray<int64_t> SystolicComputeIs::get_filter_prefetch_matrices()
 
         int delta = arr_row - (end_row_idx - start_row_idx);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_op_mat, xt::range(start_row_idx, end_row_idx), xt::all());
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_mat, xt::range(start_row_idx, end_row_idx), xt::all());
         this_fold_prefetch = xt::transpose(this_fold_prefetch);
 
         if (delta > 0)
@@ -225,181 +225,111 @@ xt::xarray<int64_t> SystolicComputeIs::get_filter_prefetch_matrices()
 }
 
 
-vector<xt::xarray<int64_t>> SystolicComputeIs::get_ifmap_demand_matrices()
+int64_t SystolicComputeIs::get_num_folds()
 {
-    cout << "get_ifmap_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> ifmap_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        // int inter_fold_gap_suffix = arr_row + arr_col + T - 2;
-        int inter_fold_gap_suffix =  arr_col + T - 1;
-        xt::xarray<int64_t> inter_fold_gap_prefix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_col}) * -1;
-
-        // int basic_iter = 2 * arr_row - 1 + arr_col - 1 + filter_op_mat.shape()[1];
-        int basic_iter = arr_row + arr_col - 1 + filter_op_mat.shape()[1];
-        ifmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
-
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold + fr;
-                // cout << "ofmap index " << index << " of " << col_fold * row_fold << endl;
-                int row_start_id = fr * arr_row;
-                int row_end_idx = min(row_start_id + arr_row, Sr);
-                int row_delta = arr_row - (row_end_idx - row_start_id);
-
-                int col_start_id = fc * arr_col;
-                int col_end_idx = min(col_start_id + arr_col, Sc);
-                int col_delta = arr_col - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ifmap_op_mat_trans, xt::range(row_start_id, row_end_idx), xt::range(col_start_id, col_end_idx));
-                ifmap_reads += ifmap_op_mat.shape()[0] * ifmap_op_mat.shape()[1];
-
-                if (col_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({(int)this_fold_demand.shape()[0], col_delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
+    return (int64_t)col_fold * row_fold;
+}
 
-                if (row_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({row_delta, arr_col}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 0);
-                }
+int64_t SystolicComputeIs::get_fold_rows()
+{
+    return arr_row + arr_col - 1 + T;
+}
 
-                // this_fold_demand = xt::flip(this_fold_demand, 0);
+int64_t SystolicComputeIs::get_fold_period()
+{
+    return row_fold;
+}
 
-                this_fold_demand = xt::concatenate(xtuple(inter_fold_gap_prefix_mat, this_fold_demand), 0);
+void SystolicComputeIs::get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand)
+{
+    int fc = fold_id / row_fold;
+    int fr = fold_id % row_fold;
+
+    if (operand == Operand::IFMAP)
+        get_ifmap_fold_demand(fc, fr, fold_demand);
+    else if (operand == Operand::FILTER)
+        get_filter_fold_demand(fc, fr, fold_demand);
+    else
+        get_ofmap_fold_demand(fc, fr, fold_demand);
+}
 
-                // cout << "this_fold_demand shape is " << this_fold_demand.shape()[0] << ", " << this_fold_demand.shape()[1] << endl;
+void SystolicComputeIs::get_ifmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
+{
+    int inter_fold_gap_prefix = arr_col + T - 1;
 
+    int row_start_id = fr * arr_row;
+    int row_end_idx = min(row_start_id + arr_row, Sr);
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_col, inter_fold_gap_prefix, row_end_idx - row_start_id);
 
-                int row_used = min(arr_row, row_end_idx - row_start_id);
-                int col_used = min(arr_col, col_end_idx - col_start_id);
-                int mac_used = row_used * col_used;
-                float mapping_eff_this_fold = (float)mac_used / (arr_row * arr_col);
+    int col_start_id = fc * arr_col;
+    int col_end_idx = min(col_start_id + arr_col, Sc);
 
-                int cycles_this_fold = this_fold_demand.shape()[0] + this_fold_demand.shape()[1] - 1;
-                int compute_cycles_this_fold = mac_used * T;
-                float compute_util_this_fold = (float)compute_cycles_this_fold / (arr_row * arr_col * cycles_this_fold);
+    for (int r = row_start_id; r < row_end_idx; r++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(inter_fold_gap_prefix + r - row_start_id, c - col_start_id) = ifmap_op_mat(c, r);
+}
 
-                mapping_efficiency_per_fold.push_back(mapping_eff_this_fold);
-                compute_utility_per_fold.push_back(compute_util_this_fold);
+void SystolicComputeIs::get_filter_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
+{
+    int inter_fold_gap_prefix = arr_row;
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, inter_fold_gap_prefix, T);
 
-                // this_fold_demand = skew_matrix(this_fold_demand);
+    int row_start_id = fr * arr_row;
+    int row_end_idx = min(row_start_id + arr_row, Sr);
 
-                xt::view(ifmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "ifmap_demand_matrix shape is " << ifmap_demand_matrix.shape()[0] << ", " << ifmap_demand_matrix.shape()[1] << endl;
-        cout << ifmap_demand_matrix << endl;
-        ifmap_demand_matrix_vector.push_back(ifmap_demand_matrix);
-    }
-    return ifmap_demand_matrix_vector;
+    for (int t = 0; t < T; t++)
+        for (int r = row_start_id; r < row_end_idx; r++)
+            fold_demand(inter_fold_gap_prefix + t, r - row_start_id) = filter_op_mat(r, t);
 }
 
-vector<xt::xarray<int64_t>> SystolicComputeIs::get_filter_demand_matrices()
+void SystolicComputeIs::get_ofmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
 {
-    cout << "get_filter_demand_matrices()" << endl;
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, T);
 
-    vector<xt::xarray<int64_t>> filter_demand_matrix_vector;
+    int col_start_id = fc * arr_col;
+    int col_end_idx = min(col_start_id + arr_row, Sc);
 
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_prefix = arr_row;
-        xt::xarray<int64_t> inter_fold_gap_prefix_mat = xt::ones<int64_t>({inter_fold_gap_prefix, arr_row}) * -1;
-
-        int inter_fold_gap_suffix = arr_col - 1;
-        xt::xarray<int64_t> inter_fold_gap_suffix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_row}) * -1;
+    for (int t = 0; t < T; t++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(t, c - col_start_id) = ofmap_op_mat(c, t);
+}
 
-        // int basic_iter = 2 * arr_row - 1 + arr_col - 1 + filter_op_mat.shape()[1];
-        int basic_iter = arr_row + arr_col - 1 + filter_op_mat.shape()[1];
-        filter_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+void SystolicComputeIs::calc_fold_stats()
+{
+    mapping_efficiency_per_fold.clear();
+    compute_utility_per_fold.clear();
 
+    for (int i = 0; i < num_pe; i++)
+    {
         for (int fc = 0; fc < col_fold; fc++)
         {
             for (int fr = 0; fr < row_fold; fr++)
             {
-                int index = fc * row_fold + fr;
-                // cout << "filter index " << index << " of " << col_fold * row_fold << endl;
                 int row_start_id = fr * arr_row;
                 int row_end_idx = min(row_start_id + arr_row, Sr);
-                int row_delta = arr_row - (row_end_idx - row_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(filter_op_mat, xt::range(row_start_id, row_end_idx), xt::all());
-                this_fold_demand = xt::transpose(this_fold_demand);
-                filter_reads += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
-
-                if (row_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, row_delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-
-                this_fold_demand = xt::concatenate(xtuple(inter_fold_gap_prefix_mat, this_fold_demand), 0);
-                this_fold_demand = xt::concatenate(xtuple(this_fold_demand, inter_fold_gap_suffix_mat), 0);
-
-                // cout << "this_fold_demand shape is " << this_fold_demand.shape()[0] << ", " << this_fold_demand.shape()[1] << endl;
-                // this_fold_demand = skew_matrix(this_fold_demand);
-
-                xt::view(filter_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "filter_demand_matrix shape is " << filter_demand_matrix.shape()[0] << ", " << filter_demand_matrix.shape()[1] << endl;
-        cout << filter_demand_matrix << endl;
-        filter_demand_matrix_vector.push_back(filter_demand_matrix);
-    }
-    return filter_demand_matrix_vector;
-}
-
-vector<xt::xarray<int64_t>> SystolicComputeIs::get_ofmap_demand_matrices()
-{
-    cout << "get_ofmap_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> ofmap_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_suffix = 2 * arr_row - 1;
-        xt::xarray<int64_t> inter_fold_gap_suffix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_row}) * -1;
 
-        // int basic_iter = 2 * arr_row - 1 + arr_col - 1 + filter_op_mat.shape()[1];
-        int basic_iter = arr_row + arr_col - 1 + filter_op_mat.shape()[1];
-        ofmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
-
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold + fr;
-                // cout << "input index " << index << " of " << col_fold * row_fold << endl;
                 int col_start_id = fc * arr_col;
-                int col_end_idx = min(col_start_id + arr_row, Sc);
-                int delta = arr_row - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ofmap_op_mat, xt::range(col_start_id, col_end_idx), xt::all());
-                this_fold_demand = xt::transpose(this_fold_demand);
-                ofmap_writes += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
+                int col_end_idx = min(col_start_id + arr_col, Sc);
 
-                if (delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
+                int row_used = min(arr_row, row_end_idx - row_start_id);
+                int col_used = min(arr_col, col_end_idx - col_start_id);
+                int mac_used = row_used * col_used;
+                float mapping_eff_this_fold = (float)mac_used / (arr_row * arr_col);
 
-                // cout << "this_fold_demand shape is " << this_fold_demand.shape()[0] << ", " << this_fold_demand.shape()[1] << endl;
+                // Prefix gap plus the ifmap fold, skewed across the array columns
+                int cycles_this_fold = arr_col + T - 1 + arr_row + arr_col - 1;
+                int compute_cycles_this_fold = mac_used * T;
+                float compute_util_this_fold = (float)compute_cycles_this_fold / (arr_row * arr_col * cycles_this_fold);
 
-                this_fold_demand = xt::concatenate(xtuple(this_fold_demand, inter_fold_gap_suffix_mat), 0);
-                // this_fold_demand = skew_matrix(this_fold_demand);
+                mapping_efficiency_per_fold.push_back(mapping_eff_this_fold);
+                compute_utility_per_fold.push_back(compute_util_this_fold);
 
-                xt::view(ofmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
+                ifmap_reads += ifmap_op_mat.shape()[0] * ifmap_op_mat.shape()[1];
+                filter_reads += T * row_used;
+                ofmap_writes += T * min(arr_row, Sc - col_start_id);
             }
         }
-        cout << "ofmap_demand_matrix shape is " << ofmap_demand_matrix.shape()[0] << ", " << ofmap_demand_matrix.shape()[1] << endl;
-        cout << ofmap_demand_matrix << endl;
-        ofmap_demand_matrix_vector.push_back(ofmap_demand_matrix);
     }
-    return ofmap_demand_matrix_vector;
 }
 
 xt::xarray<int64_t> SystolicComputeIs::skew_matrix(xt::xarray<int64_t> input_matrix_np)
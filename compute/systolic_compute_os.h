@@ -13,7 +13,6 @@ class SystolicComputeOs : public SystolicCompute
 public:
     SystolicComputeOs();
     ~SystolicComputeOs() {
-        cout << "~SystolicComputeOs()" << endl;
         // delete(ifmap_op_mat.data());
         // delete(filter_op_mat.data());
         // delete(ofmap_op_mat.data());
@@ -27,14 +26,15 @@ public:
         // delete(filter_demand_matrix.data());
         // delete(ofmap_demand_matrix.data());
     }
-    void set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe);
+    void set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe);
 
     xt::xarray<int64_t> get_ifmap_prefetch_matrices();
     xt::xarray<int64_t> get_filter_prefetch_matrices();
 
-    vector<xt::xarray<int64_t>> get_ifmap_demand_matrices();
-    vector<xt::xarray<int64_t>> get_filter_demand_matrices();
-    vector<xt::xarray<int64_t>> get_ofmap_demand_matrices();
+    int64_t get_num_folds();
+    int64_t get_fold_rows();
+    int64_t get_fold_period();
+    void get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand);
 
     // int get_arr_row() { return arr_row; }
     // int get_arr_col() { return arr_col; }
@@ -46,23 +46,20 @@ public:
     float get_avg_compute_utilization();
 
 private:
+    void get_ifmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+    void get_filter_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+    void get_ofmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+    void calc_fold_stats();
+
     xt::xarray<int64_t> skew_matrix(xt::xarray<int64_t> input_matrix_np);
     Config *config;
-    xt::xarray<int64_t> ifmap_op_mat;
-    xt::xarray<int64_t> filter_op_mat;
-    xt::xarray<int64_t> ofmap_op_mat;
-
-    xt::xarray<int64_t> ifmap_op_mat_trans;
+    OperandView ifmap_op_mat;
+    OperandView filter_op_mat;
+    OperandView ofmap_op_mat;
 
     xt::xarray<int64_t> ifmap_prefetch_matrix;
     xt::xarray<int64_t> filter_prefetch_matrix;
 
-    xt::xarray<int64_t> ifmap_demand_matrix;
-    xt::xarray<int64_t> filter_demand_matrix;
-    xt::xarray<int64_t> ofmap_demand_matrix;
-
-    int num_pe;
-
     int ifmap_col;
     int filter_row;
 
@@ -91,7 +88,7 @@ SystolicComputeOs::SystolicComputeOs()
     ofmap_writes = 0;
 }
 
-void SystolicComputeOs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe)
+void SystolicComputeOs::set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe)
 {
     this->config = config;
     this->ifmap_op_mat = ifmap_op_mat;
@@ -102,8 +99,6 @@ void SystolicComputeOs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op
     ifmap_col = this->ifmap_op_mat.shape()[1];
     filter_row = this->filter_op_mat.shape()[0];
 
-    ifmap_op_mat_trans = xt::transpose(ifmap_op_mat);
-
     Sr = ifmap_op_mat.shape()[0];
     Sc = filter_op_mat.shape()[1];
     T = ifmap_op_mat.shape()[1];
@@ -116,6 +111,8 @@ void SystolicComputeOs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op
     col_fold = (Sc + arr_col - 1) / arr_col;
 
     cout << "row_fold " << row_fold << ", col_fold " << col_fold << endl;
+
+    calc_fold_stats();
 }
 
 xt::xarray<int64_t> SystolicComputeOs::get_ifmap_prefetch_matrices()
@@ -126,6 +123,8 @@ xt::xarray<int64_t> SystolicComputeOs::get_ifmap_prefetch_matrices()
 
     cout << "get_ifmap_prefetch_matrices()" << endl;
     cout << "ifmap_op_mat shape is " << ifmap_op_mat.shape()[0] << ", " << ifmap_op_mat.shape()[1] << endl;
+    // The prefetch matrices are built from whole operands
+    xt::xarray<int64_t> ifmap_op_mat_trans = xt::transpose(ifmap_op_mat.to_array());
     cout << "ifmap_op_mat_trans shape is " << ifmap_op_mat_trans.shape()[0] << ", " << ifmap_op_mat_trans.shape()[1] << endl;
 
     for (int fr = 0; fr < row_fold; fr++)
@@ -183,6 +182,7 @@ xt::xarray<int64_t> SystolicComputeOs::get_filter_prefetch_matrices()
 {
     cout << "get_filter_prefetch_matrices()" << endl;
     cout << "filter_op_mat shape is " << filter_op_mat.shape()[0] << ", " << filter_op_mat.shape()[1] << endl;
+    xt::xarray<int64_t> filter_mat = filter_op_mat.to_array();
     int basic_iter = filter_op_mat.shape()[0];
     filter_prefetch_matrix = xt::ones<int64_t>({basic_iter * col_fold, arr_row});
 
@@ -194,7 +194,7 @@ xt::xarray<int64_t> SystolicComputeOs::get_filter_prefetch_matrices()
 
         int delta = arr_col - (col_end_id - col_start_id);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_op_mat, xt::all(), xt::range(col_start_id, col_end_id));
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_mat, xt::all(), xt::range(col_start_id, col_end_id));
 
         // cout << "this_fold_prefetch shape is " << this_fold_prefetch.shape()[0] << ", " << this_fold_prefetch.shape()[1] << endl;
 
@@ -238,170 +238,113 @@ xt::xarray<int64_t> SystolicComputeOs::get_filter_prefetch_matrices()
     return filter_prefetch_matrix;
 }
 
-vector<xt::xarray<int64_t>> SystolicComputeOs::get_ifmap_demand_matrices()
+int64_t SystolicComputeOs::get_num_folds()
 {
-    cout << "get_ifmap_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> ifmap_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_suffix = arr_col - 1;
-        xt::xarray<int64_t> inter_fold_gap_suffix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_row}) * -1;
+    return (int64_t)col_fold * row_fold;
+}
 
-        // int basic_iter = arr_row - 1 + arr_col - 1 + ifmap_op_mat.shape()[1];
-        int basic_iter = arr_col - 1 + ifmap_op_mat.shape()[1];
-        ifmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+int64_t SystolicComputeOs::get_fold_rows()
+{
+    return arr_col - 1 + T;
+}
 
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold + fr;
-                // cout << "input index " << index << " of " << col_fold * row_fold << endl;
-                int row_start_id = fr * arr_row;
-                int row_end_idx = min(row_start_id + arr_row, Sr);
-                int delta = arr_row - (row_end_idx - row_start_id);
+int64_t SystolicComputeOs::get_fold_period()
+{
+    return row_fold;
+}
 
-                xt::xarray<int64_t> this_fold_demand = xt::view(ifmap_op_mat_trans, xt::all(), xt::range(row_start_id, row_end_idx));
-                ifmap_reads += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
+void SystolicComputeOs::get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand)
+{
+    int fc = fold_id / row_fold;
+    int fr = fold_id % row_fold;
+
+    if (operand == Operand::IFMAP)
+        get_ifmap_fold_demand(fc, fr, fold_demand);
+    else if (operand == Operand::FILTER)
+        get_filter_fold_demand(fc, fr, fold_demand);
+    else
+        get_ofmap_fold_demand(fc, fr, fold_demand);
+}
 
-                if (delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
+void SystolicComputeOs::get_ifmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
+{
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, T);
 
-                this_fold_demand = xt::concatenate(xtuple(this_fold_demand, inter_fold_gap_suffix_mat), 0);
-                // this_fold_demand = skew_matrix(this_fold_demand);
+    int row_start_id = fr * arr_row;
+    int row_end_idx = min(row_start_id + arr_row, Sr);
 
-                xt::view(ifmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "ifmap_demand_matrix shape is " << ifmap_demand_matrix.shape()[0] << ", " << ifmap_demand_matrix.shape()[1] << endl;
-        cout << ifmap_demand_matrix << endl;
-        ifmap_demand_matrix_vector.push_back(ifmap_demand_matrix);
-    }
-    return ifmap_demand_matrix_vector;
+    for (int t = 0; t < T; t++)
+        for (int r = row_start_id; r < row_end_idx; r++)
+            fold_demand(t, r - row_start_id) = ifmap_op_mat(r, t);
 }
 
-
-vector<xt::xarray<int64_t>> SystolicComputeOs::get_filter_demand_matrices()
+void SystolicComputeOs::get_filter_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
 {
-    cout << "get_filter_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> filter_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_suffix = arr_row - 1;
-        xt::xarray<int64_t> inter_fold_gap_suffix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_col}) * -1;
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_col, 0, T);
 
-        // int basic_iter = arr_row - 1 + arr_col - 1 + ifmap_op_mat.shape()[1];
-        int basic_iter = arr_col - 1 + ifmap_op_mat.shape()[1];
-        filter_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+    int col_start_id = fc * arr_col;
+    int col_end_idx = min(col_start_id + arr_col, Sc);
 
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold + fr;
-                // cout << "filter index " << index << " of " << col_fold * row_fold << endl;
-                int col_start_id = fc * arr_col;
-                int col_end_idx = min(col_start_id + arr_col, Sc);
-                int delta = arr_col - (col_end_idx - col_start_id);
+    for (int t = 0; t < T; t++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(t, c - col_start_id) = filter_op_mat(t, c);
+}
 
-                xt::xarray<int64_t> this_fold_demand = xt::view(filter_op_mat, xt::all(), xt::range(col_start_id, col_end_idx));
-                filter_reads += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
+void SystolicComputeOs::get_ofmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
+{
+    int inter_fold_gap_prefix = T - 1;
 
-                if (delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
+    int row_start_id = fr * arr_row;
+    int row_end_idx = min(row_start_id + arr_row, Sr);
 
-                this_fold_demand = xt::concatenate(xtuple(this_fold_demand, inter_fold_gap_suffix_mat), 0);
+    int col_start_id = fc * arr_col;
+    int col_end_idx = min(col_start_id + arr_col, Sc);
 
-                // this_fold_demand = skew_matrix(this_fold_demand);
+    int fold_used_rows = row_end_idx - row_start_id;
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_col, inter_fold_gap_prefix + arr_row - fold_used_rows, fold_used_rows);
 
-                xt::view(filter_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "filter_demand_matrix shape is " << filter_demand_matrix.shape()[0] << ", " << filter_demand_matrix.shape()[1] << endl;
-        cout << filter_demand_matrix << endl;
-        filter_demand_matrix_vector.push_back(filter_demand_matrix);
-    }
-    return filter_demand_matrix_vector;
+    // Outputs drain bottom row first, so the padded fold is flipped vertically
+    for (int r = row_start_id; r < row_end_idx; r++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(inter_fold_gap_prefix + arr_row - 1 - (r - row_start_id), c - col_start_id) = ofmap_op_mat(r, c);
 }
 
-vector<xt::xarray<int64_t>> SystolicComputeOs::get_ofmap_demand_matrices()
+void SystolicComputeOs::calc_fold_stats()
 {
-    cout << "get_ofmap_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> ofmap_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_suffix = T - 1;
-        xt::xarray<int64_t> inter_fold_gap_prefix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_col}) * -1;
-
-        // int basic_iter = arr_row - 1 + arr_col - 1 + ifmap_op_mat.shape()[1];
-        int basic_iter = arr_col - 1 + ifmap_op_mat.shape()[1];
-        ofmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+    mapping_efficiency_per_fold.clear();
+    compute_utility_per_fold.clear();
 
+    for (int i = 0; i < num_pe; i++)
+    {
         for (int fc = 0; fc < col_fold; fc++)
         {
             for (int fr = 0; fr < row_fold; fr++)
             {
-                int index = fc * row_fold + fr;
-                // cout << "ofmap index " << index << " of " << col_fold * row_fold << endl;
                 int row_start_id = fr * arr_row;
                 int row_end_idx = min(row_start_id + arr_row, Sr);
-                int row_delta = arr_row - (row_end_idx - row_start_id);
 
                 int col_start_id = fc * arr_col;
                 int col_end_idx = min(col_start_id + arr_col, Sc);
-                int col_delta = arr_col - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ofmap_op_mat, xt::range(row_start_id, row_end_idx), xt::range(col_start_id, col_end_idx));
-                ofmap_writes += ofmap_op_mat.shape()[0] * ofmap_op_mat.shape()[1];
-
-                if (col_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({(int)this_fold_demand.shape()[0], col_delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-
-                if (row_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({row_delta, arr_col}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 0);
-                }
-
-                this_fold_demand = xt::flip(this_fold_demand, 0);
-                ofmap_writes += this_fold_demand.shape()[0] + this_fold_demand.shape()[1];
-
-                this_fold_demand = xt::concatenate(xtuple(inter_fold_gap_prefix_mat, this_fold_demand), 0);
 
                 int row_used = min(arr_row, row_end_idx - row_start_id);
                 int col_used = min(arr_col, col_end_idx - col_start_id);
                 int mac_used = row_used * col_used;
                 float mapping_eff_this_fold = (float)mac_used / (arr_row * arr_col);
 
-                int cycles_this_fold = this_fold_demand.shape()[0] + this_fold_demand.shape()[1] - 1;
+                // Prefix gap plus the flipped ofmap fold, skewed across the array columns
+                int cycles_this_fold = T - 1 + arr_row + arr_col - 1;
                 int compute_cycles_this_fold = mac_used * T;
                 float compute_util_this_fold = (float)compute_cycles_this_fold / (arr_row * arr_col * cycles_this_fold);
 
                 mapping_efficiency_per_fold.push_back(mapping_eff_this_fold);
                 compute_utility_per_fold.push_back(compute_util_this_fold);
 
-                // this_fold_demand = skew_matrix(this_fold_demand);
-
-                xt::view(ofmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
+                ifmap_reads += T * row_used;
+                filter_reads += T * col_used;
+                ofmap_writes += ofmap_op_mat.shape()[0] * ofmap_op_mat.shape()[1] + arr_row + arr_col;
             }
         }
-        cout << "ofmap_demand_matrix shape is " << ofmap_demand_matrix.shape()[0] << ", " << ofmap_demand_matrix.shape()[1] << endl;
-        cout << ofmap_demand_matrix << endl;
-        ofmap_demand_matrix_vector.push_back(ofmap_demand_matrix);
     }
-    return ofmap_demand_matrix_vector;
 }
 
 xt::xarray<int64_t> SystolicComputeOs::skew_matrix(xt::xarray<int64_t> input_matrix_np)
@@ -13,7 +13,6 @@ class SystolicComputeWs : public SystolicCompute
 public:
     SystolicComputeWs();
     ~SystolicComputeWs() {
-        cout << "~SystolicComputeWs()" << endl;
         // delete(ifmap_op_mat.data());
         // delete(filter_op_mat.data());
         // delete(ofmap_op_mat.data());
@@ -39,36 +38,34 @@ public:
         // filter_demand_matrix = xt::ones<int64_t>({1, 1});
         // ofmap_demand_matrix = xt::ones<int64_t>({1, 1});
     }
-    void set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe);
+    void set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe);
 
     xt::xarray<int64_t> get_ifmap_prefetch_matrices();
     xt::xarray<int64_t> get_filter_prefetch_matrices();
 
-    vector<xt::xarray<int64_t>> get_ifmap_demand_matrices();
-    vector<xt::xarray<int64_t>> get_filter_demand_matrices();
-    vector<xt::xarray<int64_t>> get_ofmap_demand_matrices();
+    int64_t get_num_folds();
+    int64_t get_fold_rows();
+    int64_t get_fold_period();
+    void get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand);
 
     float get_avg_mapping_efficiency();
     float get_avg_compute_utilization();
 
 private:
+    void get_ifmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+    void get_filter_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand);
+    void get_ofmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand);
+    void calc_fold_stats();
+
     xt::xarray<int64_t> skew_matrix(xt::xarray<int64_t> input_matrix_np);
     Config *config;
-    xt::xarray<int64_t> ifmap_op_mat;
-    xt::xarray<int64_t> filter_op_mat;
-    xt::xarray<int64_t> ofmap_op_mat;
-
-    xt::xarray<int64_t> ifmap_op_mat_trans;
+    OperandView ifmap_op_mat;
+    OperandView filter_op_mat;
+    OperandView ofmap_op_mat;
 
     xt::xarray<int64_t> ifmap_prefetch_matrix;
     xt::xarray<int64_t> filter_prefetch_matrix;
 
-    xt::xarray<int64_t> ifmap_demand_matrix;
-    xt::xarray<int64_t> filter_demand_matrix;
-    xt::xarray<int64_t> ofmap_demand_matrix;
-
-    int num_pe;
-
     int ifmap_col;
     int filter_row;
 
@@ -97,7 +94,7 @@ SystolicComputeWs::SystolicComputeWs()
     ofmap_writes = 0;
 }
 
-void SystolicComputeWs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe)
+void SystolicComputeWs::set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe)
 {
     this->config = config;
     this->ifmap_op_mat = ifmap_op_mat;
@@ -108,8 +105,6 @@ void SystolicComputeWs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op
     ifmap_col = this->ifmap_op_mat.shape()[1];
     filter_row = this->filter_op_mat.shape()[0];
 
-    ifmap_op_mat_trans = xt::transpose(ifmap_op_mat);
-
     Sr = ifmap_op_mat.shape()[1];
     Sc = filter_op_mat.shape()[1];
     T = ifmap_op_mat.shape()[0];
@@ -122,6 +117,8 @@ void SystolicComputeWs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op
     col_fold = (Sc + arr_col - 1) / (arr_col * num_pe);
 
     cout << "row_fold " << row_fold << ", col_fold " << col_fold << endl;
+
+    calc_fold_stats();
 }
 
 xt::xarray<int64_t> SystolicComputeWs::get_ifmap_prefetch_matrices()
@@ -132,7 +129,8 @@ xt::xarray<int64_t> SystolicComputeWs::get_ifmap_prefetch_matrices()
 
     cout << "get_ifmap_prefetch_matrices()" << endl;
     cout << "ifmap_op_mat shape is " << ifmap_op_mat.shape()[0] << ", " << ifmap_op_mat.shape()[1] << endl;
-    cout << "ifmap_op_mat_trans shape is " << ifmap_op_mat_trans.shape()[0] << ", " << ifmap_op_mat_trans.shape()[1] << endl;
+    // The prefetch matrices are built from whole operands
+    xt::xarray<int64_t> ifmap_mat = ifmap_op_mat.to_array();
 
     for (int fr = 0; fr < row_fold; fr++)
     {
@@ -143,7 +141,7 @@ xt::xarray<int64_t> SystolicComputeWs::get_ifmap_prefetch_matrices()
 
         int delta = arr_row - (end_col_idx - start_col_idx);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(ifmap_op_mat, xt::all(), xt::range(start_col_idx, end_col_idx));
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(ifmap_mat, xt::all(), xt::range(start_col_idx, end_col_idx));
 
         if (delta > 0)
         {
@@ -189,6 +187,7 @@ xt::xarray<int64_t> SystolicComputeWs::get_filter_prefetch_matrices()
 {
     cout << "get_filter_prefetch_matrices()" << endl;
     cout << "filter_op_mat shape is " << filter_op_mat.shape()[0] << ", " << filter_op_mat.shape()[1] << endl;
+    xt::xarray<int64_t> filter_mat = filter_op_mat.to_array();
     int basic_iter = filter_op_mat.shape()[0];
     filter_prefetch_matrix = xt::ones<int64_t>({basic_iter * col_fold, arr_row});
 
@@ -200,7 +199,7 @@ xt::xarray<int64_t> SystolicComputeWs::get_filter_prefetch_matrices()
 
         int delta = arr_col - (col_end_id - col_start_id);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_op_mat, xt::all(), xt::range(col_start_id, col_end_id));
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_mat, xt::all(), xt::range(col_start_id, col_end_id));
 
         if (delta > 0)
         {
@@ -219,174 +218,111 @@ xt::xarray<int64_t> SystolicComputeWs::get_filter_prefetch_matrices()
     return filter_prefetch_matrix;
 }
 
-vector<xt::xarray<int64_t>> SystolicComputeWs::get_ifmap_demand_matrices()
+int64_t SystolicComputeWs::get_num_folds()
+{
+    return (int64_t)col_fold * row_fold;
+}
+
+int64_t SystolicComputeWs::get_fold_rows()
+{
+    return arr_row + arr_col - 1 + T;
+}
+
+int64_t SystolicComputeWs::get_fold_period()
+{
+    return row_fold;
+}
+
+void SystolicComputeWs::get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand)
 {
-    cout << "get_ifmap_demand_matrices()" << endl;
+    int fc = fold_id / row_fold;
+    int fr = fold_id % row_fold;
+
+    if (operand == Operand::IFMAP)
+        get_ifmap_fold_demand(fc, fr, fold_demand);
+    else if (operand == Operand::FILTER)
+        get_filter_fold_demand(pe, fc, fr, fold_demand);
+    else
+        get_ofmap_fold_demand(pe, fc, fr, fold_demand);
+}
 
-    vector<xt::xarray<int64_t>> ifmap_demand_matrix_vector;
+void SystolicComputeWs::get_ifmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
+{
+    int inter_fold_gap_prefix = arr_row;
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, inter_fold_gap_prefix, T);
 
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_prefix = arr_row;
-        xt::xarray<int64_t> inter_fold_gap_prefix_mat = xt::ones<int64_t>({inter_fold_gap_prefix, arr_row}) * -1;
+    int col_start_id = fr * arr_row;
+    int col_end_idx = min(col_start_id + arr_row, Sr);
 
-        int inter_fold_gap_suffix = arr_col - 1;
-        xt::xarray<int64_t> inter_fold_gap_suffix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_row}) * -1;
+    for (int t = 0; t < T; t++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(inter_fold_gap_prefix + t, c - col_start_id) = ifmap_op_mat(t, c);
+}
 
-        // int basic_iter = 2 * arr_row - 1 + arr_col - 1 + ifmap_op_mat.shape()[0];
-        int basic_iter = arr_row + arr_col - 1 + ifmap_op_mat.shape()[0];
+void SystolicComputeWs::get_filter_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand)
+{
+    int row_start_id = fr * arr_row;
+    int row_end_idx = min(row_start_id + arr_row, Sr);
 
-        ifmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+    int col_start_id = (pe * col_fold + fc) * arr_col;
+    int col_end_idx = min(col_start_id + arr_col, Sc);
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, col_end_idx - col_start_id);
 
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold + fr;
-                // cout << "input index " << index << " of " << col_fold * row_fold << endl;
-                int col_start_id = fr * arr_row;
-                int col_end_idx = min(col_start_id + arr_row, Sr);
-                int delta = arr_row - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ifmap_op_mat, xt::all(), xt::range(col_start_id, col_end_idx));
-                ifmap_reads += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
-
-                if (delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-
-                this_fold_demand = xt::concatenate(xtuple(inter_fold_gap_prefix_mat, this_fold_demand), 0);
-                this_fold_demand = xt::concatenate(xtuple(this_fold_demand, inter_fold_gap_suffix_mat), 0);
-                // this_fold_demand = xt::transpose(this_fold_demand);
-                // this_fold_demand = skew_matrix(this_fold_demand);
-        
-                xt::view(ifmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "ifmap_demand_matrix shape is " << ifmap_demand_matrix.shape()[0] << ", " << ifmap_demand_matrix.shape()[1] << endl;
-        cout << ifmap_demand_matrix << endl;
-        ifmap_demand_matrix_vector.push_back(ifmap_demand_matrix);
-    }
-    return ifmap_demand_matrix_vector;
+    // The fold is transposed: filter column c is fed in demand row c
+    for (int c = col_start_id; c < col_end_idx; c++)
+        for (int r = row_start_id; r < row_end_idx; r++)
+            fold_demand(c - col_start_id, r - row_start_id) = filter_op_mat(r, c);
 }
 
-vector<xt::xarray<int64_t>> SystolicComputeWs::get_filter_demand_matrices()
+void SystolicComputeWs::get_ofmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand)
 {
-    cout << "get_filter_demand_matrices()" << endl;
+    int inter_fold_gap_prefix = 2 * arr_row - 1;
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_col, inter_fold_gap_prefix, T);
 
-    vector<xt::xarray<int64_t>> filter_demand_matrix_vector;
+    int col_start_id = (pe * col_fold + fc) * arr_col;
+    int col_end_idx = min(col_start_id + arr_col, Sc);
 
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_suffix = arr_row + T - 1;
-        xt::xarray<int64_t> inter_fold_gap_suffix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_col}) * -1;
-        int basic_iter = arr_row + arr_col - 1 + ifmap_op_mat.shape()[0];
+    for (int t = 0; t < T; t++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(inter_fold_gap_prefix + t, c - col_start_id) = ofmap_op_mat(t, c);
+}
 
-        filter_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+void SystolicComputeWs::calc_fold_stats()
+{
+    mapping_efficiency_per_fold.clear();
+    compute_utility_per_fold.clear();
 
+    for (int i = 0; i < num_pe; i++)
+    {
         for (int fc = 0; fc < col_fold; fc++)
         {
             for (int fr = 0; fr < row_fold; fr++)
             {
-                int index = fc * row_fold + fr;
-                // cout << "filter index " << index << " of " << col_fold * row_fold << endl;
                 int row_start_id = fr * arr_row;
                 int row_end_idx = min(row_start_id + arr_row, Sr);
-                int row_delta = arr_row - (row_end_idx - row_start_id);
 
                 int col_start_id = (i * col_fold + fc) * arr_col;
                 int col_end_idx = min(col_start_id + arr_col, Sc);
-                int col_delta = arr_col - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(filter_op_mat, xt::range(row_start_id, row_end_idx), xt::range(col_start_id, col_end_idx));
-                filter_reads += this_fold_demand.shape()[0] + this_fold_demand.shape()[1];
-
-                if (col_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({(int)this_fold_demand.shape()[0], col_delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-
-                if (row_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({row_delta, arr_col}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 0);
-                }
-
-                // // this_fold_demand = xt::flip(this_fold_demand, 0);
-
-                this_fold_demand = xt::transpose(this_fold_demand);
-                this_fold_demand = xt::concatenate(xtuple(this_fold_demand, inter_fold_gap_suffix_mat), 0);
 
                 int row_used = min(arr_row, row_end_idx - row_start_id);
                 int col_used = min(arr_col, col_end_idx - col_start_id);
                 int mac_used = row_used * col_used;
                 float mapping_eff_this_fold = (float)mac_used / (arr_row * arr_col);
 
-                int cycles_this_fold = this_fold_demand.shape()[0] + this_fold_demand.shape()[1] - 1;
+                // Transposed filter fold plus its suffix gap, skewed across the array rows
+                int cycles_this_fold = get_fold_rows() + arr_row - 1;
                 int compute_cycles_this_fold = mac_used * T;
                 float compute_util_this_fold = (float)compute_cycles_this_fold / (arr_row * arr_col * cycles_this_fold);
 
                 mapping_efficiency_per_fold.push_back(mapping_eff_this_fold);
                 compute_utility_per_fold.push_back(compute_util_this_fold);
 
-                xt::view(filter_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "filter_demand_matrix shape is " << filter_demand_matrix.shape()[0] << ", " << filter_demand_matrix.shape()[1] << endl;
-        cout << filter_demand_matrix << endl;
-        filter_demand_matrix_vector.push_back(filter_demand_matrix);
-    }
-    return filter_demand_matrix_vector;
-}
-
-vector<xt::xarray<int64_t>> SystolicComputeWs::get_ofmap_demand_matrices()
-{
-    cout << "get_ofmap_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> ofmap_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_prefix = 2 * arr_row - 1;
-        xt::xarray<int64_t> inter_fold_gap_prefix_mat = xt::ones<int64_t>({inter_fold_gap_prefix, arr_row}) * -1;
-
-        // int basic_iter = 2 * arr_row - 1 + arr_col - 1 + ifmap_op_mat.shape()[0];
-        int basic_iter = arr_row + arr_col - 1 + ifmap_op_mat.shape()[0];
-
-        ofmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
-
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold + fr;
-                // cout << "ofmap index " << index << " of " << col_fold * row_fold << endl;
-                int col_start_id = (i * col_fold + fc) * arr_col;
-                int col_end_idx = min(col_start_id + arr_col, Sc);
-                int col_delta = arr_col - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ofmap_op_mat, xt::all(), xt::range(col_start_id, col_end_idx));
-                ofmap_writes += ofmap_op_mat.shape()[0] * ofmap_op_mat.shape()[1];
-
-                if (col_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({(int)this_fold_demand.shape()[0], col_delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-
-                ofmap_writes += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
-
-                this_fold_demand = xt::concatenate(xtuple(inter_fold_gap_prefix_mat, this_fold_demand), 0);
-                // this_fold_demand = skew_matrix(this_fold_demand);
-
-                xt::view(ofmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
+                ifmap_reads += T * row_used;
+                filter_reads += row_used + col_used;
+                ofmap_writes += ofmap_op_mat.shape()[0] * ofmap_op_mat.shape()[1] + T * arr_col;
             }
         }
-        cout << "ofmap_demand_matrix shape is " << ofmap_demand_matrix.shape()[0] << ", " << ofmap_demand_matrix.shape()[1] << endl;
-        cout << ofmap_demand_matrix << endl;
-        ofmap_demand_matrix_vector.push_back(ofmap_demand_matrix);
     }
-    return ofmap_demand_matrix_vector;
 }
 
 
@@ -13,36 +13,34 @@ class SystolicPoolOs : public SystolicCompute
 public:
     SystolicPoolOs();
     ~SystolicPoolOs() {}
-    void set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe);
+    void set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe);
 
     xt::xarray<int64_t> get_ifmap_prefetch_matrices();
     xt::xarray<int64_t> get_filter_prefetch_matrices();
 
-    vector<xt::xarray<int64_t>> get_ifmap_demand_matrices();
-    vector<xt::xarray<int64_t>> get_filter_demand_matrices();
-    vector<xt::xarray<int64_t>> get_ofmap_demand_matrices();
+    int64_t get_num_folds();
+    int64_t get_fold_rows();
+    int64_t get_fold_period();
+    void get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand);
 
     float get_avg_mapping_efficiency();
     float get_avg_compute_utilization();
 
 private:
+    bool get_pe_fold(int pe, int64_t fold_id, int &fc, int &fr);
+    void get_unmapped_fold_demand(int64_t cols, PaddedDemand &fold_demand);
+    void get_ifmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand);
+    void get_ofmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand);
+
     xt::xarray<int64_t> skew_matrix(xt::xarray<int64_t> input_matrix_np);
     Config *config;
-    xt::xarray<int64_t> ifmap_op_mat;
-    xt::xarray<int64_t> filter_op_mat;
-    xt::xarray<int64_t> ofmap_op_mat;
-
-    xt::xarray<int64_t> ifmap_op_mat_trans;
+    OperandView ifmap_op_mat;
+    OperandView filter_op_mat;
+    OperandView ofmap_op_mat;
 
     xt::xarray<int64_t> ifmap_prefetch_matrix;
     xt::xarray<int64_t> filter_prefetch_matrix;
 
-    xt::xarray<int64_t> ifmap_demand_matrix;
-    xt::xarray<int64_t> filter_demand_matrix;
-    xt::xarray<int64_t> ofmap_demand_matrix;
-
-    int num_pe;
-
     int ifmap_col;
     int filter_row;
 
@@ -72,7 +70,7 @@ SystolicPoolOs::SystolicPoolOs()
     ofmap_writes = 0;
 }
 
-void SystolicPoolOs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe)
+void SystolicPoolOs::set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe)
 {
     this->config = config;
     this->ifmap_op_mat = ifmap_op_mat;
@@ -83,8 +81,6 @@ void SystolicPoolOs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_ma
     ifmap_col = this->ifmap_op_mat.shape()[1];
     filter_row = this->filter_op_mat.shape()[0];
 
-    ifmap_op_mat_trans = xt::transpose(ifmap_op_mat);
-
     Sr = ifmap_op_mat.shape()[0];
     Sc = filter_op_mat.shape()[1];
     T = ifmap_op_mat.shape()[1];
@@ -104,6 +100,10 @@ void SystolicPoolOs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_ma
 
     cout << "Sr " << Sr << ", Sc " << Sc  << ", T " << T << endl;
     cout << "row_fold " << row_fold << ", col_fold " << col_fold << endl;
+
+    // Folds no PE fold maps to read address 1, see get_pe_fold
+    if (num_pe > 1)
+        addr_window = AddressWindow(1, 1);
 }
 
 xt::xarray<int64_t> SystolicPoolOs::get_ifmap_prefetch_matrices()
@@ -114,7 +114,8 @@ xt::xarray<int64_t> SystolicPoolOs::get_ifmap_prefetch_matrices()
 
     cout << "get_ifmap_prefetch_matrices()" << endl;
     cout << "ifmap_op_mat shape is " << ifmap_op_mat.shape()[0] << ", " << ifmap_op_mat.shape()[1] << endl;
-    cout << "ifmap_op_mat_trans shape is " << ifmap_op_mat_trans.shape()[0] << ", " << ifmap_op_mat_trans.shape()[1] << endl;
+    // The prefetch matrices are built from whole operands
+    xt::xarray<int64_t> ifmap_mat = ifmap_op_mat.to_array();
     cout << "ofmap_op_mat shape is " << ofmap_op_mat.shape()[0] << ", " << ofmap_op_mat.shape()[1] << endl;
 
     for (int fr = 0; fr < row_fold; fr++)
@@ -126,7 +127,7 @@ xt::xarray<int64_t> SystolicPoolOs::get_ifmap_prefetch_matrices()
 
         int delta = arr_row - (end_col_idx - start_col_idx);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(ifmap_op_mat, xt::all(), xt::range(start_col_idx, end_col_idx));
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(ifmap_mat, xt::all(), xt::range(start_col_idx, end_col_idx));
 
         if (delta > 0)
         {
@@ -172,6 +173,7 @@ xt::xarray<int64_t> SystolicPoolOs::get_filter_prefetch_matrices()
 {
     cout << "get_filter_prefetch_matrices()" << endl;
     cout << "filter_op_mat shape is " << filter_op_mat.shape()[0] << ", " << filter_op_mat.shape()[1] << endl;
+    xt::xarray<int64_t> filter_mat = filter_op_mat.to_array();
     int basic_iter = filter_op_mat.shape()[0];
     filter_prefetch_matrix = xt::ones<int64_t>({basic_iter * col_fold, arr_row});
 
@@ -183,7 +185,7 @@ xt::xarray<int64_t> SystolicPoolOs::get_filter_prefetch_matrices()
 
         int delta = arr_col - (col_end_id - col_start_id);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_op_mat, xt::all(), xt::range(col_start_id, col_end_id));
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_mat, xt::all(), xt::range(col_start_id, col_end_id));
 
         if (delta > 0)
         {
@@ -202,126 +204,87 @@ xt::xarray<int64_t> SystolicPoolOs::get_filter_prefetch_matrices()
     return filter_prefetch_matrix;
 }
 
-vector<xt::xarray<int64_t>> SystolicPoolOs::get_ifmap_demand_matrices()
+int64_t SystolicPoolOs::get_num_folds()
 {
-    cout << "get_ifmap_demand_matrices()" << endl;
+    return (int64_t)col_fold * row_fold;
+}
 
-    vector<xt::xarray<int64_t>> ifmap_demand_matrix_vector;
+int64_t SystolicPoolOs::get_fold_rows()
+{
+    return arr_col - 1 + T;
+}
 
-    for (int i = 0; i < num_pe; i++) {
-        int inter_fold_gap_suffix = arr_col - 1;
-        xt::xarray<int64_t> inter_fold_gap_suffix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_row}) * -1;
+int64_t SystolicPoolOs::get_fold_period()
+{
+    return (int64_t)row_fold * num_pe;
+}
 
-        // int basic_iter = arr_row - 1 + arr_col - 1 + ifmap_op_mat.shape()[1];
-        int basic_iter = arr_col - 1 + ifmap_op_mat.shape()[1];
-        ifmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+void SystolicPoolOs::get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand)
+{
+    int fc, fr;
+    bool mapped = get_pe_fold(pe, fold_id, fc, fr);
+
+    if (operand == Operand::FILTER)
+        // Pooling has no filter operand
+        reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, 0);
+    else if (!mapped)
+        get_unmapped_fold_demand(operand == Operand::IFMAP ? arr_row : arr_col, fold_demand);
+    else if (operand == Operand::IFMAP)
+        get_ifmap_fold_demand(pe, fc, fr, fold_demand);
+    else
+        get_ofmap_fold_demand(fc, fr, fold_demand);
+}
 
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold * num_pe + i * row_fold + fr;
-
-                int row_start_id = (i * row_fold + fr) * arr_row;
-                int row_end_idx = min(row_start_id + arr_row, Sr);
-                int delta = arr_row - (row_end_idx - row_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ifmap_op_mat_trans, xt::all(), xt::range(row_start_id, row_end_idx));
-                ifmap_reads += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
-
-                if (delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-        
-                this_fold_demand = xt::concatenate(xtuple(this_fold_demand, inter_fold_gap_suffix_mat), 0);
-                xt::view(ifmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "ifmap_demand_matrix shape is " << ifmap_demand_matrix.shape()[0] << ", " << ifmap_demand_matrix.shape()[1] << endl;
-        cout << ifmap_demand_matrix << endl;
-        ifmap_demand_matrix_vector.push_back(ifmap_demand_matrix);
-    }
-    return ifmap_demand_matrix_vector;
+// Fold (fc, fr) of a PE sits at fc * row_fold * num_pe + pe * row_fold + fr
+// of its demand, so with several PEs the folds that would land past the end
+// are dropped and the others leave gaps. A gap keeps the fill of address 1
+// the whole-layer demand matrices started from.
+bool SystolicPoolOs::get_pe_fold(int pe, int64_t fold_id, int &fc, int &fr)
+{
+    int64_t pe_folds = (int64_t)row_fold * num_pe;
+    fc = fold_id / pe_folds;
+    fr = fold_id % row_fold;
+    return (fold_id % pe_folds) / row_fold == pe;
 }
 
-vector<xt::xarray<int64_t>> SystolicPoolOs::get_filter_demand_matrices()
+void SystolicPoolOs::get_unmapped_fold_demand(int64_t cols, PaddedDemand &fold_demand)
 {
-    cout << "get_filter_demand_matrices()" << endl;
+    reset_fold_demand(fold_demand, get_fold_rows(), cols, 0, get_fold_rows());
+    for (int64_t r = 0; r < get_fold_rows(); r++)
+        for (int64_t c = 0; c < cols; c++)
+            fold_demand(r, c) = 1;
+}
 
-    vector<xt::xarray<int64_t>> filter_demand_matrix_vector;
+void SystolicPoolOs::get_ifmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand)
+{
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, T);
 
-    for (int i = 0; i < num_pe; i++) {
-        int basic_iter = arr_col - 1 + ifmap_op_mat.shape()[1];
-        filter_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row}) * -1;
-        cout << "filter_demand_matrix shape is " << filter_demand_matrix.shape()[0] << ", " << filter_demand_matrix.shape()[1] << endl;
-        cout << filter_demand_matrix << endl;
-        filter_demand_matrix_vector.push_back(filter_demand_matrix);
-    }
-    return filter_demand_matrix_vector;
+    int row_start_id = (pe * row_fold + fr) * arr_row;
+    int row_end_idx = min(row_start_id + arr_row, Sr);
+
+    for (int t = 0; t < T; t++)
+        for (int r = row_start_id; r < row_end_idx; r++)
+            fold_demand(t, r - row_start_id) = ifmap_op_mat(r, t);
 }
 
-vector<xt::xarray<int64_t>> SystolicPoolOs::get_ofmap_demand_matrices()
+void SystolicPoolOs::get_ofmap_fold_demand(int fc, int fr, PaddedDemand &fold_demand)
 {
-    cout << "get_ofmap_demand_matrices()" << endl;
+    int inter_fold_gap_prefix = T - 1;
 
-    vector<xt::xarray<int64_t>> ofmap_demand_matrix_vector;
+    int row_start_id = fr * arr_row;
+    int row_end_idx = min(row_start_id + arr_row, Sr);
 
-    for (int i = 0; i < num_pe; i++) {
-         int inter_fold_gap_suffix = T - 1;
-        xt::xarray<int64_t> inter_fold_gap_prefix_mat = xt::ones<int64_t>({inter_fold_gap_suffix, arr_col}) * -1;
+    int col_start_id = fc * arr_col;
+    int col_end_idx = min(col_start_id + arr_col, Sc);
 
-        // int basic_iter = arr_row - 1 + arr_col - 1 + ifmap_op_mat.shape()[1];
-        int basic_iter = arr_col - 1 + ifmap_op_mat.shape()[1];
-        ofmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+    int fold_used_rows = row_end_idx - row_start_id;
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_col, inter_fold_gap_prefix + arr_row - fold_used_rows, fold_used_rows);
 
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold * num_pe + i * row_fold + fr;
-                
-                // cout << "input index " << index << " of " << col_fold * row_fold << endl;
-                int row_start_id = fr * arr_row;
-                int row_end_idx = min(row_start_id + arr_row, Sr);
-                int row_delta = arr_row - (row_end_idx - row_start_id);
-
-                int col_start_id = fc * arr_col;
-                int col_end_idx = min(col_start_id + arr_col, Sc);
-                int col_delta = arr_col - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ofmap_op_mat, xt::range(row_start_id, row_end_idx), xt::range(col_start_id, col_end_idx));
-                ofmap_writes += ofmap_op_mat.shape()[0] * ofmap_op_mat.shape()[1];
-
-                if (col_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({(int)this_fold_demand.shape()[0], col_delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-
-                if (row_delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({row_delta, arr_col}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 0);
-                }
-
-                this_fold_demand = xt::flip(this_fold_demand, 0);
-                ofmap_writes += this_fold_demand.shape()[0] + this_fold_demand.shape()[1];
-                this_fold_demand = xt::concatenate(xtuple(inter_fold_gap_prefix_mat, this_fold_demand), 0);
-
-
-                xt::view(ofmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "ofmap_demand_matrix shape is " << ofmap_demand_matrix.shape()[0] << ", " << ofmap_demand_matrix.shape()[1] << endl;
-        cout << ofmap_demand_matrix << endl;
-        ofmap_demand_matrix_vector.push_back(ofmap_demand_matrix);
-    }
-    return ofmap_demand_matrix_vector;
+    for (int r = row_start_id; r < row_end_idx; r++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(inter_fold_gap_prefix + arr_row - 1 - (r - row_start_id), c - col_start_id) = ofmap_op_mat(r, c);
 }
 
-
 xt::xarray<int64_t> SystolicPoolOs::skew_matrix(xt::xarray<int64_t> input_matrix_np)
 {
     int rows = input_matrix_np.shape()[0];
@@ -13,36 +13,32 @@ class SystolicPoolWs : public SystolicCompute
 public:
     SystolicPoolWs();
     ~SystolicPoolWs() {}
-    void set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe);
+    void set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe);
 
     xt::xarray<int64_t> get_ifmap_prefetch_matrices();
     xt::xarray<int64_t> get_filter_prefetch_matrices();
 
-    vector<xt::xarray<int64_t>> get_ifmap_demand_matrices();
-    vector<xt::xarray<int64_t>> get_filter_demand_matrices();
-    vector<xt::xarray<int64_t>> get_ofmap_demand_matrices();
+    int64_t get_num_folds();
+    int64_t get_fold_rows();
+    int64_t get_fold_period();
+    void get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand);
 
     float get_avg_mapping_efficiency();
     float get_avg_compute_utilization();
 
 private:
+    void get_ifmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand);
+    void get_ofmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand);
+
     xt::xarray<int64_t> skew_matrix(xt::xarray<int64_t> input_matrix_np);
     Config *config;
-    xt::xarray<int64_t> ifmap_op_mat;
-    xt::xarray<int64_t> filter_op_mat;
-    xt::xarray<int64_t> ofmap_op_mat;
-
-    xt::xarray<int64_t> ifmap_op_mat_trans;
+    OperandView ifmap_op_mat;
+    OperandView filter_op_mat;
+    OperandView ofmap_op_mat;
 
     xt::xarray<int64_t> ifmap_prefetch_matrix;
     xt::xarray<int64_t> filter_prefetch_matrix;
 
-    xt::xarray<int64_t> ifmap_demand_matrix;
-    xt::xarray<int64_t> filter_demand_matrix;
-    xt::xarray<int64_t> ofmap_demand_matrix;
-
-    int num_pe;
-
     int ifmap_col;
     int filter_row;
 
@@ -72,7 +68,7 @@ SystolicPoolWs::SystolicPoolWs()
     ofmap_writes = 0;
 }
 
-void SystolicPoolWs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_mat, xt::xarray<int64_t> &filter_op_mat, xt::xarray<int64_t> &ofmap_op_mat, int num_pe)
+void SystolicPoolWs::set_params(Config *config, OperandView &ifmap_op_mat, OperandView &filter_op_mat, OperandView &ofmap_op_mat, int num_pe)
 {
     this->config = config;
     this->ifmap_op_mat = ifmap_op_mat;
@@ -83,8 +79,6 @@ void SystolicPoolWs::set_params(Config *config, xt::xarray<int64_t> &ifmap_op_ma
     ifmap_col = this->ifmap_op_mat.shape()[1];
     filter_row = this->filter_op_mat.shape()[0];
 
-    ifmap_op_mat_trans = xt::transpose(ifmap_op_mat);
-
     Sr = ifmap_op_mat.shape()[1];
     Sc = filter_op_mat.shape()[1];
     T = ifmap_op_mat.shape()[0];
@@ -109,7 +103,8 @@ xt::xarray<int64_t> SystolicPoolWs::get_ifmap_prefetch_matrices()
 
     cout << "get_ifmap_prefetch_matrices()" << endl;
     cout << "ifmap_op_mat shape is " << ifmap_op_mat.shape()[0] << ", " << ifmap_op_mat.shape()[1] << endl;
-    cout << "ifmap_op_mat_trans shape is " << ifmap_op_mat_trans.shape()[0] << ", " << ifmap_op_mat_trans.shape()[1] << endl;
+    // The prefetch matrices are built from whole operands
+    xt::xarray<int64_t> ifmap_mat = ifmap_op_mat.to_array();
     cout << "ofmap_op_mat shape is " << ofmap_op_mat.shape()[0] << ", " << ofmap_op_mat.shape()[1] << endl;
 
     for (int fr = 0; fr < row_fold; fr++)
@@ -121,7 +116,7 @@ xt::xarray<int64_t> SystolicPoolWs::get_ifmap_prefetch_matrices()
 
         int delta = arr_row - (end_col_idx - start_col_idx);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(ifmap_op_mat, xt::all(), xt::range(start_col_idx, end_col_idx));
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(ifmap_mat, xt::all(), xt::range(start_col_idx, end_col_idx));
 
         if (delta > 0)
         {
@@ -167,6 +162,7 @@ xt::xarray<int64_t> SystolicPoolWs::get_filter_prefetch_matrices()
 {
     cout << "get_filter_prefetch_matrices()" << endl;
     cout << "filter_op_mat shape is " << filter_op_mat.shape()[0] << ", " << filter_op_mat.shape()[1] << endl;
+    xt::xarray<int64_t> filter_mat = filter_op_mat.to_array();
     int basic_iter = filter_op_mat.shape()[0];
     filter_prefetch_matrix = xt::ones<int64_t>({basic_iter * col_fold, arr_row});
 
@@ -178,7 +174,7 @@ xt::xarray<int64_t> SystolicPoolWs::get_filter_prefetch_matrices()
 
         int delta = arr_col - (col_end_id - col_start_id);
 
-        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_op_mat, xt::all(), xt::range(col_start_id, col_end_id));
+        xt::xarray<int64_t> this_fold_prefetch = xt::view(filter_mat, xt::all(), xt::range(col_start_id, col_end_id));
 
         if (delta > 0)
         {
@@ -197,108 +193,62 @@ xt::xarray<int64_t> SystolicPoolWs::get_filter_prefetch_matrices()
     return filter_prefetch_matrix;
 }
 
-vector<xt::xarray<int64_t>> SystolicPoolWs::get_ifmap_demand_matrices()
+int64_t SystolicPoolWs::get_num_folds()
 {
-    cout << "get_ifmap_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> ifmap_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        int basic_iter = ifmap_op_mat.shape()[0];
-
-        ifmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
-
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold * num_pe + i * row_fold + fr;
-                // cout << "input index " << index << " of " << col_fold * row_fold << endl;
-                int col_start_id = (i * row_fold + fr) * arr_row;
-                int col_end_idx = min(col_start_id + arr_row, Sr);
-                int delta = arr_row - (col_end_idx - col_start_id);
-
-                xt::xarray<int64_t> this_fold_demand = xt::view(ifmap_op_mat, xt::all(), xt::range(col_start_id, col_end_idx));
-                ifmap_reads += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
-
-                if (delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
-        
-                xt::view(ifmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "ifmap_demand_matrix shape is " << ifmap_demand_matrix.shape()[0] << ", " << ifmap_demand_matrix.shape()[1] << endl;
-        cout << ifmap_demand_matrix << endl;
-        ifmap_demand_matrix_vector.push_back(ifmap_demand_matrix);
-    }
-    return ifmap_demand_matrix_vector;
+    return (int64_t)col_fold * row_fold;
 }
 
-vector<xt::xarray<int64_t>> SystolicPoolWs::get_filter_demand_matrices()
+int64_t SystolicPoolWs::get_fold_rows()
 {
-    cout << "get_filter_demand_matrices()" << endl;
-
-    vector<xt::xarray<int64_t>> filter_demand_matrix_vector;
-
-    for (int i = 0; i < num_pe; i++) {
-        int basic_iter = ifmap_op_mat.shape()[0];
-        filter_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row}) * -1;
-        cout << "filter_demand_matrix shape is " << filter_demand_matrix.shape()[0] << ", " << filter_demand_matrix.shape()[1] << endl;
-        cout << filter_demand_matrix << endl;
-        filter_demand_matrix_vector.push_back(filter_demand_matrix);
-    }
-    return filter_demand_matrix_vector;
+    return T;
 }
 
-vector<xt::xarray<int64_t>> SystolicPoolWs::get_ofmap_demand_matrices()
+int64_t SystolicPoolWs::get_fold_period()
 {
-    cout << "get_ofmap_demand_matrices()" << endl;
+    return row_fold;
+}
 
-    vector<xt::xarray<int64_t>> ofmap_demand_matrix_vector;
+void SystolicPoolWs::get_fold_demand(Operand operand, int pe, int64_t fold_id, PaddedDemand &fold_demand)
+{
+    int fc = fold_id / row_fold;
+    int fr = fold_id % row_fold;
+
+    if (operand == Operand::IFMAP)
+        get_ifmap_fold_demand(pe, fc, fr, fold_demand);
+    else if (operand == Operand::FILTER)
+        // Pooling has no filter operand
+        reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, 0);
+    else
+        get_ofmap_fold_demand(pe, fc, fr, fold_demand);
+}
 
-    for (int i = 0; i < num_pe; i++) {
-        int basic_iter = ifmap_op_mat.shape()[0];
+void SystolicPoolWs::get_ifmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand)
+{
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, T);
 
-        ofmap_demand_matrix = xt::ones<int64_t>({basic_iter * col_fold * row_fold, arr_row});
+    int col_start_id = (pe * row_fold + fr) * arr_row;
+    int col_end_idx = min(col_start_id + arr_row, Sr);
 
-        for (int fc = 0; fc < col_fold; fc++)
-        {
-            for (int fr = 0; fr < row_fold; fr++)
-            {
-                int index = fc * row_fold * num_pe + i * row_fold + fr;
-                // cout << "input index " << index << " of " << col_fold * row_fold << endl;
-                int col_start_id = (i * row_fold * col_fold + fc * row_fold + fr) * arr_row;
-                int col_end_idx = min(col_start_id + arr_row, max(Sr, Sc));
-
-                col_start_id = col_start_id / W;
-                col_end_idx = col_end_idx / W;
+    for (int t = 0; t < T; t++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(t, c - col_start_id) = ifmap_op_mat(t, c);
+}
 
-                int delta = arr_row - (col_end_idx - col_start_id);
+void SystolicPoolWs::get_ofmap_fold_demand(int pe, int fc, int fr, PaddedDemand &fold_demand)
+{
+    reset_fold_demand(fold_demand, get_fold_rows(), arr_row, 0, T);
 
-                xt::xarray<int64_t> this_fold_demand = xt::view(ofmap_op_mat, xt::all(), xt::range(col_start_id, col_end_idx));
-                ofmap_writes += ofmap_op_mat.shape()[0] * ofmap_op_mat.shape()[1];
+    int col_start_id = (pe * row_fold * col_fold + fc * row_fold + fr) * arr_row;
+    int col_end_idx = min(col_start_id + arr_row, max(Sr, Sc));
 
-                if (delta > 0)
-                {
-                    xt::xarray<int64_t> null_req_mat = xt::ones<int64_t>({T, delta}) * -1;
-                    this_fold_demand = xt::concatenate(xtuple(this_fold_demand, null_req_mat), 1);
-                }
+    col_start_id = col_start_id / W;
+    col_end_idx = min(col_end_idx / W, (int)ofmap_op_mat.shape()[1]);
 
-                ofmap_writes += this_fold_demand.shape()[0] * this_fold_demand.shape()[1];
-                xt::view(ofmap_demand_matrix, xt::range(basic_iter * index, basic_iter * (index + 1)), xt::all()) = this_fold_demand;
-            }
-        }
-        cout << "ofmap_demand_matrix shape is " << ofmap_demand_matrix.shape()[0] << ", " << ofmap_demand_matrix.shape()[1] << endl;
-        cout << ofmap_demand_matrix << endl;
-        ofmap_demand_matrix_vector.push_back(ofmap_demand_matrix);
-    }
-    return ofmap_demand_matrix_vector;
+    for (int t = 0; t < T; t++)
+        for (int c = col_start_id; c < col_end_idx; c++)
+            fold_demand(t, c - col_start_id) = ofmap_op_mat(t, c);
 }
 
-
 xt::xarray<int64_t> SystolicPoolWs::skew_matrix(xt::xarray<int64_t> input_matrix_np)
 {
     int rows = input_matrix_np.shape()[0];
@@ -0,0 +1,210 @@
+#ifndef _host_profiler_h
+#define _host_profiler_h
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace std::chrono;
+
+// Host-side phases of simulating one layer
+enum class HostPhase
+{
+    SET_PARAMS,     // LayerSim::set_params, compute system allocation
+    OPERAND_MATRIX, // OperandMatrix::set_params and the operand views
+    COMPUTE_SETUP,  // SystolicCompute::set_params
+    TRACE,          // demand trace pass
+    FETCH_LINES,    // prepare_hashed_buffer of the three buffers of a PE
+    SERVICE,        // demand servicing, or recording in threaded runs
+    REPLAY,         // replay of the recorded LLC traffic
+    NUM_PHASES
+};
+
+string get_phase_name(HostPhase phase)
+{
+    static const char *names[] = {"set_params", "operand_matrix", "compute_setup", "trace", "fetch_lines", "service", "replay"};
+    return names[(int)phase];
+}
+
+// Host time, memory and heap use of every simulated layer, written as a
+// JSON array. Phases run by several threads at once add up their thread time,
+// so they can sum to more than the layer's wall time.
+//
+// Peak RSS is per layer where the kernel lets the high-water mark be reset
+// (/proc/self/clear_refs), and the process peak so far otherwise. Heap bytes
+// are the allocator's bytes in use (mallinfo2), after the layer and relative
+// to its start.
+class HostProfiler
+{
+public:
+    HostProfiler();
+    void begin_layer(string layer_name, int64_t layer_id);
+    void end_layer();
+    void add_phase_time(HostPhase phase, int64_t ns) { phase_ns[(int)phase] += ns; }
+
+    void write_json(string file_name);
+    void print_summary();
+
+private:
+    typedef struct
+    {
+        string name;
+        int64_t layer_id;
+        int64_t wall_us;
+        vector<int64_t> phase_us;
+        int64_t rss_kb;
+        int64_t peak_rss_kb;
+        bool peak_is_per_layer;
+        int64_t heap_kb;
+        int64_t heap_delta_kb;
+    } LayerProfile;
+
+    static int64_t read_status_kb(const char *field);
+    static int64_t get_heap_bytes();
+    bool reset_peak_rss();
+
+    atomic<int64_t> phase_ns[(int)HostPhase::NUM_PHASES];
+    LayerProfile current;
+    high_resolution_clock::time_point layer_start;
+    int64_t layer_start_heap;
+    vector<LayerProfile> layers;
+};
+
+// Adds the time until the end of its scope to one phase; does nothing
+// without a profiler
+class ScopedPhaseTimer
+{
+public:
+    ScopedPhaseTimer(HostProfiler *profiler, HostPhase phase) : profiler(profiler), phase(phase) {
+        if (profiler != NULL)
+            start = high_resolution_clock::now();
+    }
+    ~ScopedPhaseTimer() {
+        if (profiler != NULL)
+            profiler->add_phase_time(phase, duration_cast<nanoseconds>(high_resolution_clock::now() - start).count());
+    }
+
+private:
+    HostProfiler *profiler;
+    HostPhase phase;
+    high_resolution_clock::time_point start;
+};
+
+HostProfiler::HostProfiler()
+{
+    for (auto &ns : phase_ns)
+        ns = 0;
+    layer_start_heap = 0;
+}
+
+void HostProfiler::begin_layer(string layer_name, int64_t layer_id)
+{
+    for (auto &ns : phase_ns)
+        ns = 0;
+    current.name = layer_name;
+    current.layer_id = layer_id;
+    current.peak_is_per_layer = reset_peak_rss();
+    layer_start_heap = get_heap_bytes();
+    layer_start = high_resolution_clock::now();
+}
+
+void HostProfiler::end_layer()
+{
+    current.wall_us = duration_cast<microseconds>(high_resolution_clock::now() - layer_start).count();
+    current.phase_us.clear();
+    for (auto &ns : phase_ns)
+        current.phase_us.push_back(ns / 1000);
+
+    current.rss_kb = read_status_kb("VmRSS:");
+    current.peak_rss_kb = read_status_kb("VmHWM:");
+    if (current.peak_rss_kb < 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        current.peak_rss_kb = usage.ru_maxrss;
+        current.peak_is_per_layer = false;
+    }
+    int64_t heap_bytes = get_heap_bytes();
+    current.heap_kb = heap_bytes / 1024;
+    current.heap_delta_kb = (heap_bytes - layer_start_heap) / 1024;
+    layers.push_back(current);
+}
+
+// Field of /proc/self/status in kB, -1 if not there
+int64_t HostProfiler::read_status_kb(const char *field)
+{
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, strlen(field), field) == 0)
+            return atol(line.c_str() + strlen(field));
+    }
+    return -1;
+}
+
+int64_t HostProfiler::get_heap_bytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// Writing 5 to clear_refs resets VmHWM to the current RSS
+bool HostProfiler::reset_peak_rss()
+{
+    FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+    if (clear_refs == NULL)
+        return false;
+    bool reset = fputs("5", clear_refs) >= 0;
+    return (fclose(clear_refs) == 0) && reset;
+}
+
+void HostProfiler::write_json(string file_name)
+{
+    ofstream json(file_name);
+    json << "[" << endl;
+    for (size_t i = 0; i < layers.size(); i++) {
+        const LayerProfile &layer = layers[i];
+        json << "  {\"layer\": \"" << layer.name << "\", \"id\": " << layer.layer_id
+             << ", \"wall_us\": " << layer.wall_us << ", \"phases_us\": {";
+        for (int p = 0; p < (int)HostPhase::NUM_PHASES; p++)
+            json << (p > 0 ? ", " : "") << "\"" << get_phase_name((HostPhase)p) << "\": " << layer.phase_us[p];
+        json << "}, \"rss_kb\": " << layer.rss_kb << ", \"peak_rss_kb\": " << layer.peak_rss_kb
+             << ", \"peak_rss_per_layer\": " << (layer.peak_is_per_layer ? "true" : "false")
+             << ", \"heap_kb\": " << layer.heap_kb << ", \"heap_delta_kb\": " << layer.heap_delta_kb << "}"
+             << (i + 1 < layers.size() ? "," : "") << endl;
+    }
+    json << "]" << endl;
+    cout << "Host profile written to " << file_name << endl;
+}
+
+void HostProfiler::print_summary()
+{
+    int64_t wall_us = 0;
+    int64_t peak_rss_kb = 0;
+    vector<int64_t> phase_us((int)HostPhase::NUM_PHASES, 0);
+    for (auto &layer : layers) {
+        wall_us += layer.wall_us;
+        peak_rss_kb = max(peak_rss_kb, layer.peak_rss_kb);
+        for (int p = 0; p < (int)HostPhase::NUM_PHASES; p++)
+            phase_us[p] += layer.phase_us[p];
+    }
+
+    printf("Host profile: %ld layers, %.3f s, peak RSS %.1f MB\n", (int64_t)layers.size(), wall_us / 1e6, peak_rss_kb / 1024.0);
+    for (int p = 0; p < (int)HostPhase::NUM_PHASES; p++) {
+        if (phase_us[p] > 0)
+            printf("  %-16s %10.3f s\n", get_phase_name((HostPhase)p).c_str(), phase_us[p] / 1e6);
+    }
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef _layer_scheduler_h
+#define _layer_scheduler_h
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "topology_utils.h"
+
+using namespace std;
+
+// Start and end of one layer in the DAG schedule; a PE of the layer is busy
+// from start for its own cycles, the layer ends with its slowest PE
+typedef struct
+{
+    int64_t start_cycle;
+    int64_t end_cycle;
+    bool scheduled;
+} ScheduledLayer;
+
+// Schedules the layers of a topology as a DAG over the PEs. A layer depends
+// on the layers it reads its ifmap or filter from, and starts as soon as they
+// have ended and all of its PEs are free; of the layers that could start, the
+// one that can start first goes first, ties in topology order.
+//
+// Layer cycles come from the simulation, which runs the layers in topology
+// order; the schedule only places them in time, so a layer sees the LLC
+// contents its topology-order predecessors left behind.
+class LayerScheduler
+{
+public:
+    LayerScheduler();
+    void set_params(Topology *topology, int num_pe);
+    // Cycles of the layer on each PE of its PE list, in list order
+    void set_layer_cycles(int64_t layer_id, vector<int64_t> pe_cycles);
+    void schedule();
+
+    int64_t get_makespan() { return makespan; }
+    // Every layer after the previous one ended, as the layers are simulated
+    int64_t get_serial_cycles() { return serial_cycles; }
+    ScheduledLayer get_layer(int64_t layer_id) { return layers[layer_id]; }
+    int64_t get_pe_busy_cycles(int pe) { return pe_busy_cycles[pe]; }
+
+    void write_report(string file_name);
+    void print_summary();
+
+private:
+    int64_t get_ready_cycle(int64_t layer_id, const vector<int64_t> &pe_free_cycle);
+
+    Topology *topology;
+    int num_pe;
+    int64_t num_layers;
+
+    vector<vector<int64_t>> layer_pe_cycles;
+    vector<ScheduledLayer> layers;
+    vector<int64_t> pe_busy_cycles;
+    int64_t makespan;
+    int64_t serial_cycles;
+};
+
+LayerScheduler::LayerScheduler()
+{
+    topology = NULL;
+    num_pe = 1;
+    num_layers = 0;
+    makespan = 0;
+    serial_cycles = 0;
+}
+
+void LayerScheduler::set_params(Topology *topology, int num_pe)
+{
+    this->topology = topology;
+    this->num_pe = num_pe;
+    num_layers = topology->get_num_layers();
+    layer_pe_cycles.assign(num_layers, vector<int64_t>());
+    layers.assign(num_layers, {0, 0, false});
+    pe_busy_cycles.assign(num_pe, 0);
+}
+
+void LayerScheduler::set_layer_cycles(int64_t layer_id, vector<int64_t> pe_cycles)
+{
+    layer_pe_cycles[layer_id] = pe_cycles;
+}
+
+// Earliest cycle the layer can start, -1 while a producer is unscheduled
+int64_t LayerScheduler::get_ready_cycle(int64_t layer_id, const vector<int64_t> &pe_free_cycle)
+{
+    int64_t ready_cycle = 0;
+    for (int producer : topology->get_layer_producers(layer_id)) {
+        if (!layers[producer].scheduled)
+            return -1;
+        ready_cycle = max(ready_cycle, layers[producer].end_cycle);
+    }
+    for (int pe : topology->get_layer_pe_list(layer_id))
+        ready_cycle = max(ready_cycle, pe_free_cycle[pe]);
+    return ready_cycle;
+}
+
+void LayerScheduler::schedule()
+{
+    vector<int64_t> pe_free_cycle(num_pe, 0);
+    layers.assign(num_layers, {0, 0, false});
+    pe_busy_cycles.assign(num_pe, 0);
+    makespan = 0;
+    serial_cycles = 0;
+
+    for (int64_t n = 0; n < num_layers; n++) {
+        int64_t next_layer = -1;
+        int64_t next_ready_cycle = 0;
+        for (int64_t i = 0; i < num_layers; i++) {
+            if (layers[i].scheduled)
+                continue;
+            int64_t ready_cycle = get_ready_cycle(i, pe_free_cycle);
+            if (ready_cycle >= 0 && (next_layer == -1 || ready_cycle < next_ready_cycle)) {
+                next_layer = i;
+                next_ready_cycle = ready_cycle;
+            }
+        }
+        // Producers always come earlier in the topology, so some layer is ready
+        if (next_layer == -1)
+            break;
+
+        vector<int> pe_list = topology->get_layer_pe_list(next_layer);
+        ScheduledLayer &layer = layers[next_layer];
+        layer.start_cycle = next_ready_cycle;
+        layer.end_cycle = next_ready_cycle;
+        layer.scheduled = true;
+        int64_t layer_cycles = 0;
+        for (int i = 0; i < pe_list.size() && i < layer_pe_cycles[next_layer].size(); i++) {
+            int64_t cycles = layer_pe_cycles[next_layer][i];
+            pe_free_cycle[pe_list[i]] = next_ready_cycle + cycles;
+            pe_busy_cycles[pe_list[i]] += cycles;
+            layer.end_cycle = max(layer.end_cycle, next_ready_cycle + cycles);
+            layer_cycles = max(layer_cycles, cycles);
+        }
+        makespan = max(makespan, layer.end_cycle);
+        serial_cycles += layer_cycles;
+    }
+}
+
+// One row per layer and PE: the PE's timeline, sorted by start cycle
+void LayerScheduler::write_report(string file_name)
+{
+    vector<int64_t> order;
+    for (int64_t i = 0; i < num_layers; i++)
+        order.push_back(i);
+    stable_sort(order.begin(), order.end(), [this](int64_t a, int64_t b) { return layers[a].start_cycle < layers[b].start_cycle; });
+
+    ofstream report(file_name);
+    report << "PE,Layer name,Start cycle,End cycle,Layer end cycle" << endl;
+    for (int pe = 0; pe < num_pe; pe++) {
+        for (int64_t layer_id : order) {
+            vector<int> pe_list = topology->get_layer_pe_list(layer_id);
+            for (int i = 0; i < pe_list.size() && i < layer_pe_cycles[layer_id].size(); i++) {
+                if (pe_list[i] != pe)
+                    continue;
+                report << pe << "," << topology->get_layer_name(layer_id) << ","
+                       << layers[layer_id].start_cycle << "," << layers[layer_id].start_cycle + layer_pe_cycles[layer_id][i] << ","
+                       << layers[layer_id].end_cycle << endl;
+            }
+        }
+    }
+    report.close();
+    cout << "Layer schedule written to " << file_name << endl;
+}
+
+void LayerScheduler::print_summary()
+{
+    printf("DAG schedule: makespan %ld cycles, %ld cycles in topology order\n", makespan, serial_cycles);
+    for (int pe = 0; pe < num_pe; pe++) {
+        float util = makespan > 0 ? (float)pe_busy_cycles[pe] * 100 / makespan : 0.0f;
+        printf("  PE %d busy %ld cycles (%.2f%%)\n", pe, pe_busy_cycles[pe], util);
+    }
+}
+
+#endif
@@ -16,6 +16,10 @@
 #include "compute/systolic_pool_ws.h"
 #include "compute/systolic_pool_os.h"
 #include "memory/double_buffer_scratchpad_mem.h"
+#include "thread_pool.h"
+#include "trace_sink.h"
+#include "result_cache.h"
+#include "host_profiler.h"
 
 typedef struct
 {
@@ -36,10 +40,27 @@ class LayerSim
 {
 public:
     LayerSim();
-    // ~LayerSim();
+    ~LayerSim();
+    // Owns its operand matrix and compute system
+    LayerSim(const LayerSim &) = delete;
+    LayerSim& operator=(const LayerSim &) = delete;
     void set_params(int64_t layer_id, Config *config, Topology *topology, bool verbose, vector<DoubleBuffer*> memory_system);
+    void set_thread_pool(ThreadPool *thread_pool) { this->thread_pool = thread_pool; }
+    void set_trace_sink(TraceSink *trace_sink) { this->trace_sink = trace_sink; }
+    void set_result_cache(LayerResultCache *result_cache) { this->result_cache = result_cache; }
+    void set_profiler(HostProfiler *profiler) { this->profiler = profiler; }
+    bool is_cache_hit() { return cache_hit; }
+    // Whether run() will take the layer from the result cache, so there is
+    // nothing to prepare
+    bool has_cached_result();
     int64_t get_layer_id() { return layer_id; }
+    // The part of run() that leaves the LLC, the buffers and the memory map
+    // alone: operand and compute set-up and the fetch lines of each PE. May
+    // run on another thread while the previous layer is being serviced.
+    void prepare();
     void run();
+    // Assigns the layer's operand tensors their memory banks, for tensor interleaving
+    static void place_tensors(Config *config, Topology *topology, int64_t layer_id);
 
     ComputeStats get_compute_report_items();
     BandwidthStats get_bandwidth_report_items();
@@ -58,10 +79,16 @@ private:
     OperandMatrix *operandMatrix;
     SystolicCompute *compute_system;
     vector<DoubleBuffer*> memory_system;
+    ThreadPool *thread_pool = NULL;
+    TraceSink *trace_sink = NULL;
+    LayerResultCache *result_cache = NULL;
+    HostProfiler *profiler = NULL;
+    LayerResult cached_result;
+    bool cache_hit = false;
 
-    xt::xarray<int64_t> ifmap_op_mat;
-    xt::xarray<int64_t> filter_op_mat;
-    xt::xarray<int64_t> ofmap_op_mat;
+    OperandView ifmap_op_mat;
+    OperandView filter_op_mat;
+    OperandView ofmap_op_mat;
 
     int64_t total_cycles;
     int64_t stall_cycles;
@@ -75,52 +102,33 @@ private:
     bool runs_ready = false;
     bool report_items_ready = false;
 
+    // Demand streams of each PE (ifmap, filter, ofmap), in pe_list order
+    vector<SystolicDemandStream> demand_streams;
+    // Fetch lines of those streams, when built ahead by prepare()
+    vector<FetchLineWindow> fetch_lines;
+    bool compute_ready = false;
+    bool fetch_lines_ready = false;
+
+    void set_up_compute();
+    void end_layer();
     void calc_report_data();
+    bool use_result_cache() { return result_cache != NULL && trace_sink == NULL; }
+    LayerResult get_state();
+    void apply_cached_result();
+    void store_result(const string &cache_key, const LayerResult &start_state);
 };
 
 LayerSim::LayerSim()
 {
     operandMatrix = new OperandMatrix();
+    compute_system = NULL;
 }
 
-// LayerSim::~LayerSim()
-// {
-//     delete(operandMatrix);
-//     int64_t layer_type = topology->get_layer_type(this->layer_id);
-//     if (layer_type == CONV) {
-//         if (dataflow == "os") {
-//             delete((SystolicComputeOs *) compute_system);
-//         } else if (dataflow == "is") {
-//             delete((SystolicComputeIs *) compute_system);
-//         } else if (dataflow == "ws") {
-//             delete((SystolicComputeWs *) compute_system);
-//         } else {
-//             delete((SystolicComputeWs *) compute_system);
-//         }
-//     } else if (layer_type == POOL) {
-//         delete((SystolicPoolOs *) compute_system);
-//     }
-//     // delete(compute_system);
-
-//     cout << "ifmap_op_mat.data() is " << reinterpret_cast<void *>(ifmap_op_mat.data()) << endl;
-//     cout << "ifmap_op_mat.size() is " << ifmap_op_mat.size() << endl;
-
-//     ifmap_op_mat = xt::ones<int64_t>({1, 1});
-    
-//     cout << "ifmap_op_mat.data() is " << reinterpret_cast<void *>(ifmap_op_mat.data()) << endl;
-//     cout << "ifmap_op_mat.size() is " << ifmap_op_mat.size() << endl;
-
-
-//     // delete (ifmap_op_mat.data());
-//     // delete [] ifmap_op_mat.data();
-//     // delete [] ifmap_op_mat;
-//     // delete(filter_op_mat.data());
-//     // delete(ofmap_op_mat.data());
-//     // ifmap_op_mat.resize({1, 1}, true);
-//     // ifmap_op_mat = xt::ones<int64_t>({1, 1});
-//     // filter_op_mat = xt::ones<int64_t>({1, 1});
-//     // ofmap_op_mat = xt::ones<int64_t>({1, 1});
-// }
+LayerSim::~LayerSim()
+{
+    delete operandMatrix;
+    delete compute_system;
+}
 
 void LayerSim::set_params(int64_t layer_id, Config *config, Topology *topology, bool verbose, vector<DoubleBuffer*> memory_system)
 {
@@ -130,8 +138,6 @@ void LayerSim::set_params(int64_t layer_id, Config *config, Topology *topology,
     this->verbose = verbose;
     this->memory_system = memory_system;
 
-    operandMatrix->set_params(config, topology, layer_id);
-
     // this->dataflow = this->config->get_dataflow();
     this->dataflow = topology->get_layer_dataflow(this->layer_id);
 
@@ -155,6 +161,7 @@ void LayerSim::set_params(int64_t layer_id, Config *config, Topology *topology,
 
     auto arr_dims = this->config->get_array_dims();
     this->num_mac_unit = arr_dims.arr_h * arr_dims.arr_w;
+    num_compute = topology->get_layer_num_ofmap_px(this->layer_id) * topology->get_layer_window_size(this->layer_id);
 
     pe_list = topology->get_layer_pe_list(this->layer_id);
     params_set_flag = true;
@@ -162,53 +169,223 @@ void LayerSim::set_params(int64_t layer_id, Config *config, Topology *topology,
 
 void LayerSim::run()
 {
-    ifmap_op_mat = operandMatrix->get_ifmap_matrix();
-    filter_op_mat = operandMatrix->get_filter_matrix();
-    ofmap_op_mat = operandMatrix->get_ofmap_matrix();    
-
-    num_compute = topology->get_layer_num_ofmap_px(this->layer_id) * topology->get_layer_window_size(this->layer_id);
+    // Traced runs need the demand, so they always simulate
+    string cache_key;
+    LayerResult start_state;
+    if (use_result_cache()) {
+        cache_key = result_cache->make_key(config, topology, layer_id, pe_list.size());
+        cache_hit = result_cache->lookup(cache_key, cached_result);
+        if (cache_hit) {
+            apply_cached_result();
+            end_layer();
+            runs_ready = true;
+            return;
+        }
+        start_state = get_state();
+    }
 
-    this->compute_system->set_params(config, ifmap_op_mat, filter_op_mat, ofmap_op_mat, pe_list.size());
+    place_tensors(config, topology, layer_id);
+    set_up_compute();
+    // The cycles of every PE count from the start of the layer
+    memory_system[0]->getLLC()->start_layer();
 
     // xt::xarray<int64_t> ifmap_prefetch_mat = this->compute_system->get_ifmap_prefetch_matrices();
     // xt::xarray<int64_t> filter_prefetch_mat = this->compute_system->get_filter_prefetch_matrices();
 
-    vector<xt::xarray<int64_t>> ifmap_demand_mats = this->compute_system->get_ifmap_demand_matrices();
-    vector<xt::xarray<int64_t>> filter_demand_mats = this->compute_system->get_filter_demand_matrices();
-    vector<xt::xarray<int64_t>> ofmap_demand_mats = this->compute_system->get_ofmap_demand_matrices();
-
     int64_t layer_type = topology->get_layer_type(this->layer_id);
 
-    for (int i = 0; i < pe_list.size(); i++) {
-        memory_system[pe_list[i]]->set_read_buf_prefetch_matrices(ifmap_demand_mats[i], filter_demand_mats[i], ofmap_demand_mats[i]);
-        if (layer_type == CONV) {
-            if (dataflow == "os") {
-                memory_system[pe_list[i]]->service_memory_requests(ifmap_demand_mats[i], filter_demand_mats[i], ofmap_demand_mats[i], 1, 1, 0);
-            } else if (dataflow == "is") {
-                memory_system[pe_list[i]]->service_memory_requests(ifmap_demand_mats[i], filter_demand_mats[i], ofmap_demand_mats[i], 1, 0, 1);
-            } else {
-                memory_system[pe_list[i]]->service_memory_requests(ifmap_demand_mats[i], filter_demand_mats[i], ofmap_demand_mats[i], 0, 0, 0);
-            }   
-        } else if (layer_type == POOL) {
-            memory_system[pe_list[i]]->service_memory_requests(ifmap_demand_mats[i], filter_demand_mats[i], ofmap_demand_mats[i], 1, 1, 0);
+    bool trans_ifmap = 0, trans_filter = 0, trans_ofmap = 0;
+    if (layer_type == CONV) {
+        if (dataflow == "os") {
+            trans_ifmap = 1; trans_filter = 1; trans_ofmap = 0;
+        } else if (dataflow == "is") {
+            trans_ifmap = 1; trans_filter = 0; trans_ofmap = 1;
+        }
+    } else if (layer_type == POOL) {
+        trans_ifmap = 1; trans_filter = 1; trans_ofmap = 0;
+    }
+    bool has_demand = (layer_type == CONV || layer_type == POOL);
+
+    // Demand is pulled fold by fold by the buffers, so the full demand
+    // matrices of a layer are never materialized
+    auto run_pe = [&](int i, bool record) {
+        DemandStream *ifmap_demand_stream = &demand_streams[3 * i];
+        DemandStream *filter_demand_stream = &demand_streams[3 * i + 1];
+        DemandStream *ofmap_demand_stream = &demand_streams[3 * i + 2];
+
+        {
+            ScopedPhaseTimer timer(profiler, HostPhase::FETCH_LINES);
+            if (fetch_lines_ready)
+                memory_system[pe_list[i]]->set_fetch_lines(ifmap_demand_stream, filter_demand_stream, ofmap_demand_stream, &fetch_lines[3 * i]);
+            else
+                memory_system[pe_list[i]]->set_read_buf_prefetch_streams(ifmap_demand_stream, filter_demand_stream, ofmap_demand_stream);
         }
-             
+        if (!has_demand)
+            return;
+        ScopedPhaseTimer timer(profiler, HostPhase::SERVICE);
+        if (record)
+            memory_system[pe_list[i]]->record_memory_requests(ifmap_demand_stream, filter_demand_stream, ofmap_demand_stream, trans_ifmap, trans_filter, trans_ofmap);
+        else
+            memory_system[pe_list[i]]->service_memory_requests(ifmap_demand_stream, filter_demand_stream, ofmap_demand_stream, trans_ifmap, trans_filter, trans_ofmap);
+    };
+
+    // Traced with a separate pass over the demand, so runs without a sink
+    // generate it exactly once
+    if (trace_sink != NULL && has_demand) {
+        ScopedPhaseTimer timer(profiler, HostPhase::TRACE);
+        trace_sink->begin_layer(topology->get_layer_name(this->layer_id));
+        for (int i = 0; i < pe_list.size(); i++) {
+            SystolicDemandStream ifmap_demand_stream(compute_system, Operand::IFMAP, i);
+            SystolicDemandStream filter_demand_stream(compute_system, Operand::FILTER, i);
+            SystolicDemandStream ofmap_demand_stream(compute_system, Operand::OFMAP, i);
+            trace_sink->write_stream(Operand::IFMAP, pe_list[i], &ifmap_demand_stream);
+            trace_sink->write_stream(Operand::FILTER, pe_list[i], &filter_demand_stream);
+            trace_sink->write_stream(Operand::OFMAP, pe_list[i], &ofmap_demand_stream);
+        }
+        trace_sink->end_layer();
     }
 
-    // delete(&ifmap_op_mat);
-    // delete(&filter_demand_mats);
-    // delete(&ofmap_demand_mats);
+    if (thread_pool == NULL || pe_list.size() < 2) {
+        for (int i = 0; i < pe_list.size(); i++)
+            run_pe(i, false);
+    } else {
+        // The PEs share one LLC: their buffers run concurrently and only record
+        // the LLC traffic, which is then replayed in PE order so the results
+        // match the serial run exactly
+        for (int i = 0; i < pe_list.size(); i++)
+            thread_pool->submit([&run_pe, i] { run_pe(i, true); });
+        thread_pool->wait();
+
+        if (has_demand) {
+            ScopedPhaseTimer timer(profiler, HostPhase::REPLAY);
+            for (int i = 0; i < pe_list.size(); i++)
+                memory_system[pe_list[i]]->replay_memory_requests();
+        }
+    }
 
-    ifmap_demand_mats.clear();
-    filter_demand_mats.clear();
-    ofmap_demand_mats.clear();
+    end_layer();
 
-    // delete(operandMatrix);
-    // delete(compute_system);
+    if (use_result_cache())
+        store_result(cache_key, start_state);
 
     runs_ready = true;
 }
 
+void LayerSim::prepare()
+{
+    set_up_compute();
+
+    ScopedPhaseTimer timer(profiler, HostPhase::FETCH_LINES);
+    fetch_lines = vector<FetchLineWindow>(3 * pe_list.size());
+    for (int i = 0; i < pe_list.size(); i++)
+        memory_system[pe_list[i]]->build_fetch_lines(&demand_streams[3 * i], &demand_streams[3 * i + 1], &demand_streams[3 * i + 2], &fetch_lines[3 * i]);
+    fetch_lines_ready = true;
+}
+
+bool LayerSim::has_cached_result()
+{
+    return use_result_cache() && result_cache->contains(result_cache->make_key(config, topology, layer_id, pe_list.size()));
+}
+
+// Same on a result cache hit, which leaves the buffers as a simulated layer does
+void LayerSim::end_layer()
+{
+    for (int i = 0; i < pe_list.size(); i++)
+        memory_system[pe_list[i]]->end_layer();
+    vector<FetchLineWindow>().swap(fetch_lines);
+    fetch_lines_ready = false;
+}
+
+void LayerSim::set_up_compute()
+{
+    if (compute_ready)
+        return;
+
+    {
+        ScopedPhaseTimer timer(profiler, HostPhase::OPERAND_MATRIX);
+        operandMatrix->set_params(config, topology, layer_id);
+
+        // Operand addresses are computed on access, nothing is materialized
+        ifmap_op_mat = operandMatrix->get_ifmap_view();
+        filter_op_mat = operandMatrix->get_filter_view();
+        ofmap_op_mat = operandMatrix->get_ofmap_view();
+    }
+
+    {
+        ScopedPhaseTimer timer(profiler, HostPhase::COMPUTE_SETUP);
+        this->compute_system->set_params(config, ifmap_op_mat, filter_op_mat, ofmap_op_mat, pe_list.size());
+        this->compute_system->set_addr_window(operandMatrix->get_addr_window());
+    }
+
+    for (int i = 0; i < pe_list.size(); i++) {
+        demand_streams.push_back(SystolicDemandStream(compute_system, Operand::IFMAP, i));
+        demand_streams.push_back(SystolicDemandStream(compute_system, Operand::FILTER, i));
+        demand_streams.push_back(SystolicDemandStream(compute_system, Operand::OFMAP, i));
+    }
+    compute_ready = true;
+}
+
+// Tensor-interleaved memory banks place each operand on first use
+void LayerSim::place_tensors(Config *config, Topology *topology, int64_t layer_id)
+{
+    MemoryMap *memory_map = config->get_memory_map();
+    if (!memory_map->is_tensor_interleaved())
+        return;
+
+    OffsetInfo offsets = topology->get_layer_offsets(layer_id);
+    for (int64_t offset : offsets.ifmap_offset)
+        memory_map->add_tensor(offset);
+    memory_map->add_tensor(offsets.filter_offset);
+    memory_map->add_tensor(offsets.ofmap_offset);
+}
+
+// Cumulative cycles of the layer's PEs and LLC stats
+LayerResult LayerSim::get_state()
+{
+    LayerResult state;
+    for (int i = 0; i < pe_list.size(); i++) {
+        state.pe_total_cycles.push_back(memory_system[pe_list[i]]->get_total_compute_cycles());
+        state.pe_stall_cycles.push_back(memory_system[pe_list[i]]->get_stall_cycles());
+    }
+    state.llc_stats = memory_system[0]->getLLC()->get_llc_stats();
+    state.mapping_eff = 0.0f;
+    state.compute_util = 0.0f;
+    return state;
+}
+
+void LayerSim::apply_cached_result()
+{
+    printf("Layer %s: result cache hit, not simulated\n", topology->get_layer_name(this->layer_id).c_str());
+    for (int i = 0; i < pe_list.size(); i++) {
+        memory_system[pe_list[i]]->add_total_compute_cycles(cached_result.pe_total_cycles[i]);
+        memory_system[pe_list[i]]->add_stall_cycles(cached_result.pe_stall_cycles[i]);
+    }
+    memory_system[0]->getLLC()->add_llc_stats(cached_result.llc_stats);
+}
+
+// Stores what this layer added to the state it started from
+void LayerSim::store_result(const string &cache_key, const LayerResult &start_state)
+{
+    LayerResult result = get_state();
+    for (int i = 0; i < pe_list.size(); i++) {
+        result.pe_total_cycles[i] -= start_state.pe_total_cycles[i];
+        result.pe_stall_cycles[i] -= start_state.pe_stall_cycles[i];
+    }
+
+    LLCStats &stats = result.llc_stats;
+    const LLCStats &start_stats = start_state.llc_stats;
+    stats.read_hit -= start_stats.read_hit;
+    stats.read_miss_all -= start_stats.read_miss_all;
+    stats.read_miss_conflict -= start_stats.read_miss_conflict;
+    stats.write_hit -= start_stats.write_hit;
+    stats.write_miss_all -= start_stats.write_miss_all;
+    stats.write_miss_conflict -= start_stats.write_miss_conflict;
+
+    result.mapping_eff = compute_system->get_avg_mapping_efficiency() * 100;
+    result.compute_util = compute_system->get_avg_compute_utilization() * 100;
+    result_cache->store(cache_key, result);
+}
+
 void LayerSim::calc_report_data()
 {
     total_cycles = 0;
@@ -218,8 +395,13 @@ void LayerSim::calc_report_data()
         stall_cycles += memory_system[pe_list[i]]->get_stall_cycles();
     }
     overall_util = (num_compute * 100) / (total_cycles * num_mac_unit);
-    mapping_eff = compute_system->get_avg_mapping_efficiency() * 100;
-    compute_util = compute_system->get_avg_compute_utilization() * 100;
+    if (cache_hit) {
+        mapping_eff = cached_result.mapping_eff;
+        compute_util = cached_result.compute_util;
+    } else {
+        mapping_eff = compute_system->get_avg_mapping_efficiency() * 100;
+        compute_util = compute_system->get_avg_compute_utilization() * 100;
+    }
 
     report_items_ready = true;
 }
@@ -0,0 +1,74 @@
+#ifndef _address_window_h
+#define _address_window_h
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+
+typedef uint32_t compact_addr_t;
+
+// Byte range [base, end] holding every address a layer touches. Addresses
+// inside it are stored as a 32-bit offset from the base: 0 encodes the null
+// request -1 and addr encodes as addr - base + 1, so encoded lines sort in
+// the same order as the raw addresses.
+class AddressWindow
+{
+public:
+    AddressWindow();
+    AddressWindow(int64_t base, int64_t end);
+
+    int64_t get_base() const { return base; }
+    int64_t get_end() const { return end; }
+    bool empty() const { return end < base; }
+    bool contains(int64_t addr) const { return addr >= base && addr <= end; }
+
+    void merge(const AddressWindow &other);
+    // Same window at cache line granularity, for line addresses (addr >> offset_bits)
+    AddressWindow get_line_window(int offset_bits) const { return empty() ? AddressWindow() : AddressWindow(base >> offset_bits, end >> offset_bits); }
+
+    compact_addr_t encode(int64_t addr) const { return addr == -1 ? 0 : (compact_addr_t)(addr - base + 1); }
+    int64_t decode(compact_addr_t compact_addr) const { return compact_addr == 0 ? -1 : base + compact_addr - 1; }
+
+private:
+    void check_size();
+
+    int64_t base;
+    int64_t end;
+};
+
+// Empty window, merging anything into it yields the other window
+AddressWindow::AddressWindow()
+{
+    base = numeric_limits<int64_t>::max();
+    end = -1;
+}
+
+AddressWindow::AddressWindow(int64_t base, int64_t end)
+{
+    this->base = base;
+    this->end = max(base, end);
+    check_size();
+}
+
+void AddressWindow::merge(const AddressWindow &other)
+{
+    if (other.empty())
+        return;
+    base = min(base, other.base);
+    end = max(end, other.end);
+    check_size();
+}
+
+void AddressWindow::check_size()
+{
+    if (end - base + 1 >= (int64_t)numeric_limits<compact_addr_t>::max()) {
+        cout << "Address window [" << base << ", " << end << "] does not fit 32-bit offsets. Exiting!!!" << endl;
+        exit(1);
+    }
+}
+
+#endif
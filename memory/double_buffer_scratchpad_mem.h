@@ -11,12 +11,29 @@
 #include "read_buffer.h"
 #include "write_buffer.h"
 #include "llc.h"
+#include "llc_access_log.h"
 #include "dram.h"
+#include "fold_extrapolator.h"
+
+// Cycle counters a DoubleBuffer carries from one layer to the next
+typedef struct
+{
+    int64_t total_cycles;
+    int64_t stall_cycles;
+    int64_t ifmap_serviced_cycles;
+    int64_t filter_serviced_cycles;
+    int64_t ofmap_serviced_cycles;
+    FoldExtrapolator extrapolator;
+} BufferState;
 
 class DoubleBuffer
 {
 public:
     DoubleBuffer();
+    // Owns its buffers and DRAM, and the LLC unless it was given one
+    ~DoubleBuffer();
+    DoubleBuffer(const DoubleBuffer &) = delete;
+    DoubleBuffer& operator=(const DoubleBuffer &) = delete;
     void set_params(Config* config, 
                              int64_t word_size,
                              int64_t ifmap_buf_size_bytes,
@@ -40,6 +57,21 @@ public:
                              LLC *llc);
     void set_read_buf_prefetch_matrices(xt::xarray<int64_t> ifmap_prefetch_mat, xt::xarray<int64_t> filter_prefetch_mat, xt::xarray<int64_t> ofmap_prefetch_mat);
     void service_memory_requests(xt::xarray<int64_t> &ifmap_demand_mat, xt::xarray<int64_t> &filter_demand_mat, xt::xarray<int64_t> &ofmap_demand_mat, bool trans_ifmap, bool trans_filter, bool trans_ofmap);
+    void set_read_buf_prefetch_streams(DemandStream *ifmap_prefetch_stream, DemandStream *filter_prefetch_stream, DemandStream *ofmap_prefetch_stream);
+    // Split form of set_read_buf_prefetch_streams: build only reads the buffer
+    // sizes, so a layer's fetch lines (ifmap, filter, ofmap) can be built while
+    // the buffers service the previous layer; set hands them to the buffers.
+    void build_fetch_lines(DemandStream *ifmap_prefetch_stream, DemandStream *filter_prefetch_stream, DemandStream *ofmap_prefetch_stream, FetchLineWindow *fetch_lines);
+    void set_fetch_lines(DemandStream *ifmap_prefetch_stream, DemandStream *filter_prefetch_stream, DemandStream *ofmap_prefetch_stream, FetchLineWindow *fetch_lines);
+    void service_memory_requests(DemandStream *ifmap_demand_stream, DemandStream *filter_demand_stream, DemandStream *ofmap_demand_stream, bool trans_ifmap, bool trans_filter, bool trans_ofmap);
+    // Split form of service_memory_requests for PEs sharing one LLC: record
+    // runs the buffers without touching the LLC and may run concurrently for
+    // different PEs, replay must then be called for each PE in order.
+    void record_memory_requests(DemandStream *ifmap_demand_stream, DemandStream *filter_demand_stream, DemandStream *ofmap_demand_stream, bool trans_ifmap, bool trans_filter, bool trans_ofmap);
+    void replay_memory_requests();
+    // Frees the storage that only lives for one layer: the fetch lines of the
+    // demand streams and the recorded LLC traffic
+    void end_layer();
     void service_prefetch_demand_memory_requests(xt::xarray<int64_t> ifmap_op_mat, xt::xarray<int64_t> filter_op_mat, 
     xt::xarray<int64_t> ifmap_prefetch_demand_mat, xt::xarray<int64_t> filter_prefetch_demand_mat);
     LLC* getLLC() {return llc;}
@@ -51,6 +83,10 @@ public:
 
     void add_total_compute_cycles(int64_t cycles) { total_cycles += cycles;}
     void add_stall_cycles(int64_t cycles) { stall_cycles += cycles;}
+    FoldExtrapolator* get_fold_extrapolator() { return &extrapolator; }
+    // The LLC is checkpointed separately, it may be shared between buffers
+    BufferState get_state();
+    void set_state(const BufferState &state);
 
 private:
     Config* config;
@@ -61,9 +97,35 @@ private:
 
     LLC *llc;
     DRAM *dram;
+    bool owns_llc;
 
     bool verbose;
 
+    void service_demand_lines(int64_t ofmap_lines, int64_t fold_rows, int64_t fold_period, bool trans_ifmap, bool trans_filter, bool trans_ofmap);
+    void report_demand_lines(int64_t current_stall_cycles);
+    // At the end of every fold; true once the rest of the layer was extrapolated
+    bool end_fold(int64_t line_id, int64_t ofmap_lines, int64_t fold_rows, int64_t &current_stall_cycles);
+    // Rows without demand in any of the three buffers are stepped over in bulk
+    int64_t get_next_demand_row(int64_t row);
+    int64_t skip_idle_rows(int64_t row, int64_t end_row, int64_t fold_rows, int64_t &current_stall_cycles);
+    // Touches the LLC lines of folds [first_fold, end_fold) in demand order,
+    // so that later layers find the cache as the skipped folds leave it.
+    // Returns the touches that missed, -1 without demand streams.
+    int64_t warm_llc(int64_t first_fold, int64_t end_fold);
+
+    // Demand of the layer being serviced (ifmap, filter, ofmap), NULL for
+    // demand given as matrices
+    DemandStream *demand_streams[3];
+
+    LLCAccessLog access_log;
+    int64_t recorded_ofmap_lines;
+    int64_t recorded_fold_rows;
+    int64_t recorded_fold_period;
+
+    FoldExtrapolator extrapolator;
+    LLCStats fold_start_llc_stats;
+    int64_t fold_start_stall_cycles;
+
     int64_t total_cycles;
     int64_t compute_cycles;
     int64_t stall_cycles;
@@ -102,6 +164,15 @@ private:
 };
 
 DoubleBuffer::DoubleBuffer() {
+    ifmap_L1_buf = NULL;
+    filter_L1_buf = NULL;
+    ofmap_L1_buf = NULL;
+    llc = NULL;
+    dram = NULL;
+    owns_llc = false;
+    for (int b = 0; b < 3; b++)
+        demand_streams[b] = NULL;
+
     total_cycles = 0;
     stall_cycles = 0;
 
@@ -123,11 +194,17 @@ void DoubleBuffer::set_params(Config* config,
 {
     this->config = config;
     dram = new DRAM();
+    owns_llc = true;
+    auto llcConfig = config->get_llc_config();
+    auto dramConfig = config->get_dram_config();
+    dram->set_params(dramConfig.num_channels, dramConfig.num_banks, dramConfig.row_buffer_bytes, llcConfig.cache_line_size,
+        dramConfig.row_hit_latency, dramConfig.row_miss_latency, dramConfig.row_conflict_latency, dramConfig.bytes_per_cycle);
+    dram->set_memory_map(config->get_memory_map());
 
     llc = new LLC();
-    auto llcConfig = config->get_llc_config();
     llc->set_params(dram, llcConfig.total_size_bytes, llcConfig.cache_line_size, 
         llcConfig.hit_latency, llcConfig.set_associativity, llcConfig.partition, llcConfig.is_always_hit, llcConfig.is_bypassing);
+    llc->set_num_mshr(llcConfig.num_mshr);
         
     ifmap_L1_buf = new ReadBuffer(false);
     filter_L1_buf = new ReadBuffer(false);
@@ -138,6 +215,8 @@ void DoubleBuffer::set_params(Config* config,
     ofmap_L1_buf = new WriteBuffer();
     ofmap_L1_buf->set_params(llc, ofmap_buf_size_bytes, word_size, wr_buf_active_frac, ofmap_backing_bw);
 
+    extrapolator.set_params(config->get_fold_extrapolation(), config->get_extrapolation_tolerance());
+
     this->verbose = verbose;
     params_valid_flag = true;
 }
@@ -155,9 +234,8 @@ void DoubleBuffer::set_params(Config* config,
                              LLC *llc)
 {
     this->config = config;
-    dram = new DRAM();
-
     this->llc = llc;
+    owns_llc = false;
 
     ifmap_L1_buf = new ReadBuffer(false);
     filter_L1_buf = new ReadBuffer(false);
@@ -168,10 +246,43 @@ void DoubleBuffer::set_params(Config* config,
     ofmap_L1_buf = new WriteBuffer();
     ofmap_L1_buf->set_params(llc, ofmap_buf_size_bytes, word_size, wr_buf_active_frac, ofmap_backing_bw);
 
+    extrapolator.set_params(config->get_fold_extrapolation(), config->get_extrapolation_tolerance());
+
     this->verbose = verbose;
     params_valid_flag = true;
 }
 
+DoubleBuffer::~DoubleBuffer() {
+    delete ifmap_L1_buf;
+    delete filter_L1_buf;
+    delete ofmap_L1_buf;
+    if (owns_llc)
+        delete llc;
+    delete dram;
+}
+
+void DoubleBuffer::end_layer() {
+    ifmap_L1_buf->release_lines();
+    filter_L1_buf->release_lines();
+    ofmap_L1_buf->release_lines();
+    access_log.release();
+    for (int b = 0; b < 3; b++)
+        demand_streams[b] = NULL;
+}
+
+BufferState DoubleBuffer::get_state() {
+    return {total_cycles, stall_cycles, ifmap_serviced_cycles, filter_serviced_cycles, ofmap_serviced_cycles, extrapolator};
+}
+
+void DoubleBuffer::set_state(const BufferState &state) {
+    total_cycles = state.total_cycles;
+    stall_cycles = state.stall_cycles;
+    ifmap_serviced_cycles = state.ifmap_serviced_cycles;
+    filter_serviced_cycles = state.filter_serviced_cycles;
+    ofmap_serviced_cycles = state.ofmap_serviced_cycles;
+    extrapolator = state.extrapolator;
+}
+
 void DoubleBuffer::set_read_buf_prefetch_matrices(xt::xarray<int64_t> ifmap_prefetch_mat, xt::xarray<int64_t> filter_prefetch_mat, xt::xarray<int64_t> ofmap_prefetch_mat) {
     ifmap_L1_buf->set_fetch_matrix(ifmap_prefetch_mat);
     filter_L1_buf->set_fetch_matrix(filter_prefetch_mat);
@@ -179,64 +290,176 @@ void DoubleBuffer::set_read_buf_prefetch_matrices(xt::xarray<int64_t> ifmap_pref
 }
 
 
+void DoubleBuffer::set_read_buf_prefetch_streams(DemandStream *ifmap_prefetch_stream, DemandStream *filter_prefetch_stream, DemandStream *ofmap_prefetch_stream) {
+    ifmap_L1_buf->set_fetch_stream(ifmap_prefetch_stream);
+    filter_L1_buf->set_fetch_stream(filter_prefetch_stream);
+    ofmap_L1_buf->set_fetch_stream(ofmap_prefetch_stream);
+}
+
+void DoubleBuffer::build_fetch_lines(DemandStream *ifmap_prefetch_stream, DemandStream *filter_prefetch_stream, DemandStream *ofmap_prefetch_stream, FetchLineWindow *fetch_lines) {
+    ifmap_L1_buf->build_fetch_lines(ifmap_prefetch_stream, fetch_lines[0]);
+    filter_L1_buf->build_fetch_lines(filter_prefetch_stream, fetch_lines[1]);
+    ofmap_L1_buf->build_fetch_lines(ofmap_prefetch_stream, fetch_lines[2]);
+}
+
+void DoubleBuffer::set_fetch_lines(DemandStream *ifmap_prefetch_stream, DemandStream *filter_prefetch_stream, DemandStream *ofmap_prefetch_stream, FetchLineWindow *fetch_lines) {
+    ifmap_L1_buf->set_fetch_lines(ifmap_prefetch_stream, fetch_lines[0]);
+    filter_L1_buf->set_fetch_lines(filter_prefetch_stream, fetch_lines[1]);
+    ofmap_L1_buf->set_fetch_lines(ofmap_prefetch_stream, fetch_lines[2]);
+}
+
 void DoubleBuffer::service_memory_requests(xt::xarray<int64_t> &ifmap_demand_mat, xt::xarray<int64_t> &filter_demand_mat, xt::xarray<int64_t> &ofmap_demand_mat, bool trans_ifmap, bool trans_filter, bool trans_ofmap) {
-    int64_t ofmap_lines = ofmap_demand_mat.shape()[0];
+    for (int b = 0; b < 3; b++)
+        demand_streams[b] = NULL;
+    service_demand_lines(ofmap_demand_mat.shape()[0], ofmap_demand_mat.shape()[0], 1, trans_ifmap, trans_filter, trans_ofmap);
+}
+
+void DoubleBuffer::service_memory_requests(DemandStream *ifmap_demand_stream, DemandStream *filter_demand_stream, DemandStream *ofmap_demand_stream, bool trans_ifmap, bool trans_filter, bool trans_ofmap) {
+    // The buffers pull the demand lines from their fetch streams, only the
+    // number of ofmap rows is needed to drive the loop
+    demand_streams[0] = ifmap_demand_stream;
+    demand_streams[1] = filter_demand_stream;
+    demand_streams[2] = ofmap_demand_stream;
+    service_demand_lines(ofmap_demand_stream->get_num_rows(), ofmap_demand_stream->get_fold_rows(), ofmap_demand_stream->get_fold_period(), trans_ifmap, trans_filter, trans_ofmap);
+}
 
+void DoubleBuffer::service_demand_lines(int64_t ofmap_lines, int64_t fold_rows, int64_t fold_period, bool trans_ifmap, bool trans_filter, bool trans_ofmap) {
     int64_t ifmap_hit_latency = ifmap_L1_buf->get_hit_latency();
     int64_t filter_hit_latency = ifmap_L1_buf->get_hit_latency();
 
+    // A PE without rows in this layer spends no cycles on it
+    ifmap_serviced_cycles = 0;
+    filter_serviced_cycles = 0;
+    ofmap_serviced_cycles = 0;
+
     int64_t current_stall_cycles = 0;
+    if (extrapolator.is_enabled() && fold_rows > 0) {
+        extrapolator.start(ofmap_lines / fold_rows, fold_period, llc->is_warmed());
+        fold_start_llc_stats = llc->get_llc_stats();
+        fold_start_stall_cycles = 0;
+    }
 
     for (int64_t i = 0; i < ofmap_lines; i++) {
         // cout << "process " << i << " of " << ofmap_lines << endl;
-        int64_t incoming_cycle_arr = 1 + i + current_stall_cycles;
-
-        xt::xarray<int64_t> ifmap_demand_line = xt::view(ifmap_demand_mat, i, xt::all());
-        int64_t ifmap_cycle_out;
-        if (config->is_use_llc_partition()) {
-            // ifmap_cycle_out = ifmap_L1_buf->service_read(ifmap_demand_line, incoming_cycle_arr, 0, trans_ifmap);
-            ifmap_cycle_out = ifmap_L1_buf->service_read(i, incoming_cycle_arr, 0, trans_ifmap);
+        int64_t idle_end = min(get_next_demand_row(i), ofmap_lines);
+        if (idle_end > i) {
+            i = skip_idle_rows(i, idle_end, fold_rows, current_stall_cycles);
         } else {
-            // ifmap_cycle_out = ifmap_L1_buf->service_read(ifmap_demand_line, incoming_cycle_arr, 0, trans_ifmap);
-            ifmap_cycle_out = ifmap_L1_buf->service_read(i, incoming_cycle_arr, 0, trans_ifmap);
-        }
-        ifmap_serviced_cycles = ifmap_cycle_out;
-        int64_t ifmap_stalls = ifmap_cycle_out - incoming_cycle_arr - ifmap_hit_latency;
-
-        // cout << "ifmap_demand_line is " << ifmap_demand_line << endl;
-        // cout << "ifmap_serviced_cycles is " << ifmap_serviced_cycles << endl;
-            
-        xt::xarray<int64_t> filter_demand_line = xt::view(filter_demand_mat, i, xt::all());
-        int64_t filter_cycle_out;
-        if (config->is_use_llc_partition()) {
-            // filter_cycle_out = filter_L1_buf->service_read(filter_demand_line, incoming_cycle_arr, 1, trans_filter);
-            filter_cycle_out = filter_L1_buf->service_read(i, incoming_cycle_arr, 1, trans_filter);
-        } else {
-            // filter_cycle_out = filter_L1_buf->service_read(filter_demand_line, incoming_cycle_arr, 0, trans_filter);
-            filter_cycle_out = filter_L1_buf->service_read(i, incoming_cycle_arr, 0, trans_filter);
-        }
-        filter_serviced_cycles = filter_cycle_out;
-        int64_t filter_stalls = filter_cycle_out - incoming_cycle_arr - filter_hit_latency;
+            int64_t incoming_cycle_arr = 1 + i + current_stall_cycles;
 
-        // cout << "filter_demand_line is " << filter_demand_line << endl;
-        // cout << "filter_serviced_cycles is " << filter_serviced_cycles << endl;
+            int64_t ifmap_cycle_out = ifmap_L1_buf->service_read(i, incoming_cycle_arr, 0, trans_ifmap);
+            ifmap_serviced_cycles = ifmap_cycle_out;
+            int64_t ifmap_stalls = ifmap_cycle_out - incoming_cycle_arr - ifmap_hit_latency;
 
-        xt::xarray<int64_t> ofmap_demand_line = xt::view(ofmap_demand_mat, i, xt::all());
-        int64_t ofmap_cycle_out;
-        if (config->is_use_llc_partition()) {
-            // ofmap_cycle_out = ofmap_L1_buf->service_write(ofmap_demand_line, incoming_cycle_arr, 0, trans_ofmap);
-            ofmap_cycle_out = ofmap_L1_buf->service_write(i, incoming_cycle_arr, 0, trans_ofmap);
-        } else {
-            // ofmap_cycle_out = ofmap_L1_buf->service_write(ofmap_demand_line, incoming_cycle_arr, 0, trans_ofmap);
-            ofmap_cycle_out = ofmap_L1_buf->service_write(i, incoming_cycle_arr, 0, trans_ofmap);
+            // cout << "ifmap_serviced_cycles is " << ifmap_serviced_cycles << endl;
+
+            int64_t filter_cycle_out;
+            if (config->is_use_llc_partition()) {
+                filter_cycle_out = filter_L1_buf->service_read(i, incoming_cycle_arr, 1, trans_filter);
+            } else {
+                filter_cycle_out = filter_L1_buf->service_read(i, incoming_cycle_arr, 0, trans_filter);
+            }
+            filter_serviced_cycles = filter_cycle_out;
+            int64_t filter_stalls = filter_cycle_out - incoming_cycle_arr - filter_hit_latency;
+
+            // cout << "filter_serviced_cycles is " << filter_serviced_cycles << endl;
+
+            int64_t ofmap_cycle_out = ofmap_L1_buf->service_write(i, incoming_cycle_arr, 0, trans_ofmap);
+            ofmap_serviced_cycles = ofmap_cycle_out;
+            int64_t ofmap_stalls = ofmap_cycle_out - incoming_cycle_arr - 1;
+
+            // cout << "ofmap_serviced_cycles is " << ofmap_serviced_cycles << endl;
+            current_stall_cycles += max(ifmap_stalls, max(filter_stalls, ofmap_stalls));
         }
-        ofmap_serviced_cycles = ofmap_cycle_out;
-        int64_t ofmap_stalls = ofmap_cycle_out - incoming_cycle_arr - 1;
 
-        // cout << "ofmap_demand_line is " << ofmap_demand_line << endl;
-        // cout << "ofmap_serviced_cycles is " << ofmap_serviced_cycles << endl;
-        current_stall_cycles += max(ifmap_stalls, max(filter_stalls, ofmap_stalls));
+        if (extrapolator.is_enabled() && fold_rows > 0 && (i + 1) % fold_rows == 0 &&
+            end_fold(i, ofmap_lines, fold_rows, current_stall_cycles))
+            break;
     }
+    report_demand_lines(current_stall_cycles);
+}
+
+bool DoubleBuffer::end_fold(int64_t line_id, int64_t ofmap_lines, int64_t fold_rows, int64_t &current_stall_cycles) {
+    LLCStats llc_stats = llc->get_llc_stats();
+    LLCStats fold_stats;
+    fold_stats.read_hit = llc_stats.read_hit - fold_start_llc_stats.read_hit;
+    fold_stats.read_miss_all = llc_stats.read_miss_all - fold_start_llc_stats.read_miss_all;
+    fold_stats.read_miss_conflict = llc_stats.read_miss_conflict - fold_start_llc_stats.read_miss_conflict;
+    fold_stats.write_hit = llc_stats.write_hit - fold_start_llc_stats.write_hit;
+    fold_stats.write_miss_all = llc_stats.write_miss_all - fold_start_llc_stats.write_miss_all;
+    fold_stats.write_miss_conflict = llc_stats.write_miss_conflict - fold_start_llc_stats.write_miss_conflict;
+
+    bool is_steady = extrapolator.add_fold(current_stall_cycles - fold_start_stall_cycles, fold_stats);
+    fold_start_llc_stats = llc_stats;
+    fold_start_stall_cycles = current_stall_cycles;
+    if (!is_steady)
+        return false;
+
+    // The remaining rows each take one cycle plus their share of the stalls
+    int64_t remaining_lines = ofmap_lines - line_id - 1;
+    int64_t remaining_folds = remaining_lines / fold_rows;
+    // The skipped folds still leave their lines in the LLC; the misses of
+    // their whole periods check the extrapolated stalls
+    int64_t first_fold = ofmap_lines / fold_rows - remaining_folds;
+    int64_t period_folds = remaining_folds / extrapolator.get_fold_period() * extrapolator.get_fold_period();
+    int64_t skipped_misses = warm_llc(first_fold, first_fold + period_folds);
+    warm_llc(first_fold + period_folds, first_fold + remaining_folds);
+    int64_t extra_stall_cycles = extrapolator.extrapolate(remaining_folds, skipped_misses, llc);
+    current_stall_cycles += extra_stall_cycles;
+    ifmap_serviced_cycles += remaining_lines + extra_stall_cycles;
+    filter_serviced_cycles += remaining_lines + extra_stall_cycles;
+    ofmap_serviced_cycles += remaining_lines + extra_stall_cycles;
+    return true;
+}
+
+int64_t DoubleBuffer::warm_llc(int64_t first_fold, int64_t end_fold) {
+    if (demand_streams[0] == NULL)
+        return -1;
+
+    int partition[3] = {0, config->is_use_llc_partition() ? 1 : 0, 0};
+    PaddedDemand fold_buf;
+    int64_t misses = 0;
+    for (int64_t fold_id = first_fold; fold_id < end_fold; fold_id++) {
+        for (int b = 0; b < 3; b++) {
+            const PaddedDemand &fold = demand_streams[b]->get_fold(fold_id, fold_buf);
+            misses += llc->warm(fold.get_block_data(), fold.get_block_elems(), b == 2, partition[b]);
+        }
+    }
+    return misses;
+}
+
+// Rows before the returned one have no demand in any of the buffers
+int64_t DoubleBuffer::get_next_demand_row(int64_t row) {
+    int64_t next_row = ifmap_L1_buf->get_next_demand_line(row);
+    next_row = min(next_row, filter_L1_buf->get_next_demand_line(row));
+    next_row = min(next_row, ofmap_L1_buf->get_next_demand_line(row));
+    return next_row;
+}
+
+// Services the idle rows [row, end_row) in one step, stopping at the end of a
+// fold while extrapolating, and returns the last row serviced. An idle row
+// leaves each buffer after its hit latency, so every row stalls the same
+// cycles as it would serviced row by row.
+int64_t DoubleBuffer::skip_idle_rows(int64_t row, int64_t end_row, int64_t fold_rows, int64_t &current_stall_cycles) {
+    if (extrapolator.is_enabled() && fold_rows > 0)
+        end_row = min(end_row, (row / fold_rows + 1) * fold_rows);
+
+    int64_t hit_latency[3] = {ifmap_L1_buf->get_hit_latency(), filter_L1_buf->get_hit_latency(), ofmap_L1_buf->get_hit_latency()};
+    int64_t stall_latency[3] = {ifmap_L1_buf->get_hit_latency(), ifmap_L1_buf->get_hit_latency(), 1};
+    int64_t row_stalls = 0;
+    for (int b = 0; b < 3; b++)
+        row_stalls = max(row_stalls, hit_latency[b] - stall_latency[b]);
+
+    int64_t num_rows = end_row - row;
+    int64_t last_incoming_cycle = end_row + current_stall_cycles + (num_rows - 1) * row_stalls;
+    ifmap_serviced_cycles = last_incoming_cycle + hit_latency[0];
+    filter_serviced_cycles = last_incoming_cycle + hit_latency[1];
+    ofmap_serviced_cycles = last_incoming_cycle + hit_latency[2];
+    current_stall_cycles += num_rows * row_stalls;
+    return end_row - 1;
+}
+
+void DoubleBuffer::report_demand_lines(int64_t current_stall_cycles) {
     llc->dump_stats();
 
     cout << "current_stall_cycles is " << current_stall_cycles << endl;
@@ -248,6 +471,101 @@ void DoubleBuffer::service_memory_requests(xt::xarray<int64_t> &ifmap_demand_mat
     total_cycles += ofmap_serviced_cycles;
 }
 
+void DoubleBuffer::record_memory_requests(DemandStream *ifmap_demand_stream, DemandStream *filter_demand_stream, DemandStream *ofmap_demand_stream, bool trans_ifmap, bool trans_filter, bool trans_ofmap) {
+    int filter_partition = config->is_use_llc_partition() ? 1 : 0;
+
+    access_log.clear();
+    demand_streams[0] = ifmap_demand_stream;
+    demand_streams[1] = filter_demand_stream;
+    demand_streams[2] = ofmap_demand_stream;
+    AddressWindow addr_window = ifmap_demand_stream->get_addr_window();
+    addr_window.merge(filter_demand_stream->get_addr_window());
+    addr_window.merge(ofmap_demand_stream->get_addr_window());
+    access_log.set_addr_window(addr_window);
+    ifmap_L1_buf->set_access_log(&access_log, 0);
+    filter_L1_buf->set_access_log(&access_log, 1);
+    ofmap_L1_buf->set_access_log(&access_log, 2);
+
+    // Which lines get prefetched only depends on the line ids, so the cycles
+    // passed in here do not matter
+    recorded_ofmap_lines = ofmap_demand_stream->get_num_rows();
+    recorded_fold_rows = ofmap_demand_stream->get_fold_rows();
+    recorded_fold_period = ofmap_demand_stream->get_fold_period();
+    for (int64_t i = get_next_demand_row(0); i < recorded_ofmap_lines; i = get_next_demand_row(i + 1)) {
+        ifmap_L1_buf->service_read(i, 0, 0, trans_ifmap);
+        filter_L1_buf->service_read(i, 0, filter_partition, trans_filter);
+        ofmap_L1_buf->service_write(i, 0, 0, trans_ofmap);
+    }
+
+    ifmap_L1_buf->set_access_log(NULL, 0);
+    filter_L1_buf->set_access_log(NULL, 1);
+    ofmap_L1_buf->set_access_log(NULL, 2);
+}
+
+void DoubleBuffer::replay_memory_requests() {
+    // Redo the cycle bookkeeping of service_demand_lines with the prefetch
+    // latencies from the replay. Each prefetch is replayed from the cycle the
+    // serial run issued it at, in the serial order, so a layer extrapolated
+    // after some folds leaves the LLC as the serial run does.
+    int64_t hit_latency[3] = {ifmap_L1_buf->get_hit_latency(), filter_L1_buf->get_hit_latency(), ofmap_L1_buf->get_hit_latency()};
+    int64_t stall_latency[3] = {ifmap_L1_buf->get_hit_latency(), ifmap_L1_buf->get_hit_latency(), 1};
+    int64_t last_prefetch_cycle[3] = {-1, -1, -1};
+    int64_t cycle_out[3];
+
+    ifmap_serviced_cycles = 0;
+    filter_serviced_cycles = 0;
+    ofmap_serviced_cycles = 0;
+
+    int64_t current_stall_cycles = 0;
+    size_t event_id = 0;
+    if (extrapolator.is_enabled() && recorded_fold_rows > 0) {
+        extrapolator.start(recorded_ofmap_lines / recorded_fold_rows, recorded_fold_period, llc->is_warmed());
+        fold_start_llc_stats = llc->get_llc_stats();
+        fold_start_stall_cycles = 0;
+    }
+
+    for (int64_t i = 0; i < recorded_ofmap_lines; i++) {
+        // Rows up to the next recorded prefetch are idle
+        int64_t idle_end = recorded_ofmap_lines;
+        if (event_id < access_log.events.size())
+            idle_end = min(idle_end, (int64_t)access_log.events[event_id].request_line_id);
+        if (idle_end > i) {
+            i = skip_idle_rows(i, idle_end, recorded_fold_rows, current_stall_cycles);
+        } else {
+            int64_t incoming_cycle_arr = 1 + i + current_stall_cycles;
+            for (int b = 0; b < 3; b++)
+                cycle_out[b] = incoming_cycle_arr + hit_latency[b];
+
+            for (; event_id < access_log.events.size() && access_log.events[event_id].request_line_id == i; event_id++) {
+                const PrefetchEvent &event = access_log.events[event_id];
+                int b = event.buffer;
+                if (event.kind == PrefetchKind::INIT) {
+                    llc->replay(access_log, event_id, last_prefetch_cycle[b]);
+                    last_prefetch_cycle[b] += event.latency;
+                } else {
+                    int64_t cycle = max(incoming_cycle_arr, last_prefetch_cycle[b]);
+                    llc->replay(access_log, event_id, cycle);
+                    last_prefetch_cycle[b] = cycle + event.latency;
+                    cycle_out[b] = cycle + hit_latency[b];
+                }
+            }
+
+            ifmap_serviced_cycles = cycle_out[0];
+            filter_serviced_cycles = cycle_out[1];
+            ofmap_serviced_cycles = cycle_out[2];
+
+            int64_t stalls = cycle_out[0] - incoming_cycle_arr - stall_latency[0];
+            for (int b = 1; b < 3; b++)
+                stalls = max(stalls, cycle_out[b] - incoming_cycle_arr - stall_latency[b]);
+            current_stall_cycles += stalls;
+        }
+
+        if (extrapolator.is_enabled() && recorded_fold_rows > 0 && (i + 1) % recorded_fold_rows == 0 &&
+            end_fold(i, recorded_ofmap_lines, recorded_fold_rows, current_stall_cycles))
+            break;
+    }
+    report_demand_lines(current_stall_cycles);
+}
 
 void DoubleBuffer::service_prefetch_demand_memory_requests(xt::xarray<int64_t> ifmap_op_mat, xt::xarray<int64_t> filter_op_mat, 
     xt::xarray<int64_t> ifmap_prefetch_demand_mat, xt::xarray<int64_t> filter_prefetch_demand_mat) {
@@ -1,16 +1,342 @@
 #ifndef _dram_h
 #define _dram_h
 
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "../memory_map.h"
+
+using namespace std;
+
+// Cumulative traffic of one memory bank
+typedef struct
+{
+    int64_t requests;
+    int64_t stall_cycles;
+    int64_t busy_cycles;
+} MemoryBankStats;
+
+// What carries over from one layer to the next: open rows and counters
+typedef struct
+{
+    vector<int64_t> open_row;
+    vector<MemoryBankStats> bank_stats;
+    int64_t row_hits;
+    int64_t row_misses;
+    int64_t row_conflicts;
+    int64_t bank_stall_cycles;
+    int64_t bus_stall_cycles;
+} DRAMState;
+
+// Cycles a shared resource is taken, counted per window of window_cycles
+// cycles, over the timeline of one layer. Requests do not arrive in cycle
+// order: the PEs of a layer are simulated one after the other on the same
+// timeline, and each buffer's prefetches run ahead of the others'. A request
+// therefore takes the first window from its ready cycle on that still has
+// room, rather than queueing behind whichever request was seen last, so the
+// limit holds over every window whatever the order.
+class BusyWindows
+{
+public:
+    BusyWindows();
+    void set_params(int64_t window_cycles, int64_t capacity);
+    void clear() { busy.clear(); }
+    // Serves busy_cycles after those its window holds already, from
+    // ready_cycle on; returns the cycle they start
+    int64_t reserve(int64_t ready_cycle, int64_t busy_cycles);
+    // First cycle from ready_cycle on whose window has busy_cycles to spare
+    int64_t find(int64_t ready_cycle, int64_t busy_cycles);
+    // Marks [start_cycle, end_cycle) busy, up to the capacity of each window
+    // it spans; returns the cycles newly counted
+    int64_t add(int64_t start_cycle, int64_t end_cycle);
+
+private:
+    int64_t get_window(int64_t cycle);
+
+    int64_t window_cycles;
+    int64_t capacity;
+    // Busy cycles of each window; layers can run for hundreds of millions of
+    // cycles, so they are kept narrow
+    vector<uint16_t> busy;
+};
+
+BusyWindows::BusyWindows()
+{
+    set_params(64, 64);
+}
+
+void BusyWindows::set_params(int64_t window_cycles, int64_t capacity)
+{
+    this->window_cycles = max(window_cycles, (int64_t)1);
+    this->capacity = min(max(capacity, (int64_t)1), (int64_t)UINT16_MAX);
+    busy.clear();
+}
+
+// Index of the window holding cycle, grown on demand
+int64_t BusyWindows::get_window(int64_t cycle)
+{
+    int64_t window = max(cycle, (int64_t)0) / window_cycles;
+    if (window >= (int64_t)busy.size())
+        busy.resize(window + 1, 0);
+    return window;
+}
+
+int64_t BusyWindows::reserve(int64_t ready_cycle, int64_t busy_cycles)
+{
+    if (busy_cycles <= 0)
+        return ready_cycle;
+    busy_cycles = min(busy_cycles, capacity);
+
+    int64_t window = get_window(ready_cycle);
+    while (busy[window] + busy_cycles > capacity)
+        window = get_window((window + 1) * window_cycles);
+    int64_t start_cycle = max(ready_cycle, window * window_cycles + busy[window]);
+    busy[window] += busy_cycles;
+    return start_cycle;
+}
+
+int64_t BusyWindows::find(int64_t ready_cycle, int64_t busy_cycles)
+{
+    busy_cycles = min(busy_cycles, capacity);
+    int64_t window = get_window(ready_cycle);
+    while (busy[window] + busy_cycles > capacity)
+        window = get_window((window + 1) * window_cycles);
+    return max(ready_cycle, window * window_cycles);
+}
+
+int64_t BusyWindows::add(int64_t start_cycle, int64_t end_cycle)
+{
+    int64_t added = 0;
+    for (int64_t cycle = max(start_cycle, (int64_t)0); cycle < end_cycle;) {
+        int64_t window = get_window(cycle);
+        int64_t window_end = min(end_cycle, (window + 1) * window_cycles);
+        int64_t cycles = min(window_end - cycle, capacity - busy[window]);
+        busy[window] += cycles;
+        added += cycles;
+        cycle = window_end;
+    }
+    return added;
+}
+
+// Cache lines are interleaved over channels and banks a row buffer at a
+// time: line = row | bank | channel | column. An access to the open row of
+// its bank costs row_hit_latency, to a closed bank row_miss_latency, and to
+// another row row_conflict_latency. Each channel moves bytes_per_cycle /
+// num_channels bytes per cycle; 0 leaves the bandwidth unlimited.
+//
+// With a memory map of several memory banks, each memory bank is a device
+// of its own with this organization, and a line goes to the device the map
+// assigns it. A request waits in its device's queue while the bank or
+// channel it needs is busy; those cycles count as the device's stall cycles.
+//
+// Issue cycles are those of the layer's timeline, and the cycles each bank
+// and channel is busy are kept over the whole layer, so requests of
+// different LLC calls, buffers and PEs contend with each other. A layer
+// starts with idle banks and channels, while the open rows carry over.
+// With the defaults every access costs 40 cycles.
 class DRAM {
 public:
     DRAM();
-    int64_t get_latency() {return hit_latency; }
+    void set_params(int num_channels, int num_banks, int64_t row_buffer_bytes, int64_t cache_line_size,
+        int64_t row_hit_latency, int64_t row_miss_latency, int64_t row_conflict_latency, int64_t bytes_per_cycle);
+    // Latency of an access to a closed row, without contention
+    int64_t get_latency() {return row_miss_latency; }
+    void set_memory_map(MemoryMap *memory_map);
+    int get_num_mem_banks() {return num_mem_banks; }
+    vector<MemoryBankStats> get_bank_stats() {return bank_stats; }
+    bool is_banked() {return num_mem_banks * num_channels * num_banks > 1 || bytes_per_cycle > 0 ||
+        row_hit_latency != row_miss_latency || row_conflict_latency != row_miss_latency; }
+
+    // The layer's timeline starts over
+    void start_layer();
+    // Cycle the line issued at issue_cycle is returned
+    int64_t service_request(int64_t line_addr, int64_t issue_cycle);
+    void dump_stats();
+
+    void save_state(DRAMState &state);
+    void restore_state(const DRAMState &state);
+
 private:
-    int64_t hit_latency;
+    void reset_state();
+
+    MemoryMap *memory_map;
+    int num_mem_banks;
+    int num_channels;
+    int num_banks;
+    int64_t lines_per_row;
+    int64_t cache_line_size;
+    int64_t row_hit_latency;
+    int64_t row_miss_latency;
+    int64_t row_conflict_latency;
+    int64_t bytes_per_cycle;
+    int64_t transfer_cycles;
+
+    // Per bank, indexed (mem_bank * num_channels + channel) * num_banks + bank
+    vector<int64_t> open_row;
+    vector<BusyWindows> bank_busy;
+    vector<BusyWindows> channel_busy;
+    // Per memory bank, the cycles it had a request in service
+    vector<BusyWindows> mem_busy;
+    vector<MemoryBankStats> bank_stats;
+
+    int64_t row_hits;
+    int64_t row_misses;
+    int64_t row_conflicts;
+    int64_t bank_stall_cycles;
+    int64_t bus_stall_cycles;
 };
 
 DRAM::DRAM() {
-    hit_latency = 40;
+    memory_map = NULL;
+    num_mem_banks = 1;
+    row_hits = 0;
+    row_misses = 0;
+    row_conflicts = 0;
+    bank_stall_cycles = 0;
+    bus_stall_cycles = 0;
+    set_params(1, 1, 2048, 64, 40, 40, 40, 0);
+}
+
+void DRAM::set_params(int num_channels, int num_banks, int64_t row_buffer_bytes, int64_t cache_line_size,
+    int64_t row_hit_latency, int64_t row_miss_latency, int64_t row_conflict_latency, int64_t bytes_per_cycle)
+{
+    this->num_channels = max(num_channels, 1);
+    this->num_banks = max(num_banks, 1);
+    this->cache_line_size = cache_line_size;
+    this->lines_per_row = max(row_buffer_bytes / cache_line_size, (int64_t)1);
+    this->row_hit_latency = row_hit_latency;
+    this->row_miss_latency = row_miss_latency;
+    this->row_conflict_latency = row_conflict_latency;
+    this->bytes_per_cycle = bytes_per_cycle;
+
+    // Burst of one line on its channel
+    int64_t channel_bytes_per_cycle = bytes_per_cycle / this->num_channels;
+    if (bytes_per_cycle > 0)
+        transfer_cycles = (cache_line_size + max(channel_bytes_per_cycle, (int64_t)1) - 1) / max(channel_bytes_per_cycle, (int64_t)1);
+    else
+        transfer_cycles = 0;
+
+    reset_state();
+}
+
+void DRAM::set_memory_map(MemoryMap *memory_map)
+{
+    this->memory_map = memory_map;
+    num_mem_banks = (int)max(memory_map->num_banks, (int64_t)1);
+    reset_state();
+}
+
+void DRAM::reset_state()
+{
+    int total_channels = num_mem_banks * num_channels;
+    open_row.assign(total_channels * num_banks, -1);
+
+    // Windows of a few requests each, so the limits hold over short stretches
+    int64_t bank_cycles = max(row_miss_latency, row_conflict_latency) - row_hit_latency + transfer_cycles;
+    int64_t window_cycles = max((int64_t)64, 2 * max(bank_cycles, transfer_cycles));
+    BusyWindows busy;
+    busy.set_params(window_cycles, window_cycles);
+    bank_busy.assign(total_channels * num_banks, busy);
+    channel_busy.assign(total_channels, busy);
+    mem_busy.assign(num_mem_banks, busy);
+    bank_stats.assign(num_mem_banks, {0, 0, 0});
+}
+
+void DRAM::start_layer()
+{
+    for (auto &busy : bank_busy)
+        busy.clear();
+    for (auto &busy : channel_busy)
+        busy.clear();
+    for (auto &busy : mem_busy)
+        busy.clear();
+}
+
+int64_t DRAM::service_request(int64_t line_addr, int64_t issue_cycle)
+{
+    int mem_bank = 0;
+    if (num_mem_banks > 1) {
+        uint64_t addr = (uint64_t)line_addr * cache_line_size;
+        mem_bank = (int)memory_map->get_bank(addr);
+        line_addr = memory_map->get_bank_addr(addr) / cache_line_size;
+    }
+
+    int64_t row_line = line_addr / lines_per_row;
+    int channel = mem_bank * num_channels + (int)(row_line % num_channels);
+    int bank = (int)((row_line / num_channels) % num_banks);
+    int64_t row = row_line / ((int64_t)num_channels * num_banks);
+    int bank_id = channel * num_banks + bank;
+
+    int64_t latency;
+    if (open_row[bank_id] == row) {
+        latency = row_hit_latency;
+        row_hits++;
+    } else if (open_row[bank_id] == -1) {
+        latency = row_miss_latency;
+        row_misses++;
+    } else {
+        latency = row_conflict_latency;
+        row_conflicts++;
+    }
+    open_row[bank_id] = row;
+
+    // Row hits only hold the bank for their burst, opening a row holds it
+    // until the row is ready
+    int64_t start_cycle = bank_busy[bank_id].reserve(issue_cycle, (latency - row_hit_latency) + transfer_cycles);
+    bank_stall_cycles += start_cycle - issue_cycle;
+    int64_t queue_cycles = start_cycle - issue_cycle;
+
+    // The data leaves once the row is open and the channel is free
+    int64_t ready_cycle = start_cycle + latency - transfer_cycles;
+    int64_t data_cycle = channel_busy[channel].reserve(ready_cycle, transfer_cycles);
+    bus_stall_cycles += data_cycle - ready_cycle;
+    queue_cycles += data_cycle - ready_cycle;
+    int64_t done_cycle = data_cycle + transfer_cycles;
+
+    // Busy cycles count the time a request of the device is in service,
+    // never more than a window's cycles per window
+    MemoryBankStats &stats = bank_stats[mem_bank];
+    stats.requests++;
+    stats.stall_cycles += queue_cycles;
+    stats.busy_cycles += mem_busy[mem_bank].add(start_cycle, done_cycle);
+    return done_cycle;
+}
+
+void DRAM::save_state(DRAMState &state)
+{
+    state.open_row = open_row;
+    state.bank_stats = bank_stats;
+    state.row_hits = row_hits;
+    state.row_misses = row_misses;
+    state.row_conflicts = row_conflicts;
+    state.bank_stall_cycles = bank_stall_cycles;
+    state.bus_stall_cycles = bus_stall_cycles;
+}
+
+void DRAM::restore_state(const DRAMState &state)
+{
+    open_row = state.open_row;
+    bank_stats = state.bank_stats;
+    row_hits = state.row_hits;
+    row_misses = state.row_misses;
+    row_conflicts = state.row_conflicts;
+    bank_stall_cycles = state.bank_stall_cycles;
+    bus_stall_cycles = state.bus_stall_cycles;
+}
+
+void DRAM::dump_stats()
+{
+    cout << "dram.row_hits is " << row_hits << endl;
+    cout << "dram.row_misses is " << row_misses << endl;
+    cout << "dram.row_conflicts is " << row_conflicts << endl;
+    cout << "dram.bank_stall_cycles is " << bank_stall_cycles << endl;
+    cout << "dram.bus_stall_cycles is " << bus_stall_cycles << endl;
+    if (num_mem_banks > 1) {
+        for (int i = 0; i < num_mem_banks; i++)
+            cout << "dram.mem_bank" << i << ".requests is " << bank_stats[i].requests << endl;
+    }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,351 @@
+#ifndef _fetch_lines_h
+#define _fetch_lines_h
+
+#include <xtensor/xarray.hpp>
+#include <xtensor/xio.hpp>
+#include <xtensor/xview.hpp>
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+#include "../compute/demand_stream.h"
+#include "address_window.h"
+
+// Sorted, deduplicated addresses of one fetch line, as a view into an arena
+// of 32-bit offsets. Iterating yields the decoded byte addresses. Only valid
+// until the owning FetchLineWindow is modified.
+struct FetchLine {
+    const compact_addr_t *addrs;
+    int64_t num_addrs;
+    AddressWindow addr_window;
+
+    struct iterator {
+        const compact_addr_t *it;
+        const AddressWindow *addr_window;
+
+        int64_t operator*() const { return addr_window->decode(*it); }
+        iterator &operator++() { it++; return *this; }
+        bool operator!=(const iterator &other) const { return it != other.it; }
+    };
+
+    iterator begin() const { return {addrs, &addr_window}; }
+    iterator end() const { return {addrs + num_addrs, &addr_window}; }
+    bool contains(int64_t addr) const {
+        if (addr != -1 && !addr_window.contains(addr))
+            return false;
+        return binary_search(addrs, addrs + num_addrs, addr_window.encode(addr));
+    }
+};
+
+// Walks a DemandStream in row-major order and cuts it into fetch lines of
+// line_width elements. The last line is padded with -1. Padding rows of a
+// fold are stepped over as runs, only the fold's block is copied.
+class FetchLineReader {
+public:
+    FetchLineReader();
+    void set_stream(DemandStream *stream, int64_t line_width);
+    void rewind();
+    bool next_line(vector<int64_t> &line);
+    void release() { fold_buf = PaddedDemand(); }
+
+private:
+    DemandStream *stream;
+    int64_t line_width;
+
+    int64_t num_folds;
+    int64_t fold_id;
+    int64_t elem_id;
+    const PaddedDemand *fold;
+    PaddedDemand fold_buf;
+};
+
+FetchLineReader::FetchLineReader() {
+    stream = NULL;
+    line_width = 1;
+    num_folds = 0;
+    fold_id = 0;
+    elem_id = 0;
+    fold = NULL;
+}
+
+void FetchLineReader::set_stream(DemandStream *stream, int64_t line_width) {
+    this->stream = stream;
+    this->line_width = line_width;
+    rewind();
+}
+
+void FetchLineReader::rewind() {
+    num_folds = stream->get_num_folds();
+    fold_id = -1;
+    elem_id = 0;
+    fold = NULL;
+}
+
+bool FetchLineReader::next_line(vector<int64_t> &line) {
+    line.assign(line_width, -1);
+
+    int64_t col = 0;
+    while (col < line_width) {
+        if (fold == NULL || elem_id == fold->get_num_elems()) {
+            if (fold_id + 1 >= num_folds)
+                break;
+            fold_id++;
+            fold = &stream->get_fold(fold_id, fold_buf);
+            elem_id = 0;
+            continue;
+        }
+
+        // Up to the end of the padding run or of the block the element is in
+        int64_t block_first = fold->get_block_start() * fold->get_num_cols();
+        int64_t block_last = block_first + fold->get_block_elems();
+        int64_t run_end = fold->get_num_elems();
+        if (elem_id < block_first)
+            run_end = block_first;
+        else if (elem_id < block_last)
+            run_end = block_last;
+
+        int64_t count = min(line_width - col, run_end - elem_id);
+        if (elem_id >= block_first && elem_id < block_last) {
+            const int64_t *src = fold->get_block_data() + (elem_id - block_first);
+            for (int64_t k = 0; k < count; k++)
+                line[col + k] = src[k];
+        }
+        col += count;
+        elem_id += count;
+    }
+
+    return col > 0;
+}
+
+// Non-empty fetch lines of a demand stream, addressed by their compacted id.
+// Only the first num_head_lines lines (which cover the initial fill and the
+// wrap-around of the prefetch window) and a sliding window behind the
+// prefetcher are kept; anything else is regenerated from the stream.
+class FetchLineWindow {
+public:
+    FetchLineWindow();
+    void set_stream(DemandStream *stream, int64_t line_width, int64_t num_head_lines);
+    void clear();
+    // Like clear, and also frees the arenas
+    void release();
+
+    int64_t get_num_lines() { return num_lines; }
+    bool has_content(int64_t fetch_line_id);
+    // First fetch line from fetch_line_id on with content, the largest int64_t if none
+    int64_t find_content_line(int64_t fetch_line_id);
+    int64_t get_line_id(int64_t fetch_line_id);
+
+    FetchLine get_line(int64_t line_id);
+    void release_before(int64_t line_id);
+
+private:
+    bool next_content_line();
+    void append_line(vector<compact_addr_t> &arena, vector<int64_t> &offsets);
+
+    FetchLineReader reader;
+    vector<int64_t> line;
+    AddressWindow addr_window;
+
+    vector<bool> line_has_content;
+    int64_t num_lines;
+
+    // Lines are stored back to back in an arena of offsets into addr_window;
+    // line k spans [offsets[k], offsets[k + 1]). Arenas keep their capacity
+    // from one stream to the next until release().
+    vector<compact_addr_t> head_arena;
+    vector<int64_t> head_offsets;
+    int64_t num_head_lines;
+
+    vector<compact_addr_t> window_arena;
+    vector<int64_t> window_offsets;
+    int64_t window_first;
+    int64_t window_start;
+    int64_t next_line_id;
+
+    int64_t cursor_fetch_line_id;
+    int64_t cursor_line_id;
+
+    int64_t search_start;
+    int64_t search_result;
+};
+
+FetchLineWindow::FetchLineWindow() {
+    num_lines = 0;
+    num_head_lines = 0;
+    window_first = 0;
+    window_start = 0;
+    next_line_id = 0;
+    cursor_fetch_line_id = 0;
+    cursor_line_id = 0;
+    search_start = -1;
+    search_result = -1;
+}
+
+void FetchLineWindow::clear() {
+    head_arena.clear();
+    head_offsets.assign(1, 0);
+    window_arena.clear();
+    window_offsets.assign(1, 0);
+    line_has_content.clear();
+
+    num_lines = 0;
+    num_head_lines = 0;
+    window_first = 0;
+    window_start = 0;
+    next_line_id = 0;
+    cursor_fetch_line_id = 0;
+    cursor_line_id = 0;
+    search_start = -1;
+    search_result = -1;
+}
+
+void FetchLineWindow::release() {
+    vector<compact_addr_t>().swap(head_arena);
+    vector<int64_t>().swap(head_offsets);
+    vector<compact_addr_t>().swap(window_arena);
+    vector<int64_t>().swap(window_offsets);
+    vector<bool>().swap(line_has_content);
+    vector<int64_t>().swap(line);
+    reader.release();
+    clear();
+}
+
+void FetchLineWindow::append_line(vector<compact_addr_t> &arena, vector<int64_t> &offsets) {
+    sort(line.begin(), line.end());
+    auto line_end = unique(line.begin(), line.end());
+    for (auto it = line.begin(); it != line_end; it++)
+        arena.push_back(addr_window.encode(*it));
+    offsets.push_back(arena.size());
+}
+
+void FetchLineWindow::set_stream(DemandStream *stream, int64_t line_width, int64_t num_head_lines) {
+    clear();
+    reader.set_stream(stream, line_width);
+    addr_window = stream->get_addr_window();
+
+    while (reader.next_line(line)) {
+        bool content = false;
+        for (int64_t elem : line) {
+            if (elem != -1) {
+                content = true;
+                break;
+            }
+        }
+
+        line_has_content.push_back(content);
+        if (content) {
+            if (num_lines < num_head_lines)
+                append_line(head_arena, head_offsets);
+            num_lines++;
+        }
+    }
+
+    reader.rewind();
+    this->num_head_lines = head_offsets.size() - 1;
+    window_start = this->num_head_lines;
+}
+
+bool FetchLineWindow::has_content(int64_t fetch_line_id) {
+    if (fetch_line_id >= (int64_t)line_has_content.size())
+        return false;
+    return line_has_content[fetch_line_id];
+}
+
+int64_t FetchLineWindow::find_content_line(int64_t fetch_line_id) {
+    // Lines [search_start, search_result) have no content, so a search that
+    // starts in there ends where the last one did
+    if (fetch_line_id >= search_start && fetch_line_id <= search_result)
+        return search_result;
+
+    search_start = fetch_line_id;
+    search_result = numeric_limits<int64_t>::max();
+    for (int64_t id = fetch_line_id; id < (int64_t)line_has_content.size(); id++) {
+        if (line_has_content[id]) {
+            search_result = id;
+            break;
+        }
+    }
+    return search_result;
+}
+
+int64_t FetchLineWindow::get_line_id(int64_t fetch_line_id) {
+    if (fetch_line_id < cursor_fetch_line_id) {
+        cursor_fetch_line_id = 0;
+        cursor_line_id = 0;
+    }
+
+    int64_t end_id = min(fetch_line_id, (int64_t)line_has_content.size());
+    for (; cursor_fetch_line_id < end_id; cursor_fetch_line_id++) {
+        if (line_has_content[cursor_fetch_line_id])
+            cursor_line_id++;
+    }
+
+    return cursor_line_id;
+}
+
+bool FetchLineWindow::next_content_line() {
+    while (reader.next_line(line)) {
+        for (int64_t elem : line) {
+            if (elem != -1)
+                return true;
+        }
+    }
+    return false;
+}
+
+FetchLine FetchLineWindow::get_line(int64_t line_id) {
+    if (line_id < num_head_lines)
+        return {head_arena.data() + head_offsets[line_id], head_offsets[line_id + 1] - head_offsets[line_id], addr_window};
+
+    if (line_id < window_start) {
+        // Fell behind the window, replay the stream from the start
+        window_arena.clear();
+        window_offsets.assign(1, 0);
+        window_first = 0;
+        reader.rewind();
+        next_line_id = 0;
+        window_start = line_id;
+    }
+
+    while (next_line_id <= line_id) {
+        next_content_line();
+        if (next_line_id >= window_start)
+            append_line(window_arena, window_offsets);
+        next_line_id++;
+    }
+
+    int64_t k = window_first + line_id - window_start;
+    return {window_arena.data() + window_offsets[k], window_offsets[k + 1] - window_offsets[k], addr_window};
+}
+
+void FetchLineWindow::release_before(int64_t line_id) {
+    int64_t window_lines = window_offsets.size() - 1 - window_first;
+    int64_t num_release = min(line_id - window_start, window_lines);
+    if (num_release > 0) {
+        window_first += num_release;
+        window_start += num_release;
+    }
+
+    if (window_first == (int64_t)window_offsets.size() - 1) {
+        // Everything was released, restart the arena from the front
+        window_arena.clear();
+        window_offsets.assign(1, 0);
+        window_first = 0;
+        if (window_start < line_id)
+            window_start = line_id;
+    } else if (window_offsets[window_first] * 2 > (int64_t)window_arena.size()) {
+        // Compact once the released prefix dominates the arena
+        int64_t shift = window_offsets[window_first];
+        window_arena.erase(window_arena.begin(), window_arena.begin() + shift);
+        window_offsets.erase(window_offsets.begin(), window_offsets.begin() + window_first);
+        for (auto &offset : window_offsets)
+            offset -= shift;
+        window_first = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef _fold_extrapolator_h
+#define _fold_extrapolator_h
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "llc.h"
+
+using namespace std;
+
+// Steady-state detection over the folds of one layer. The accesses of a
+// layer repeat, translated, every fold period (the row folds of one column
+// fold), so once the LLC has warmed up the stall cycles and LLC accesses of
+// consecutive periods repeat too. After window consecutive periods (not
+// counting the first, cold one) agree within tolerance, the remaining periods
+// are taken to cost the window's mean.
+//
+// The last periods of a layer stall less than the window, as the buffers run
+// out of lines to prefetch, and nothing the window saw predicts by how much.
+// The caller touches the LLC lines of the skipped folds without timing them,
+// which leaves the LLC as the skipped folds would for the later layers, and
+// passes the misses of those touches in: scaled by the window's stall cycles
+// per miss, they give a second estimate that follows the end of the layer.
+// The reported spread covers the window's half range, at least tolerance,
+// over the remaining periods plus the gap between the two estimates. It is
+// still an estimate, not a bound. Layers that start from an LLC warmed this
+// way are counted, since the LRU order and dirty lines of the warmed contents
+// only approximate those of a simulated run.
+class FoldExtrapolator
+{
+public:
+    FoldExtrapolator();
+    void set_params(int window, float tolerance);
+    bool is_enabled() { return window > 0; }
+
+    // llc_warmed: earlier layers left the LLC as warmed after an extrapolation
+    void start(int64_t num_folds, int64_t fold_period, bool llc_warmed);
+    // Stats of the next finished fold; true once the remaining folds can be extrapolated
+    bool add_fold(int64_t stall_cycles, LLCStats llc_stats);
+    // Stall cycles of the remaining folds, whole periods; their LLC stats are
+    // added to llc. skipped_misses are the misses of the untimed touches of
+    // those periods' lines, -1 if unknown.
+    int64_t extrapolate(int64_t remaining_folds, int64_t skipped_misses, LLC *llc);
+
+    int64_t get_fold_period() { return fold_period; }
+    int64_t get_extrapolated_folds() { return extrapolated_folds; }
+    int64_t get_total_folds() { return total_folds; }
+    int64_t get_stall_spread() { return stall_spread; }
+    int64_t get_warmed_layers() { return warmed_layers; }
+
+private:
+    bool is_stable(const vector<int64_t> &values);
+    double get_mean(const vector<int64_t> &values);
+    int64_t get_half_range(const vector<int64_t> &values);
+
+    int window;
+    float tolerance;
+
+    int64_t num_folds;
+    int64_t fold_period;
+    int64_t folds_seen;
+
+    // Sums of the period in progress
+    int64_t period_stalls;
+    LLCStats period_llc_stats;
+
+    // Last window periods; LLC stats also as hits and misses
+    vector<int64_t> window_stalls;
+    vector<int64_t> window_hits;
+    vector<int64_t> window_misses;
+    vector<LLCStats> window_llc_stats;
+
+    // Over all layers run so far
+    int64_t extrapolated_folds;
+    int64_t total_folds;
+    int64_t stall_spread;
+    int64_t warmed_layers;
+};
+
+FoldExtrapolator::FoldExtrapolator()
+{
+    window = 0;
+    tolerance = 0.02;
+    num_folds = 0;
+    fold_period = 1;
+    folds_seen = 0;
+    period_stalls = 0;
+    period_llc_stats = {0, 0, 0, 0, 0, 0};
+    extrapolated_folds = 0;
+    total_folds = 0;
+    stall_spread = 0;
+    warmed_layers = 0;
+}
+
+void FoldExtrapolator::set_params(int window, float tolerance)
+{
+    this->window = window;
+    this->tolerance = tolerance;
+}
+
+void FoldExtrapolator::start(int64_t num_folds, int64_t fold_period, bool llc_warmed)
+{
+    this->num_folds = num_folds;
+    this->fold_period = max(fold_period, (int64_t)1);
+    folds_seen = 0;
+    period_stalls = 0;
+    period_llc_stats = {0, 0, 0, 0, 0, 0};
+    total_folds += num_folds;
+    window_stalls.clear();
+    window_hits.clear();
+    window_misses.clear();
+    window_llc_stats.clear();
+    if (llc_warmed) {
+        warmed_layers++;
+        printf("Layer starts from LLC contents warmed over extrapolated folds\n");
+    }
+}
+
+bool FoldExtrapolator::add_fold(int64_t stall_cycles, LLCStats llc_stats)
+{
+    period_stalls += stall_cycles;
+    period_llc_stats.read_hit += llc_stats.read_hit;
+    period_llc_stats.read_miss_all += llc_stats.read_miss_all;
+    period_llc_stats.read_miss_conflict += llc_stats.read_miss_conflict;
+    period_llc_stats.write_hit += llc_stats.write_hit;
+    period_llc_stats.write_miss_all += llc_stats.write_miss_all;
+    period_llc_stats.write_miss_conflict += llc_stats.write_miss_conflict;
+
+    folds_seen++;
+    if (folds_seen % fold_period != 0)
+        return false;
+    int64_t period_id = folds_seen / fold_period - 1;
+    int64_t stalls = period_stalls;
+    LLCStats stats = period_llc_stats;
+    period_stalls = 0;
+    period_llc_stats = {0, 0, 0, 0, 0, 0};
+
+    // The first period warms up the LLC
+    if (period_id == 0)
+        return false;
+
+    window_stalls.push_back(stalls);
+    window_hits.push_back(stats.read_hit + stats.write_hit);
+    window_misses.push_back(stats.read_miss_all + stats.write_miss_all);
+    window_llc_stats.push_back(stats);
+    if ((int)window_stalls.size() > window) {
+        window_stalls.erase(window_stalls.begin());
+        window_hits.erase(window_hits.begin());
+        window_misses.erase(window_misses.begin());
+        window_llc_stats.erase(window_llc_stats.begin());
+    }
+
+    if ((int)window_stalls.size() < window || folds_seen >= num_folds)
+        return false;
+    return is_stable(window_stalls) && is_stable(window_hits) && is_stable(window_misses);
+}
+
+int64_t FoldExtrapolator::extrapolate(int64_t remaining_folds, int64_t skipped_misses, LLC *llc)
+{
+    int64_t remaining_periods = remaining_folds / fold_period;
+    double n = (double)window_llc_stats.size();
+    double sums[6] = {0, 0, 0, 0, 0, 0};
+    for (auto &stats : window_llc_stats) {
+        sums[0] += stats.read_hit;
+        sums[1] += stats.read_miss_all;
+        sums[2] += stats.read_miss_conflict;
+        sums[3] += stats.write_hit;
+        sums[4] += stats.write_miss_all;
+        sums[5] += stats.write_miss_conflict;
+    }
+    LLCStats delta;
+    delta.read_hit = llround(sums[0] / n * remaining_periods);
+    delta.read_miss_all = llround(sums[1] / n * remaining_periods);
+    delta.read_miss_conflict = llround(sums[2] / n * remaining_periods);
+    delta.write_hit = llround(sums[3] / n * remaining_periods);
+    delta.write_miss_all = llround(sums[4] / n * remaining_periods);
+    delta.write_miss_conflict = llround(sums[5] / n * remaining_periods);
+    llc->add_llc_stats(delta);
+
+    double mean_stalls = get_mean(window_stalls);
+    double mean_misses = get_mean(window_misses);
+    int64_t stall_cycles = llround(mean_stalls * remaining_periods);
+    int64_t misses = delta.read_miss_all + delta.write_miss_all;
+    int64_t spread = max(get_half_range(window_stalls), (int64_t)llround(tolerance * mean_stalls)) * remaining_periods;
+    int64_t miss_spread = max(get_half_range(window_misses), (int64_t)llround(tolerance * mean_misses)) * remaining_periods;
+    if (skipped_misses >= 0) {
+        if (mean_misses > 0)
+            spread += llabs(llround(mean_stalls / mean_misses * skipped_misses) - stall_cycles);
+        miss_spread += llabs(skipped_misses - misses);
+    }
+
+    extrapolated_folds += remaining_folds;
+    stall_spread += spread;
+
+    printf("Extrapolated %ld of %ld folds: %ld stall cycles (spread estimate %ld), %ld LLC misses (spread estimate %ld)\n",
+        remaining_folds, num_folds, stall_cycles, spread, misses, miss_spread);
+    return stall_cycles;
+}
+
+// Largest deviation from the mean within tolerance of the mean, or 1 for
+// counts close to 0
+bool FoldExtrapolator::is_stable(const vector<int64_t> &values)
+{
+    double mean = get_mean(values);
+    double limit = max(tolerance * mean, 1.0);
+    for (int64_t value : values) {
+        if (fabs(value - mean) > limit)
+            return false;
+    }
+    return true;
+}
+
+double FoldExtrapolator::get_mean(const vector<int64_t> &values)
+{
+    double sum = 0;
+    for (int64_t value : values)
+        sum += value;
+    return values.empty() ? 0.0 : sum / values.size();
+}
+
+int64_t FoldExtrapolator::get_half_range(const vector<int64_t> &values)
+{
+    if (values.empty())
+        return 0;
+    auto range = minmax_element(values.begin(), values.end());
+    return (*range.second - *range.first + 1) / 2;
+}
+
+#endif
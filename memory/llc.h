@@ -6,11 +6,14 @@
 #include <xtensor/xview.hpp>
 
 #include <vector>
-#include <set>
 #include <string>
+#include <limits>
 #include <unordered_map>
 
 #include "dram.h"
+#include "fetch_lines.h"
+#include "llc_access_log.h"
+#include "tag_match.h"
 
 using namespace std;
 
@@ -24,63 +27,75 @@ typedef struct
     int64_t write_miss_conflict;
 } LLCStats;
 
+// Everything a later access can observe: the ways of every set, the
+// counters, and the DRAM behind the cache
+typedef struct
+{
+    vector<int32_t> tags;
+    vector<uint8_t> rrip_bits;
+    vector<uint8_t> dirty_bits;
+    LLCStats stats;
+    int64_t last_addr_no_offset;
+    int64_t mshr_merges;
+    int64_t mshr_stall_cycles;
+    DRAMState dram;
+} LLCState;
+
+// A miss still in flight: the cycle it took its MSHR and the cycle its line
+// returns
+typedef struct
+{
+    int64_t issue_cycle;
+    int64_t return_cycle;
+} PendingMiss;
+
 enum class Replacement
 {
     LRU,
     RRIP
 };
 
-class CacheContent
+// Tags, RRIP bits and dirty bits of every way of every set, stored as flat
+// arrays indexed by set_id * ways_per_set + way. The ways of a set are split
+// into contiguous partitions, sized by the [llc] Partition list.
+class CacheTagStore
 {
 public:
-    CacheContent(int64_t tag_bits);
-    CacheContent(int64_t tag_bits, bool dirty_bit);
-    int64_t tag_bits;
-    int32_t rrip_bits = 3;
-    bool dirty_bit;
-};
-
-CacheContent::CacheContent(int64_t tag_bits)
-{
-    this->tag_bits = tag_bits;
-    this->dirty_bit = false;
-}
-
-CacheContent::CacheContent(int64_t tag_bits, bool dirty_bit)
-{
-    this->tag_bits = tag_bits;
-    this->dirty_bit = dirty_bit;
-}
-
-class CacheSet
-{
-public:
-    CacheSet(LLCStats *stats, Replacement replacement, int64_t set_associativity, string partition);
-    bool service_read(int64_t tag_bits, int partition);
-    bool service_write(int64_t tag_bits, int partition);
+    CacheTagStore(LLCStats *stats, Replacement replacement, int number_of_sets, string partition);
+    bool service_read(int set_id, int64_t tag_bits, int partition);
+    bool service_write(int set_id, int64_t tag_bits, int partition);
+    void save_state(LLCState &state);
+    void restore_state(const LLCState &state);
 
 private:
     LLCStats *stats;
     Replacement replacement;
-    int64_t set_associativity;
 
+    int number_of_sets;
+    int ways_per_set;
     int number_of_partitions;
-    vector<vector<CacheContent *>> contents;
+    vector<int> partition_offsets;
     vector<int> capacities;
 
-    int is_read_hit(int64_t tag_bits, int partition);
-    int is_write_hit(int64_t tag_bits, int partition);
-    void update_queue_lru(int index, int partition);
-    void replace_queue_lru(int64_t tag_bits, int partition);
-    void update_queue_rrip(int index, int partition);
-    void replace_queue_rrip(int64_t tag_bits, int partition);
+    vector<int32_t> tags;
+    vector<uint8_t> rrip_bits;
+    vector<uint8_t> dirty_bits;
+    bool use_avx2;
+
+    int64_t get_base(int set_id, int partition) { return (int64_t)set_id * ways_per_set + partition_offsets[partition]; }
+    int find_way(int64_t base, int64_t tag_bits, int partition);
+    void update_queue_lru(int64_t base, int index, bool dirty);
+    void replace_queue_lru(int64_t base, int64_t tag_bits, int partition, bool dirty);
+    void update_queue_rrip(int64_t base, int index, bool dirty);
+    void replace_queue_rrip(int64_t base, int64_t tag_bits, int partition, bool dirty);
+    bool service(int set_id, int64_t tag_bits, int partition, bool dirty);
 };
 
-CacheSet::CacheSet(LLCStats *stats, Replacement replacement, int64_t set_associativity, string partition)
+CacheTagStore::CacheTagStore(LLCStats *stats, Replacement replacement, int number_of_sets, string partition)
 {
     this->stats = stats;
     this->replacement = replacement;
-    this->set_associativity = set_associativity;
+    this->number_of_sets = number_of_sets;
 
     vector<string> eles_per_partititon;
     stringstream ss(partition);
@@ -93,174 +108,176 @@ CacheSet::CacheSet(LLCStats *stats, Replacement replacement, int64_t set_associa
     }
 
     number_of_partitions = eles_per_partititon.size();
+    ways_per_set = 0;
     for (size_t i = 0; i < number_of_partitions; i++)
     {
-        contents.push_back(vector<CacheContent *>());
+        partition_offsets.push_back(ways_per_set);
         capacities.push_back(stoi(eles_per_partititon[i]));
-
-        for (int j = 0; j < stoi(eles_per_partititon[i]); j++)
-        {
-            CacheContent *content = new CacheContent(-1);
-            contents[i].push_back(content);
-        }
+        ways_per_set += capacities[i];
     }
+
+    int64_t num_ways = (int64_t)number_of_sets * ways_per_set;
+    tags.assign(num_ways, -1);
+    rrip_bits.assign(num_ways, 3);
+    dirty_bits.assign(num_ways, 0);
+    use_avx2 = cpu_has_avx2();
+}
+
+void CacheTagStore::save_state(LLCState &state)
+{
+    state.tags = tags;
+    state.rrip_bits = rrip_bits;
+    state.dirty_bits = dirty_bits;
+}
+
+void CacheTagStore::restore_state(const LLCState &state)
+{
+    tags = state.tags;
+    rrip_bits = state.rrip_bits;
+    dirty_bits = state.dirty_bits;
+}
+
+int CacheTagStore::find_way(int64_t base, int64_t tag_bits, int partition)
+{
+    // Tags are stored as 32 bits, the LLC never passes wider ones
+    return find_tag(&tags[base], capacities[partition], (int32_t)tag_bits, use_avx2);
 }
 
-void CacheSet::update_queue_lru(int index, int partition)
+void CacheTagStore::update_queue_lru(int64_t base, int index, bool dirty)
 {
-    CacheContent *content = contents[partition][index];
+    int32_t tag_bits = tags[base + index];
+    uint8_t dirty_bit = dirty_bits[base + index];
     for (int i = index; i > 0; i--)
     {
-        contents[partition][i] = contents[partition][i - 1];
+        tags[base + i] = tags[base + i - 1];
+        rrip_bits[base + i] = rrip_bits[base + i - 1];
+        dirty_bits[base + i] = dirty_bits[base + i - 1];
     }
-    contents[partition][0] = new CacheContent(content->tag_bits);
+    tags[base] = tag_bits;
+    rrip_bits[base] = 3;
+    dirty_bits[base] = dirty_bit | dirty;
 }
 
-void CacheSet::replace_queue_lru(int64_t tag_bits, int partition)
+void CacheTagStore::replace_queue_lru(int64_t base, int64_t tag_bits, int partition, bool dirty)
 {
-    for (int i = capacities[partition] - 1; i > 0; i--)
-    {
-        contents[partition][i] = contents[partition][i - 1];
-    }
-    contents[partition][0] = new CacheContent(tag_bits);
-}
-
-// void CacheSet::replace_queue_lru(int64_t tag_bits, int partition)
-// {
-//     if (contents[partition].size() < capacities[partition])
-//     {
-//         CacheContent *content = new CacheContent(tag_bits);
-//         contents[partition].push_back(content);
-//     }
-//     else
-//     {
-//         for (int i = capacities[partition] - 1; i > 0; i--)
-//         {
-//             contents[partition][i] = contents[partition][i - 1];
-//         }
-//         contents[partition][0] = new CacheContent(tag_bits);
-//     }
-// }
-
-void CacheSet::update_queue_rrip(int index, int partition)
-{
-    return;
-}
-
-void CacheSet::replace_queue_rrip(int64_t tag_bits, int partition)
-{
-    while (1) {
-        for (int i = 0; i < contents[partition].size(); i++) {
-            if (contents[partition][i]->rrip_bits == 3) {
-                contents[partition][i]->tag_bits = tag_bits;
-                contents[partition][i]->rrip_bits = 2;
-                return;
-            }
-        }
-        for (int i = 0; i < contents[partition].size(); i++) {
-            contents[partition][i]->rrip_bits++;
-        }
-    }
+    // Shift the last way out to the front, then overwrite it with the new line
+    update_queue_lru(base, capacities[partition] - 1, dirty);
+    tags[base] = tag_bits;
+    dirty_bits[base] = dirty;
 }
 
-int CacheSet::is_read_hit(int64_t tag_bits, int partition)
+void CacheTagStore::update_queue_rrip(int64_t base, int index, bool dirty)
 {
-    for (int i = 0; i < contents[partition].size(); i++)
-    {
-        if (contents[partition][i]->tag_bits == tag_bits) {
-            contents[partition][i]->rrip_bits = 0;
-            return i;
-        }
-    }
-    if (contents[partition].size() == capacities[partition])
-        stats->read_miss_conflict++;
-    return -1;
+    rrip_bits[base + index] = 0;
+    dirty_bits[base + index] |= dirty;
 }
 
-int CacheSet::is_write_hit(int64_t tag_bits, int partition)
+void CacheTagStore::replace_queue_rrip(int64_t base, int64_t tag_bits, int partition, bool dirty)
 {
-    for (int i = 0; i < contents[partition].size(); i++)
-    {
-        if (contents[partition][i]->tag_bits == tag_bits) {
-            contents[partition][i]->rrip_bits = 0;
-            return i;
-        }
-            
+    // Aging every way until one reaches 3 ages them all by 3 - max, and the
+    // victim is the first way holding the max
+    uint8_t max_rrip;
+    int index = find_max_rrip(&rrip_bits[base], capacities[partition], max_rrip);
+    uint8_t age = 3 - max_rrip;
+    if (age != 0) {
+        for (int i = 0; i < capacities[partition]; i++)
+            rrip_bits[base + i] += age;
     }
-    if (contents[partition].size() == capacities[partition])
-        stats->write_miss_conflict++;
-    return -1;
+
+    tags[base + index] = tag_bits;
+    rrip_bits[base + index] = 2;
+    dirty_bits[base + index] = dirty;
 }
 
-bool CacheSet::service_read(int64_t tag_bits, int partition)
+bool CacheTagStore::service(int set_id, int64_t tag_bits, int partition, bool dirty)
 {
-    // return true;
-    int index = is_read_hit(tag_bits, partition);
+    int64_t base = get_base(set_id, partition);
+    int index = find_way(base, tag_bits, partition);
     if (index == -1)
     {
         if (replacement == Replacement::LRU)
-            replace_queue_lru(tag_bits, partition);
+            replace_queue_lru(base, tag_bits, partition, dirty);
         else if (replacement == Replacement::RRIP)
-            replace_queue_rrip(tag_bits, partition);
+            replace_queue_rrip(base, tag_bits, partition, dirty);
         return false;
     }
     else
     {
         if (replacement == Replacement::LRU)
-            update_queue_lru(index, partition);
+            update_queue_lru(base, index, dirty);
         else if (replacement == Replacement::RRIP)
-            update_queue_rrip(index, partition);
+            update_queue_rrip(base, index, dirty);
         return true;
     }
 }
 
-bool CacheSet::service_write(int64_t tag_bits, int partition)
+bool CacheTagStore::service_read(int set_id, int64_t tag_bits, int partition)
 {
-    // return true;
-    int index = is_write_hit(tag_bits, partition);
-    if (index == -1)
-    {
-        if (replacement == Replacement::LRU)
-            replace_queue_lru(tag_bits, partition);
-        else if (replacement == Replacement::RRIP)
-            replace_queue_rrip(tag_bits, partition);
-        return false;
-    }
-    else
-    {
-        if (replacement == Replacement::LRU)
-            update_queue_lru(index, partition);
-        else if (replacement == Replacement::RRIP)
-            update_queue_rrip(index, partition);
-        return true;
-    }
+    bool is_hit = service(set_id, tag_bits, partition, false);
+    // Every way of a partition is always allocated, so each miss evicts
+    if (!is_hit)
+        stats->read_miss_conflict++;
+    return is_hit;
+}
+
+bool CacheTagStore::service_write(int set_id, int64_t tag_bits, int partition)
+{
+    bool is_hit = service(set_id, tag_bits, partition, true);
+    if (!is_hit)
+        stats->write_miss_conflict++;
+    return is_hit;
 }
 
 class LLC
 {
 public:
     LLC();
+    ~LLC();
+    LLC(const LLC &) = delete;
+    LLC& operator=(const LLC &) = delete;
     void set_params(DRAM *dram, int64_t total_size_bytes, int64_t cache_line_size, int64_t hit_latency, int64_t set_associativity, string partition, bool is_always_hit, bool is_bypassing);
     int64_t get_latency() { return hit_latency; }
-    int64_t service_read(set<int64_t> *incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset);
-    int64_t service_write(set<int64_t> *incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset);
+    int64_t service_read(const FetchLine &incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset);
+    int64_t service_write(const FetchLine &incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset);
     int64_t service_read(xt::xarray<int64_t> incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset);
     int64_t service_write(xt::xarray<int64_t> incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset);
+    void replay(LLCAccessLog &access_log, size_t event_id, int64_t start_cycle);
+    // Brings the lines of addrs into the cache as accesses would, without
+    // timing them or counting them in the stats; -1 entries are skipped.
+    // Returns the accesses that missed.
+    int64_t warm(const int64_t *addrs, int64_t count, bool is_write, int partition);
+    // Whether some contents came from warm rather than timed accesses
+    bool is_warmed() { return warmed; }
+    // The layer's timeline starts over, see start_requests
+    void start_layer();
+    // The later of cycle and the return of every miss issued since the last
+    // wait. Only calls with MSHRs leave misses outstanding.
+    int64_t wait_for_fills(int64_t cycle);
+    int get_offset_bits() { return offset_bits; }
     void dump_stats();
     LLCStats get_llc_stats() { return stats; }
+    DRAM *get_dram() { return dram; }
+    // Checkpoints of the cache contents, for runs that fork from a common prefix
+    void save_state(LLCState &state);
+    void restore_state(const LLCState &state);
+    // Accounts accesses simulated elsewhere, e.g. a layer result taken from a cache
+    void add_llc_stats(LLCStats delta);
     void inc_read_miss_conflict() { stats.read_miss_conflict++; }
     void inc_write_miss_conflict() { stats.write_miss_conflict++; }
+    // 0 keeps the blocking model where every miss adds the full miss latency
+    void set_num_mshr(int num_mshr);
+    int get_num_mshr() { return num_mshr; }
 
 private:
     DRAM *dram;
-    vector<CacheSet *> cacheSets;
+    CacheTagStore *tagStore;
     int64_t total_size_bytes;
     int64_t cache_line_size;
     int64_t hit_latency;
-    int64_t miss_latency;
     int number_of_partitions;
     bool is_always_hit;
     bool is_bypassing;
+    bool warmed;
 
     LLCStats stats;
 
@@ -273,10 +290,36 @@ private:
 
     int get_set_index(int64_t addr);
     int64_t get_tag(int64_t addr);
+    int64_t service_lines(const compact_addr_t *line_addrs_begin, const compact_addr_t *line_addrs_end, const AddressWindow &line_window, int64_t incoming_cycle, bool is_write, int partition, bool reset);
+
+    // Timing of the requests of one call. Requests issue back to back from
+    // the incoming cycle, one every hit_latency cycles, and a miss returns
+    // when the DRAM delivers its line. Cycles are those of the layer's
+    // timeline, which the DRAM keeps its banks and channels busy over.
+    // Without MSHRs a miss blocks issue until its line returns. With MSHRs a
+    // call ends once its last request has issued: its misses stay in flight,
+    // holding an MSHR until their line returns, and the caller waits for
+    // them with wait_for_fills. A request to a line still in flight, from
+    // this call or an earlier one, merges into its MSHR, and issue stalls
+    // while all MSHRs of its window are taken. PEs issue over the same
+    // timeline one after the other, so MSHR occupancy is kept per window of
+    // cycles, like the DRAM banks.
+    void start_requests(int64_t incoming_cycle);
+    void issue_request(int64_t line_addr, bool is_hit);
+    int64_t finish_requests();
 
     int num_mshr;
 
-    unordered_map<int64_t, int64_t> mshr;
+    // Line address -> its miss in flight, until the incoming cycle of a
+    // call passes its return cycle
+    unordered_map<int64_t, PendingMiss> mshr;
+    BusyWindows mshr_busy;
+    int64_t issue_cycle;
+    // Latest return cycle of the misses not waited for yet
+    int64_t fill_cycle;
+
+    int64_t mshr_merges;
+    int64_t mshr_stall_cycles;
 
     int64_t last_addr_no_offset = -1;
 };
@@ -289,7 +332,13 @@ LLC::LLC()
     set_associativity = 4;
     number_of_partitions = 1;
     is_always_hit = false;
-    num_mshr = 8;
+    warmed = false;
+    num_mshr = 0;
+    issue_cycle = 0;
+    fill_cycle = numeric_limits<int64_t>::min();
+    mshr_merges = 0;
+    mshr_stall_cycles = 0;
+    tagStore = NULL;
 
     last_addr_no_offset = -1;
 
@@ -310,7 +359,6 @@ void LLC::set_params(DRAM *dram, int64_t total_size_bytes, int64_t cache_line_si
     this->hit_latency = hit_latency;
     this->set_associativity = set_associativity;
     this->is_always_hit = is_always_hit;
-    this->miss_latency = dram->get_latency();
     this->is_bypassing = is_bypassing;
 
     // this->hit_latency = 2;
@@ -324,17 +372,18 @@ void LLC::set_params(DRAM *dram, int64_t total_size_bytes, int64_t cache_line_si
 
     cout << "number_of_sets is " << number_of_sets << endl;
 
-    for (int i = 0; i < number_of_sets; i++)
-    {
-        CacheSet *cacheSet = new CacheSet(&stats, replacement, set_associativity, partition);
-        cacheSets.push_back(cacheSet);
-    }
+    delete tagStore;
+    tagStore = new CacheTagStore(&stats, replacement, number_of_sets, partition);
+}
+
+LLC::~LLC()
+{
+    delete tagStore;
 }
 
-int64_t LLC::service_read(set<int64_t> *incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset)
+int64_t LLC::service_read(const FetchLine &incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset)
 {
     int64_t out_cycle = incoming_cycles_arr;
-    int64_t offset = 0;
 
     int64_t addr_no_offset = -1;
     if (reset)
@@ -343,9 +392,10 @@ int64_t LLC::service_read(set<int64_t> *incoming_requests, int64_t incoming_cycl
     if (is_bypassing && reset) return (out_cycle + hit_latency);
     if (is_bypassing && !reset) return (out_cycle);
 
-    for (auto i = incoming_requests->begin(); i != incoming_requests->end(); ++i)
+    start_requests(out_cycle);
+
+    for (int64_t addr : incoming_requests)
     {
-        int64_t addr = (*i);
         if (addr == -1)
             continue;
 
@@ -359,29 +409,22 @@ int64_t LLC::service_read(set<int64_t> *incoming_requests, int64_t incoming_cycl
         } else {
             int cache_set_id = get_set_index(addr);
             int64_t tag_bits = get_tag(addr);
-            is_hit = cacheSets[cache_set_id]->service_read(tag_bits, partition);
+            is_hit = tagStore->service_read(cache_set_id, tag_bits, partition);
         }
 
         if (is_hit)
-        {
-            offset += hit_latency;
             stats.read_hit++;
-        }
         else
-        {
-            offset += miss_latency;
             stats.read_miss_all++;
-        }
+        issue_request(addr_no_offset, is_hit);
         last_addr_no_offset = addr_no_offset;
     }
-    out_cycle += offset;
-    return out_cycle;
+    return finish_requests();
 }
 
-int64_t LLC::service_write(set<int64_t> *incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset)
+int64_t LLC::service_write(const FetchLine &incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset)
 {
     int64_t out_cycle = incoming_cycles_arr;
-    int64_t offset = 0;
 
     int64_t addr_no_offset = -1;
     if (reset)
@@ -390,9 +433,10 @@ int64_t LLC::service_write(set<int64_t> *incoming_requests, int64_t incoming_cyc
     if (is_bypassing && reset) return (out_cycle + hit_latency);
     if (is_bypassing && !reset) return (out_cycle);
 
-    for (auto i = incoming_requests->begin(); i != incoming_requests->end(); ++i)
+    start_requests(out_cycle);
+
+    for (int64_t addr : incoming_requests)
     {
-        int64_t addr = (*i);
         if (addr == -1)
             continue;
 
@@ -406,29 +450,22 @@ int64_t LLC::service_write(set<int64_t> *incoming_requests, int64_t incoming_cyc
         } else {
             int cache_set_id = get_set_index(addr);
             int64_t tag_bits = get_tag(addr);
-            is_hit = cacheSets[cache_set_id]->service_write(tag_bits, partition);
+            is_hit = tagStore->service_write(cache_set_id, tag_bits, partition);
         }
 
         if (is_hit)
-        {
-            offset += hit_latency;
             stats.write_hit++;
-        }
         else
-        {
-            offset += miss_latency;
             stats.write_miss_all++;
-        }
+        issue_request(addr_no_offset, is_hit);
         last_addr_no_offset = addr_no_offset;
     }
-    out_cycle += offset;
-    return out_cycle;
+    return finish_requests();
 }
 
 int64_t LLC::service_read(xt::xarray<int64_t> incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset)
 {
     int64_t out_cycle = incoming_cycles_arr;
-    int64_t offset = 0;
     
     int64_t addr_no_offset = -1;
     if (reset)
@@ -437,6 +474,8 @@ int64_t LLC::service_read(xt::xarray<int64_t> incoming_requests, int64_t incomin
     if (is_bypassing && reset) return (out_cycle + hit_latency);
     if (is_bypassing && !reset) return (out_cycle);
 
+    start_requests(out_cycle);
+
     for (int64_t addr : incoming_requests)
     {
         if (addr == -1)
@@ -452,29 +491,22 @@ int64_t LLC::service_read(xt::xarray<int64_t> incoming_requests, int64_t incomin
         } else {
             int cache_set_id = get_set_index(addr);
             int64_t tag_bits = get_tag(addr);
-            is_hit = cacheSets[cache_set_id]->service_read(tag_bits, partition);
+            is_hit = tagStore->service_read(cache_set_id, tag_bits, partition);
         }
 
         if (is_hit)
-        {
-            offset += hit_latency;
             stats.read_hit++;
-        }
         else
-        {
-            offset += miss_latency;
             stats.read_miss_all++;
-        }
+        issue_request(addr_no_offset, is_hit);
         last_addr_no_offset = addr_no_offset;
     }
-    out_cycle += offset;
-    return out_cycle;
+    return finish_requests();
 }
 
 int64_t LLC::service_write(xt::xarray<int64_t> incoming_requests, int64_t incoming_cycles_arr, int partition, bool reset)
 {
     int64_t out_cycle = incoming_cycles_arr;
-    int64_t offset = 0;
 
     int64_t addr_no_offset = -1;
     if (reset)
@@ -483,6 +515,8 @@ int64_t LLC::service_write(xt::xarray<int64_t> incoming_requests, int64_t incomi
     if (is_bypassing && reset) return (out_cycle + hit_latency);
     if (is_bypassing && !reset) return (out_cycle);
 
+    start_requests(out_cycle);
+
     for (int64_t addr : incoming_requests)
     {
         if (addr == -1)
@@ -498,23 +532,221 @@ int64_t LLC::service_write(xt::xarray<int64_t> incoming_requests, int64_t incomi
         } else {
             int cache_set_id = get_set_index(addr);
             int64_t tag_bits = get_tag(addr);
-            is_hit = cacheSets[cache_set_id]->service_write(tag_bits, partition);
+            is_hit = tagStore->service_write(cache_set_id, tag_bits, partition);
         }
 
         if (is_hit)
-        {
-            offset += hit_latency;
             stats.write_hit++;
+        else
+            stats.write_miss_all++;
+        issue_request(addr_no_offset, is_hit);
+        last_addr_no_offset = addr_no_offset;
+    }
+    return finish_requests();
+}
+
+// Runs the recorded calls of one prefetch against the cache, chained from
+// start_cycle as the buffer issued them, and stores their latency in the
+// event. The prefetches of a PE must be replayed in their serial order, each
+// from the cycle the serial run would have started it at.
+void LLC::replay(LLCAccessLog &access_log, size_t event_id, int64_t start_cycle)
+{
+    const compact_addr_t *line_addrs = access_log.line_addrs.data();
+    const AddressWindow &line_window = access_log.get_line_window();
+    PrefetchEvent &event = access_log.events[event_id];
+    int64_t cycle = start_cycle;
+    for (int64_t call_id = event.call_start; call_id < event.call_end; call_id++)
+    {
+        const LLCCall &call = access_log.calls[call_id];
+        cycle = service_lines(line_addrs + call.addr_start, line_addrs + call.addr_end, line_window, cycle, call.is_write, call.partition, call.reset);
+    }
+    cycle = wait_for_fills(cycle);
+    event.latency = cycle - start_cycle;
+}
+
+// Same as service_read/service_write on already shifted line addresses
+int64_t LLC::service_lines(const compact_addr_t *line_addrs_begin, const compact_addr_t *line_addrs_end, const AddressWindow &line_window, int64_t incoming_cycle, bool is_write, int partition, bool reset)
+{
+    if (reset)
+        last_addr_no_offset = -1;
+
+    if (is_bypassing && reset) return incoming_cycle + hit_latency;
+    if (is_bypassing && !reset) return incoming_cycle;
+
+    start_requests(incoming_cycle);
+
+    int64_t index_bits = (int64_t)(pow(2, set_bits)) - 1;
+
+    for (const compact_addr_t *it = line_addrs_begin; it != line_addrs_end; it++)
+    {
+        int64_t addr_no_offset = line_window.decode(*it);
+
+        if (addr_no_offset == last_addr_no_offset) continue;
+
+        bool is_hit = false;
+        if (is_always_hit) {
+            is_hit = true;
+        } else {
+            int cache_set_id = (int)(addr_no_offset & index_bits);
+            int64_t tag_bits = (int)(addr_no_offset >> set_bits);
+            if (is_write)
+                is_hit = tagStore->service_write(cache_set_id, tag_bits, partition);
+            else
+                is_hit = tagStore->service_read(cache_set_id, tag_bits, partition);
+        }
+
+        if (is_hit)
+        {
+            if (is_write)
+                stats.write_hit++;
+            else
+                stats.read_hit++;
         }
         else
         {
-            offset += miss_latency;
-            stats.write_miss_all++;
+            if (is_write)
+                stats.write_miss_all++;
+            else
+                stats.read_miss_all++;
         }
+        issue_request(addr_no_offset, is_hit);
         last_addr_no_offset = addr_no_offset;
     }
-    out_cycle += offset;
-    return out_cycle;
+    return finish_requests();
+}
+
+int64_t LLC::warm(const int64_t *addrs, int64_t count, bool is_write, int partition)
+{
+    // Neither keeps contents nor counts misses
+    if (is_always_hit || is_bypassing)
+        return 0;
+
+    // A miss counts as a conflict in the tag store
+    LLCStats saved_stats = stats;
+    int64_t index_bits = (int64_t)(pow(2, set_bits)) - 1;
+    int64_t last_line = -1;
+    int64_t misses = 0;
+    for (int64_t i = 0; i < count; i++)
+    {
+        if (addrs[i] == -1)
+            continue;
+        int64_t addr_no_offset = addrs[i] >> offset_bits;
+        if (addr_no_offset == last_line)
+            continue;
+
+        int cache_set_id = (int)(addr_no_offset & index_bits);
+        int64_t tag_bits = (int)(addr_no_offset >> set_bits);
+        bool is_hit;
+        if (is_write)
+            is_hit = tagStore->service_write(cache_set_id, tag_bits, partition);
+        else
+            is_hit = tagStore->service_read(cache_set_id, tag_bits, partition);
+        if (!is_hit)
+            misses++;
+        last_line = addr_no_offset;
+    }
+    stats = saved_stats;
+    warmed = true;
+    return misses;
+}
+
+void LLC::set_num_mshr(int num_mshr)
+{
+    this->num_mshr = num_mshr;
+    // A window spans a few miss latencies, and holds each MSHR busy for all
+    // of its cycles at most
+    int64_t window_cycles = max((int64_t)64, 4 * dram->get_latency());
+    mshr_busy.set_params(window_cycles, num_mshr * window_cycles);
+}
+
+void LLC::start_layer()
+{
+    dram->start_layer();
+    mshr.clear();
+    mshr_busy.clear();
+    fill_cycle = numeric_limits<int64_t>::min();
+}
+
+int64_t LLC::wait_for_fills(int64_t cycle)
+{
+    cycle = max(cycle, fill_cycle);
+    fill_cycle = numeric_limits<int64_t>::min();
+    return cycle;
+}
+
+inline void LLC::start_requests(int64_t incoming_cycle)
+{
+    issue_cycle = incoming_cycle;
+    // Retire the misses that have returned by now
+    for (auto it = mshr.begin(); it != mshr.end();) {
+        if (it->second.return_cycle <= incoming_cycle)
+            it = mshr.erase(it);
+        else
+            it++;
+    }
+}
+
+inline void LLC::issue_request(int64_t line_addr, bool is_hit)
+{
+    if (num_mshr == 0) {
+        issue_cycle = is_hit ? issue_cycle + hit_latency : dram->service_request(line_addr, issue_cycle);
+        return;
+    }
+
+    // The tag store already holds lines that are still being filled
+    auto pending = mshr.find(line_addr);
+    if (pending != mshr.end() && pending->second.issue_cycle <= issue_cycle && issue_cycle < pending->second.return_cycle) {
+        mshr_merges++;
+        fill_cycle = max(fill_cycle, pending->second.return_cycle);
+        issue_cycle += hit_latency;
+        return;
+    }
+
+    if (!is_hit) {
+        int64_t start_cycle = mshr_busy.find(issue_cycle, dram->get_latency());
+        mshr_stall_cycles += start_cycle - issue_cycle;
+        issue_cycle = start_cycle;
+        int64_t return_cycle = dram->service_request(line_addr, issue_cycle);
+        mshr_busy.add(issue_cycle, return_cycle);
+        mshr[line_addr] = {issue_cycle, return_cycle};
+        fill_cycle = max(fill_cycle, return_cycle);
+    }
+    issue_cycle += hit_latency;
+}
+
+inline int64_t LLC::finish_requests()
+{
+    return issue_cycle;
+}
+
+void LLC::save_state(LLCState &state)
+{
+    tagStore->save_state(state);
+    state.stats = stats;
+    state.last_addr_no_offset = last_addr_no_offset;
+    state.mshr_merges = mshr_merges;
+    state.mshr_stall_cycles = mshr_stall_cycles;
+    dram->save_state(state.dram);
+}
+
+void LLC::restore_state(const LLCState &state)
+{
+    tagStore->restore_state(state);
+    stats = state.stats;
+    last_addr_no_offset = state.last_addr_no_offset;
+    mshr_merges = state.mshr_merges;
+    mshr_stall_cycles = state.mshr_stall_cycles;
+    dram->restore_state(state.dram);
+}
+
+void LLC::add_llc_stats(LLCStats delta)
+{
+    stats.read_hit += delta.read_hit;
+    stats.read_miss_all += delta.read_miss_all;
+    stats.read_miss_conflict += delta.read_miss_conflict;
+    stats.write_hit += delta.write_hit;
+    stats.write_miss_all += delta.write_miss_all;
+    stats.write_miss_conflict += delta.write_miss_conflict;
 }
 
 int LLC::get_set_index(int64_t addr)
@@ -540,6 +772,13 @@ void LLC::dump_stats()
     cout << "llc.write_hit is " << stats.write_hit << endl;
     cout << "llc.write_miss_conflict is " << stats.write_miss_conflict << endl;
     cout << "llc.write_miss_all is " << stats.write_miss_all << endl;
+
+    if (num_mshr > 0) {
+        cout << "llc.mshr_merges is " << mshr_merges << endl;
+        cout << "llc.mshr_stall_cycles is " << mshr_stall_cycles << endl;
+    }
+    if (dram->is_banked())
+        dram->dump_stats();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#ifndef _llc_access_log_h
+#define _llc_access_log_h
+
+#include <vector>
+
+using namespace std;
+
+#include "fetch_lines.h"
+#include "address_window.h"
+
+enum class PrefetchKind
+{
+    INIT,       // prefetch_active_buffer, adds to the last prefetch cycle
+    PREFETCH    // new_prefetch, starts from max(incoming cycle, last prefetch cycle)
+};
+
+// One LLC service_read/service_write call; its line addresses are
+// line_addrs[addr_start, addr_end), encoded in the log's line window.
+typedef struct
+{
+    int64_t addr_start;
+    int64_t addr_end;
+    bool is_write;
+    int partition;
+    bool reset;
+} LLCCall;
+
+// The LLC calls issued by one prefetch of one buffer while serving a demand row.
+// latency is the sum of the call offsets, filled in by LLC::replay.
+typedef struct
+{
+    int buffer;
+    int64_t request_line_id;
+    PrefetchKind kind;
+    int64_t call_start;
+    int64_t call_end;
+    int64_t latency;
+} PrefetchEvent;
+
+// LLC traffic of one PE, recorded in issue order instead of being sent to the
+// shared LLC. Addresses are kept as cache line addresses with -1 and repeated
+// lines of the same call dropped, which is all the LLC looks at. Line
+// addresses are stored as 32-bit offsets into the line window.
+class LLCAccessLog
+{
+public:
+    LLCAccessLog();
+    void clear();
+    // Like clear, and also frees the storage
+    void release();
+    void set_offset_bits(int offset_bits);
+    void set_addr_window(AddressWindow addr_window);
+    const AddressWindow& get_line_window() { return line_window; }
+
+    void begin_event(int buffer, int64_t request_line_id, PrefetchKind kind);
+    template <class Requests>
+    int64_t record(const Requests &incoming_requests, int64_t incoming_cycle, bool is_write, int partition, bool reset);
+
+    vector<compact_addr_t> line_addrs;
+    vector<LLCCall> calls;
+    vector<PrefetchEvent> events;
+
+private:
+    void update_line_window();
+
+    int offset_bits;
+    AddressWindow addr_window;
+    AddressWindow line_window;
+};
+
+LLCAccessLog::LLCAccessLog()
+{
+    offset_bits = 6;
+    update_line_window();
+}
+
+void LLCAccessLog::set_offset_bits(int offset_bits)
+{
+    this->offset_bits = offset_bits;
+    update_line_window();
+}
+
+void LLCAccessLog::set_addr_window(AddressWindow addr_window)
+{
+    this->addr_window = addr_window;
+    update_line_window();
+}
+
+void LLCAccessLog::update_line_window()
+{
+    // Transposed prefetches pad their lines with address 0, which is sent to
+    // the LLC like any other address, so line 0 is always in the window
+    AddressWindow window(0, 0);
+    window.merge(addr_window);
+    line_window = window.get_line_window(offset_bits);
+}
+
+void LLCAccessLog::clear()
+{
+    line_addrs.clear();
+    calls.clear();
+    events.clear();
+}
+
+void LLCAccessLog::release()
+{
+    vector<compact_addr_t>().swap(line_addrs);
+    vector<LLCCall>().swap(calls);
+    vector<PrefetchEvent>().swap(events);
+}
+
+void LLCAccessLog::begin_event(int buffer, int64_t request_line_id, PrefetchKind kind)
+{
+    PrefetchEvent event;
+    event.buffer = buffer;
+    event.request_line_id = request_line_id;
+    event.kind = kind;
+    event.call_start = calls.size();
+    event.call_end = calls.size();
+    event.latency = 0;
+    events.push_back(event);
+}
+
+template <class Requests>
+int64_t LLCAccessLog::record(const Requests &incoming_requests, int64_t incoming_cycle, bool is_write, int partition, bool reset)
+{
+    LLCCall call;
+    call.addr_start = line_addrs.size();
+    call.is_write = is_write;
+    call.partition = partition;
+    call.reset = reset;
+
+    for (int64_t addr : incoming_requests)
+    {
+        if (addr == -1)
+            continue;
+
+        compact_addr_t addr_no_offset = line_window.encode(addr >> offset_bits);
+        if (line_addrs.size() > (size_t)call.addr_start && line_addrs.back() == addr_no_offset)
+            continue;
+        line_addrs.push_back(addr_no_offset);
+    }
+
+    call.addr_end = line_addrs.size();
+    calls.push_back(call);
+    events.back().call_end = calls.size();
+
+    // The real latency is only known after the replay
+    return incoming_cycle;
+}
+
+#endif
@@ -6,32 +6,47 @@
 #include <xtensor/xview.hpp>
 
 #include <vector>
-#include <set>
 
 using namespace std;
 
 #include "llc.h"
+#include "fetch_lines.h"
 
 class ReadBuffer {
 public:
     ReadBuffer(bool verbose);
     void set_params(LLC* llc, int64_t total_size_bytes, int64_t word_size, float active_buf_frac, int64_t req_gen_bandwidth);
     void set_fetch_matrix(xt::xarray<int64_t> fetch_matrix_np);
+    // Kept as is, the padding rows stay run-lengths
+    void set_fetch_matrix(PaddedDemand fetch_matrix);
+    void set_fetch_stream(DemandStream *fetch_stream);
+    // Builds the fetch lines of a stream apart from the buffer, which can go on
+    // servicing meanwhile; set_fetch_lines then makes them the current stream
+    void build_fetch_lines(DemandStream *fetch_stream, FetchLineWindow &lines);
+    void set_fetch_lines(DemandStream *fetch_stream, FetchLineWindow &lines);
+    // Frees the fetch lines of the current stream, which must not be serviced after
+    void release_lines();
     xt::xarray<int64_t> service_reads(xt::xarray<int64_t> incoming_requests_arr_np, xt::xarray<int64_t> incoming_cycles_arr, int llc_partition, bool trans);
     int64_t service_read(xt::xarray<int64_t> incoming_requests_arr_np, int64_t incoming_cycle, int llc_partition, bool trans);
     int64_t service_read(int request_line_id, int64_t incoming_cycle, int llc_partition, bool trans);
     int64_t get_hit_latency() { return hit_latency; }
+    // First request line from request_line_id on that has demand for this buffer
+    int64_t get_next_demand_line(int64_t request_line_id) { return hashed_buffer.find_content_line(request_line_id); }
+    void set_access_log(LLCAccessLog *access_log, int buffer_id);
 
     int64_t get_last_prefetch_cycle() { return last_prefetch_cycle; }
     void add_last_prefetch_cycle(int64_t cycle) { last_prefetch_cycle += cycle;}
 private:
     LLC *llc;
+    LLCAccessLog *access_log = NULL;
+    int buffer_id;
     int64_t total_size_bytes;
     int64_t word_size; 
     float active_buf_frac;
     int64_t req_gen_bandwidth;
 
-    xt::xarray<int64_t> fetch_matrix;
+    PaddedDemand fetch_matrix;
+    MatrixDemandStream fetch_matrix_stream;
     int64_t last_prefetch_cycle;
     int64_t next_line_prefetch_idx;
     int64_t next_col_prefetch_idx;
@@ -61,14 +76,16 @@ private:
     bool trace_valid = false;
     bool finished = false;
 
-    vector<set<int64_t>*> hashed_buffer;
-    vector<int64_t> hashed_line_id;
-    vector<bool> hashed_has_content;
+    FetchLineWindow hashed_buffer;
 
-    void prepare_hashed_buffer();
+    void init_hashed_buffer();
     void prefetch_active_buffer(int64_t start_cycle, int llc_partition);
     int64_t active_buffer_hit(int64_t addr);
     void new_prefetch(int llc_partition);
+    template <class Requests>
+    int64_t llc_read(const Requests &incoming_requests, int64_t incoming_cycle, int llc_partition, bool reset);
+    // A prefetch is done once the misses it left in the LLC's MSHRs return
+    int64_t llc_wait_for_fills(int64_t cycle);
 };
 
 ReadBuffer::ReadBuffer(bool verbose) {
@@ -113,78 +130,63 @@ void ReadBuffer::set_params(LLC* llc, int64_t total_size_bytes, int64_t word_siz
 }
 
 void ReadBuffer::set_fetch_matrix(xt::xarray<int64_t> fetch_matrix_np) {
+    set_fetch_matrix(PaddedDemand(fetch_matrix_np));
+}
+
+void ReadBuffer::set_fetch_matrix(PaddedDemand fetch_matrix) {
     cout << "ReadBuffer::set_fetch_matrix" << endl;
-    int64_t src_rows = fetch_matrix_np.shape()[0];
-    int64_t src_cols = fetch_matrix_np.shape()[1];
-    int64_t num_elems = src_rows * src_cols;
-    int64_t num_lines = (num_elems + req_gen_bandwidth - 1) / req_gen_bandwidth;
-    cout << src_rows << ", " << src_cols << endl;
-    cout << num_lines << ", " << req_gen_bandwidth << endl;
-    fetch_matrix = xt::ones<int64_t>({num_lines, req_gen_bandwidth}) * -1;
-
-    for (int64_t i = 0; i < num_elems; i++) {
-        int64_t src_row = i / fetch_matrix_np.shape()[1];
-        int64_t src_col = i % fetch_matrix_np.shape()[1];
-
-        int64_t dest_row = i / req_gen_bandwidth;
-        int64_t dest_col = i % req_gen_bandwidth;
-
-        fetch_matrix(dest_row, dest_col) = fetch_matrix_np(src_row, src_col);
-    }
+    this->fetch_matrix = fetch_matrix;
+    fetch_matrix_stream.set_matrix(&this->fetch_matrix);
+    set_fetch_stream(&fetch_matrix_stream);
+}
 
+void ReadBuffer::set_fetch_stream(DemandStream *fetch_stream) {
     last_prefetch_cycle = -1;
-    prepare_hashed_buffer();
-    // cout << fetch_matrix << endl;
+    build_fetch_lines(fetch_stream, hashed_buffer);
+    init_hashed_buffer();
 }
 
-void ReadBuffer::prepare_hashed_buffer() {
-    cout << "prepare_hashed_buffer" << endl;
-    // int64_t elems_per_set = (total_size_elems + 99) / 100;
-    elems_per_set = req_gen_bandwidth;
+void ReadBuffer::build_fetch_lines(DemandStream *fetch_stream, FetchLineWindow &lines) {
+    // Keep the lines of one full buffer resident, the rest is streamed
+    int64_t num_head_lines = (active_buf_size + req_gen_bandwidth - 1) / req_gen_bandwidth
+                           + (prefetch_buf_size + req_gen_bandwidth - 1) / req_gen_bandwidth;
+    lines.set_stream(fetch_stream, req_gen_bandwidth, num_head_lines);
+}
 
-    int64_t prefetch_rows = fetch_matrix.shape()[0];
-    int64_t prefetch_cols = fetch_matrix.shape()[1];
+void ReadBuffer::set_fetch_lines(DemandStream *fetch_stream, FetchLineWindow &lines) {
+    last_prefetch_cycle = -1;
+    swap(hashed_buffer, lines);
+    init_hashed_buffer();
+}
 
-    int64_t line_id = 0;
+// While a log is set, LLC calls are recorded there instead of going to the LLC
+void ReadBuffer::set_access_log(LLCAccessLog *access_log, int buffer_id) {
+    this->access_log = access_log;
+    this->buffer_id = buffer_id;
+    if (access_log != NULL)
+        access_log->set_offset_bits(llc->get_offset_bits());
+}
 
-    hashed_buffer.clear();
-    hashed_line_id.clear();
-    hashed_has_content.clear();
+void ReadBuffer::release_lines() {
+    hashed_buffer.release();
+    hashed_buffer_valid = false;
+    fetch_matrix = PaddedDemand();
+}
+
+void ReadBuffer::init_hashed_buffer() {
+    cout << "prepare_hashed_buffer" << endl;
+    // int64_t elems_per_set = (total_size_elems + 99) / 100;
+    elems_per_set = req_gen_bandwidth;
 
     active_buf_full_flag = false;
     finished = false;
-        
-    for (int64_t r = 0; r < prefetch_rows; r++) {
-        // set<int64_t> *this_set = new set<int64_t>(elems_per_set);
-        set<int64_t> *this_set = new set<int64_t>();
-        bool has_content = false;
-        for (int64_t c = 0; c < prefetch_cols; c++) {
-            int64_t elem = fetch_matrix(r, c);
-            if (elem != -1)
-                has_content = true;
-            this_set->insert(elem);
-        }
-        hashed_line_id.push_back(line_id);
-        hashed_has_content.push_back(has_content);
-        if (has_content) {
-            hashed_buffer.push_back(this_set);
-            line_id++;
-
-            // for (int64_t c = 0; c < prefetch_cols; c++) {
-            //     int64_t elem = fetch_matrix(r, c);
-            //     std::cout << elem << ", ";
-            // }
-            // cout << endl;
-        }
-            
-    }
 
     max_num_active_buf_lines = (active_buf_size + elems_per_set - 1) / elems_per_set;
     max_num_prefetch_buf_lines = (prefetch_buf_size + elems_per_set - 1) / elems_per_set;
-    int64_t num_lines = line_id;
+
+    int64_t num_lines = hashed_buffer.get_num_lines();
 
     cout << "num_lines is " << num_lines << endl;
-        
 
     if (num_lines > max_num_active_buf_lines)
         num_active_buf_lines = max_num_active_buf_lines;
@@ -210,20 +212,20 @@ int64_t ReadBuffer::active_buffer_hit(int64_t addr) {
 
     if (start_id < end_id) {
         for (int line_id = start_id; line_id < end_id; line_id++) {
-            set<int64_t> *this_set = hashed_buffer[line_id];
-            if (this_set->find(addr) != this_set->end())                       
+            FetchLine this_line = hashed_buffer.get_line(line_id);
+            if (this_line.contains(addr))                       
                 return true;
         }        
     } else {
         for (int line_id = start_id; line_id < num_lines; line_id++) {
-            set<int64_t> *this_set = hashed_buffer[line_id];
-            if (this_set->find(addr) != this_set->end())                       
+            FetchLine this_line = hashed_buffer.get_line(line_id);
+            if (this_line.contains(addr))                       
                 return true;
         } 
 
         for (int line_id = 0; line_id < end_id; line_id++) {
-            set<int64_t> *this_set = hashed_buffer[line_id];
-            if (this_set->find(addr) != this_set->end())                       
+            FetchLine this_line = hashed_buffer.get_line(line_id);
+            if (this_line.contains(addr))                       
                 return true;
         } 
     }
@@ -287,17 +289,17 @@ int64_t ReadBuffer::service_read(xt::xarray<int64_t> request_line, int64_t incom
 
 int64_t ReadBuffer::service_read(int request_line_id, int64_t incoming_cycle, int llc_partition, bool trans) {
     this->trans = trans;
-    int64_t line_id = hashed_line_id[request_line_id];
-
-    // cout << "line_id is " << line_id << endl;
-    // cout << "hashed_has_content[request_line_id] is " << hashed_has_content[request_line_id] << endl;
 
     int64_t offset = hit_latency;
     int64_t cycle = incoming_cycle;
     
-    if (hashed_has_content[request_line_id]) {
+    if (hashed_buffer.has_content(request_line_id)) {
+        int64_t line_id = hashed_buffer.get_line_id(request_line_id);
+
         if (!active_buf_full_flag) {
             int64_t start_cycle = incoming_cycle;
+            if (access_log != NULL)
+                access_log->begin_event(buffer_id, request_line_id, PrefetchKind::INIT);
             prefetch_active_buffer(start_cycle, llc_partition); 
         }
 
@@ -305,6 +307,8 @@ int64_t ReadBuffer::service_read(int request_line_id, int64_t incoming_cycle, in
             if (!finished) {
                 cycle = max(incoming_cycle, last_prefetch_cycle);
                 last_prefetch_cycle = max(last_prefetch_cycle, cycle);
+                if (access_log != NULL)
+                    access_log->begin_event(buffer_id, request_line_id, PrefetchKind::PREFETCH);
                 new_prefetch(llc_partition);
             }
             if (line_id == (num_lines - 1)) finished = true;
@@ -314,6 +318,8 @@ int64_t ReadBuffer::service_read(int request_line_id, int64_t incoming_cycle, in
             if (!finished) {
                 cycle = max(incoming_cycle, last_prefetch_cycle);
                 last_prefetch_cycle = max(last_prefetch_cycle, cycle);
+                if (access_log != NULL)
+                    access_log->begin_event(buffer_id, request_line_id, PrefetchKind::PREFETCH);
                 new_prefetch(llc_partition);
             }
             finished = true;
@@ -328,8 +334,8 @@ int64_t ReadBuffer::service_read(int request_line_id, int64_t incoming_cycle, in
 void ReadBuffer::prefetch_active_buffer(int64_t start_cycle, int llc_partition) {
     int64_t fetch_lines = (active_buf_size + req_gen_bandwidth - 1) / req_gen_bandwidth;
     
-    if (fetch_lines >= hashed_buffer.size()) {
-        fetch_lines = hashed_buffer.size();
+    if (fetch_lines >= num_lines) {
+        fetch_lines = num_lines;
     }
         
     int64_t requested_data_size = fetch_lines * elems_per_set;
@@ -340,17 +346,16 @@ void ReadBuffer::prefetch_active_buffer(int64_t start_cycle, int llc_partition)
 
     if (!trans) {
         for (int line_id = start_idx; line_id < end_idx; line_id++) {
-            set<int64_t> *this_set = hashed_buffer[line_id];
-            last_prefetch_cycle = llc->service_read(this_set, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
+            FetchLine this_line = hashed_buffer.get_line(line_id);
+            last_prefetch_cycle = llc_read(this_line, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
         } 
     } else {
         xt::xarray<int64_t> trans_hashed_buffer = xt::zeros<int64_t>({req_gen_bandwidth, fetch_lines});
         int row = 0;
         for (int line_id = start_idx; line_id < end_idx; line_id++) {
-            set<int64_t> *this_set = hashed_buffer[line_id];
+            FetchLine this_line = hashed_buffer.get_line(line_id);
             int col = 0;
-            for (auto i = this_set->begin(); i != this_set->end(); ++i) {
-                int64_t addr = (*i);
+            for (int64_t addr : this_line) {
                 trans_hashed_buffer(col, row) = addr;
                 col++;
             }
@@ -359,9 +364,10 @@ void ReadBuffer::prefetch_active_buffer(int64_t start_cycle, int llc_partition)
 
         for (int i = 0; i < req_gen_bandwidth; i++) {
             xt::xarray<int64_t> trans_line = xt::row(trans_hashed_buffer, i);
-            last_prefetch_cycle = llc->service_read(trans_line, last_prefetch_cycle, llc_partition, (i + 1) % 2);
+            last_prefetch_cycle = llc_read(trans_line, last_prefetch_cycle, llc_partition, (i + 1) % 2);
         }
     }
+    last_prefetch_cycle = llc_wait_for_fills(last_prefetch_cycle);
 
     trace_valid = true;
 
@@ -388,6 +394,7 @@ void ReadBuffer::new_prefetch(int llc_partition) {
         
     active_buffer_set_limits = {active_start, active_end};
     prefetch_buffer_set_limits = {prefetch_start, prefetch_end};
+    hashed_buffer.release_before(active_start);
     
     int64_t start_idx = prefetch_start;
     int64_t fetch_lines = (prefetch_buf_size + elems_per_set - 1) / elems_per_set;
@@ -400,20 +407,20 @@ void ReadBuffer::new_prefetch(int llc_partition) {
     if (!trans) {
         if (end_idx > start_idx) {
             for (int line_id = start_idx; line_id < end_idx; line_id++) {
-                set<int64_t> *this_set = hashed_buffer[line_id];
-                last_prefetch_cycle = llc->service_read(this_set, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
+                FetchLine this_line = hashed_buffer.get_line(line_id);
+                last_prefetch_cycle = llc_read(this_line, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
             }        
         } else {
             cout << "read_buffer end_idx < start_idx" << endl;
             cout << "start_idx is " << start_idx << ", end_idx is " << end_idx << ", num_lines is " << num_lines << endl;
             for (int line_id = start_idx; line_id < num_lines; line_id++) {
-                set<int64_t> *this_set = hashed_buffer[line_id];
-                last_prefetch_cycle = llc->service_read(this_set, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
+                FetchLine this_line = hashed_buffer.get_line(line_id);
+                last_prefetch_cycle = llc_read(this_line, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
             } 
 
             for (int line_id = 0; line_id < end_idx; line_id++) {
-                set<int64_t> *this_set = hashed_buffer[line_id];
-                last_prefetch_cycle = llc->service_read(this_set, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
+                FetchLine this_line = hashed_buffer.get_line(line_id);
+                last_prefetch_cycle = llc_read(this_line, last_prefetch_cycle, llc_partition, (line_id + 1) % 2);
             } 
         }
     } else {
@@ -422,10 +429,9 @@ void ReadBuffer::new_prefetch(int llc_partition) {
         int row = 0;
         if (end_idx > start_idx) {
             for (int line_id = start_idx; line_id < end_idx; line_id++) {
-                set<int64_t> *this_set = hashed_buffer[line_id];
+                FetchLine this_line = hashed_buffer.get_line(line_id);
                 int col = 0;
-                for (auto i = this_set->begin(); i != this_set->end(); ++i) {
-                    int64_t addr = (*i);
+                for (int64_t addr : this_line) {
                     trans_hashed_buffer(col, row) = addr;
                     col++;
                 }
@@ -435,10 +441,9 @@ void ReadBuffer::new_prefetch(int llc_partition) {
             cout << "read_buffer end_idx < start_idx" << endl;
             cout << "start_idx is " << start_idx << ", end_idx is " << end_idx << ", num_lines is " << num_lines << endl;
             for (int line_id = start_idx; line_id < num_lines; line_id++) {
-                set<int64_t> *this_set = hashed_buffer[line_id];
+                FetchLine this_line = hashed_buffer.get_line(line_id);
                 int col = 0;
-                for (auto i = this_set->begin(); i != this_set->end(); ++i) {
-                    int64_t addr = (*i);
+                for (int64_t addr : this_line) {
                     trans_hashed_buffer(col, row) = addr;
                     col++;
                 }
@@ -446,10 +451,9 @@ void ReadBuffer::new_prefetch(int llc_partition) {
             }
 
             for (int line_id = 0; line_id < end_idx; line_id++) {
-                set<int64_t> *this_set = hashed_buffer[line_id];
+                FetchLine this_line = hashed_buffer.get_line(line_id);
                 int col = 0;
-                for (auto i = this_set->begin(); i != this_set->end(); ++i) {
-                    int64_t addr = (*i);
+                for (int64_t addr : this_line) {
                     trans_hashed_buffer(col, row) = addr;
                     col++;
                 }
@@ -459,11 +463,26 @@ void ReadBuffer::new_prefetch(int llc_partition) {
 
         for (int i = 0; i < req_gen_bandwidth; i++) {
             xt::xarray<int64_t> trans_line = xt::row(trans_hashed_buffer, i);
-            last_prefetch_cycle = llc->service_read(trans_line, last_prefetch_cycle, llc_partition, (i + 1) % 2);
+            last_prefetch_cycle = llc_read(trans_line, last_prefetch_cycle, llc_partition, (i + 1) % 2);
         }
 
     }
+    last_prefetch_cycle = llc_wait_for_fills(last_prefetch_cycle);
     // cout << "finish new_prefetch at last_prefetch_cycle " << last_prefetch_cycle << endl;
 }
 
+template <class Requests>
+int64_t ReadBuffer::llc_read(const Requests &incoming_requests, int64_t incoming_cycle, int llc_partition, bool reset) {
+    if (access_log != NULL)
+        return access_log->record(incoming_requests, incoming_cycle, false, llc_partition, reset);
+    return llc->service_read(incoming_requests, incoming_cycle, llc_partition, reset);
+}
+
+int64_t ReadBuffer::llc_wait_for_fills(int64_t cycle) {
+    // A replay waits at the end of every recorded prefetch
+    if (access_log != NULL)
+        return cycle;
+    return llc->wait_for_fills(cycle);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#ifndef _tag_match_h
+#define _tag_match_h
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TAG_MATCH_X86
+#endif
+
+// Way searches of one LLC set partition. Tags are 32-bit, RRIP values one
+// byte per way; both are contiguous per set. The x86 versions compare 4 (SSE2)
+// or 8 (AVX2) tags and 16 RRIP values per instruction and fall back to the
+// scalar loop for the remaining ways. SSE2 is part of x86-64, AVX2 is checked
+// at run time.
+
+// First way holding tag, -1 if none
+inline int find_tag_scalar(const int32_t *tags, int num_ways, int32_t tag)
+{
+    for (int i = 0; i < num_ways; i++)
+    {
+        if (tags[i] == tag)
+            return i;
+    }
+    return -1;
+}
+
+// First way with the largest RRIP value
+inline int find_max_rrip_scalar(const uint8_t *rrip_bits, int num_ways, uint8_t &max_rrip)
+{
+    int index = 0;
+    max_rrip = rrip_bits[0];
+    for (int i = 1; i < num_ways; i++)
+    {
+        if (rrip_bits[i] > max_rrip) {
+            max_rrip = rrip_bits[i];
+            index = i;
+        }
+    }
+    return index;
+}
+
+inline bool cpu_has_avx2()
+{
+#ifdef TAG_MATCH_X86
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+#ifdef TAG_MATCH_X86
+
+inline int find_tag_sse2(const int32_t *tags, int num_ways, int32_t tag)
+{
+    __m128i key = _mm_set1_epi32(tag);
+    int i = 0;
+    for (; i + 4 <= num_ways; i += 4)
+    {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(tags + i)), key);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    int index = find_tag_scalar(tags + i, num_ways - i, tag);
+    return index == -1 ? -1 : i + index;
+}
+
+// Clears the upper ymm halves before returning, callers run legacy SSE code
+// and would otherwise pay the AVX/SSE transition on every lookup
+__attribute__((target("avx2")))
+inline int find_tag_avx2(const int32_t *tags, int num_ways, int32_t tag)
+{
+    __m256i key = _mm256_set1_epi32(tag);
+    int index = -1;
+    int i = 0;
+    for (; i + 8 <= num_ways; i += 8)
+    {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(tags + i)), key);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (mask != 0) {
+            index = i + __builtin_ctz(mask);
+            break;
+        }
+    }
+    _mm256_zeroupper();
+    if (index != -1)
+        return index;
+
+    index = find_tag_scalar(tags + i, num_ways - i, tag);
+    return index == -1 ? -1 : i + index;
+}
+
+inline int find_max_rrip_sse2(const uint8_t *rrip_bits, int num_ways, uint8_t &max_rrip)
+{
+    if (num_ways < 16)
+        return find_max_rrip_scalar(rrip_bits, num_ways, max_rrip);
+
+    // Largest value over all ways, folded down from 16 lanes
+    __m128i max_vec = _mm_loadu_si128((const __m128i *)rrip_bits);
+    int i = 16;
+    for (; i + 16 <= num_ways; i += 16)
+        max_vec = _mm_max_epu8(max_vec, _mm_loadu_si128((const __m128i *)(rrip_bits + i)));
+    max_vec = _mm_max_epu8(max_vec, _mm_srli_si128(max_vec, 8));
+    max_vec = _mm_max_epu8(max_vec, _mm_srli_si128(max_vec, 4));
+    max_vec = _mm_max_epu8(max_vec, _mm_srli_si128(max_vec, 2));
+    max_vec = _mm_max_epu8(max_vec, _mm_srli_si128(max_vec, 1));
+    max_rrip = (uint8_t)_mm_cvtsi128_si32(max_vec);
+    for (int j = i; j < num_ways; j++)
+        max_rrip = rrip_bits[j] > max_rrip ? rrip_bits[j] : max_rrip;
+
+    __m128i key = _mm_set1_epi8((char)max_rrip);
+    for (i = 0; i + 16 <= num_ways; i += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(rrip_bits + i)), key));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    for (; i < num_ways; i++)
+    {
+        if (rrip_bits[i] == max_rrip)
+            return i;
+    }
+    return 0;
+}
+
+#endif
+
+// use_avx2 comes from cpu_has_avx2(), checked once by the caller
+inline int find_tag(const int32_t *tags, int num_ways, int32_t tag, bool use_avx2)
+{
+#ifdef TAG_MATCH_X86
+    if (use_avx2)
+        return find_tag_avx2(tags, num_ways, tag);
+    return find_tag_sse2(tags, num_ways, tag);
+#else
+    return find_tag_scalar(tags, num_ways, tag);
+#endif
+}
+
+inline int find_max_rrip(const uint8_t *rrip_bits, int num_ways, uint8_t &max_rrip)
+{
+#ifdef TAG_MATCH_X86
+    return find_max_rrip_sse2(rrip_bits, num_ways, max_rrip);
+#else
+    return find_max_rrip_scalar(rrip_bits, num_ways, max_rrip);
+#endif
+}
+
+#endif
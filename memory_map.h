@@ -1,14 +1,30 @@
 #ifndef _memory_map_h
 #define _memory_map_h
 
+#include <map>
+#include <string>
 #include <vector>
+#include <iostream>
 
 using namespace std;
 
+// How addresses are spread over the memory banks: cache line by cache
+// line, page by page, or one whole tensor per bank, round robin in the
+// order the tensors are first used
+enum class BankInterleave { LINE, PAGE, TENSOR };
+
 class MemoryMap {
     public:
         MemoryMap();
         void set_single_bank_params(uint64_t filter_offset, uint64_t ofmap_offset);
+        void set_bank_params(int64_t num_banks, string interleave, int64_t line_size, int64_t page_size);
+        // Tensor interleaving only; the tensor runs up to the next one added
+        void add_tensor(uint64_t start_addr);
+        bool is_tensor_interleaved() { return num_banks > 1 && interleave == BankInterleave::TENSOR; }
+
+        int64_t get_bank(uint64_t addr);
+        // Address within the bank, with the interleaving bits removed
+        uint64_t get_bank_addr(uint64_t addr);
 
         int64_t num_mappings;
         int64_t num_banks;
@@ -18,11 +34,20 @@ class MemoryMap {
         vector<uint64_t> ofmap_map_list;
 
         bool map_data_valid = false;
+
+    private:
+        BankInterleave interleave;
+        int64_t granularity;
+
+        // Start address -> bank of every tensor seen
+        map<uint64_t, int64_t> tensor_banks;
 };
 
 MemoryMap::MemoryMap() {
     num_mappings = 1;
     num_banks = 1;
+    interleave = BankInterleave::LINE;
+    granularity = 64;
     map_data_valid = false;
 }
 
@@ -37,4 +62,49 @@ void MemoryMap::set_single_bank_params(uint64_t filter_offset, uint64_t ofmap_of
     map_data_valid = true;
 }
 
-#endif
\ No newline at end of file
+void MemoryMap::set_bank_params(int64_t num_banks, string interleave, int64_t line_size, int64_t page_size) {
+    this->num_banks = max(num_banks, (int64_t)1);
+
+    if (interleave == "page") {
+        this->interleave = BankInterleave::PAGE;
+        granularity = page_size;
+    } else if (interleave == "tensor") {
+        this->interleave = BankInterleave::TENSOR;
+        granularity = line_size;
+    } else {
+        if (interleave != "line")
+            cout << "Unknown bank interleaving " << interleave << ", interleaving by cache line" << endl;
+        this->interleave = BankInterleave::LINE;
+        granularity = line_size;
+    }
+    tensor_banks.clear();
+}
+
+void MemoryMap::add_tensor(uint64_t start_addr) {
+    if (tensor_banks.count(start_addr) == 0) {
+        int64_t bank = tensor_banks.size() % num_banks;
+        tensor_banks[start_addr] = bank;
+    }
+}
+
+int64_t MemoryMap::get_bank(uint64_t addr) {
+    if (num_banks == 1)
+        return 0;
+    if (interleave == BankInterleave::TENSOR) {
+        // Addresses below the first tensor go to bank 0
+        auto it = tensor_banks.upper_bound(addr);
+        if (it == tensor_banks.begin())
+            return 0;
+        return prev(it)->second;
+    }
+    return (addr / granularity) % num_banks;
+}
+
+uint64_t MemoryMap::get_bank_addr(uint64_t addr) {
+    if (num_banks == 1 || interleave == BankInterleave::TENSOR)
+        return addr;
+    uint64_t chunk = addr / granularity;
+    return (chunk / num_banks) * granularity + addr % granularity;
+}
+
+#endif
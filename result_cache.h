@@ -0,0 +1,214 @@
+#ifndef _result_cache_h
+#define _result_cache_h
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "scale_config.h"
+#include "topology_utils.h"
+#include "memory/llc.h"
+
+using namespace std;
+
+// What a layer adds to the simulator state: cycles of each PE it runs on, in
+// pe_list order, and the LLC accesses
+typedef struct
+{
+    vector<int64_t> pe_total_cycles;
+    vector<int64_t> pe_stall_cycles;
+    LLCStats llc_stats;
+    float mapping_eff;
+    float compute_util;
+} LayerResult;
+
+// On-disk per-layer results, keyed on everything a layer's result depends on
+// when the LLC state does not matter ([llc] AlwaysHit or Bypassing): layer
+// shape, dataflow, array, SRAM and bandwidth parameters, and the operand
+// offsets. The LLC merges consecutive requests to the same line, so offsets
+// only enter relative to the layer's first cache line.
+//
+// One file per key, <dir>/<hash>.layer, holding the key itself and the result.
+class LayerResultCache
+{
+public:
+    LayerResultCache(string cache_dir);
+    // Only runs whose layers cannot see each other through the LLC are cached
+    static bool is_cacheable(Config *config);
+
+    string make_key(Config *config, Topology *topology, int64_t layer_id, int64_t num_pes);
+    bool lookup(const string &key, LayerResult &result);
+    // Whether an entry for key is stored, without counting a hit or a miss
+    bool contains(const string &key);
+    void store(const string &key, const LayerResult &result);
+
+    string get_cache_dir() { return cache_dir; }
+    int64_t get_hits() { return hits; }
+    int64_t get_misses() { return misses; }
+
+private:
+    string get_file_name(const string &key);
+
+    string cache_dir;
+    int64_t hits;
+    int64_t misses;
+};
+
+LayerResultCache::LayerResultCache(string cache_dir)
+{
+    this->cache_dir = cache_dir;
+    hits = 0;
+    misses = 0;
+
+    if (mkdir(cache_dir.c_str(), 0755) != 0 && errno != EEXIST)
+        cout << "Could not create result cache directory " << cache_dir << ": " << strerror(errno) << endl;
+}
+
+bool LayerResultCache::is_cacheable(Config *config)
+{
+    LlcConfig llcConfig = config->get_llc_config();
+    return llcConfig.is_always_hit || llcConfig.is_bypassing;
+}
+
+string LayerResultCache::make_key(Config *config, Topology *topology, int64_t layer_id, int64_t num_pes)
+{
+    ArrayDims arr_dims = config->get_array_dims();
+    MemSizes mem_sizes = config->get_mem_sizes();
+    LlcConfig llcConfig = config->get_llc_config();
+    OffsetInfo offsets = topology->get_layer_offsets(layer_id);
+
+    // Shift the offsets by whole cache lines so the layer starts in line 1.
+    // Transposed prefetches pad with address 0, so a layer touching line 0
+    // keeps its offsets.
+    int64_t min_offset = min(offsets.filter_offset, offsets.ofmap_offset);
+    for (int64_t offset : offsets.ifmap_offset)
+        min_offset = min(min_offset, offset);
+    int64_t min_line = min_offset / llcConfig.cache_line_size;
+    int64_t shift = (min_line > 1) ? (min_line - 1) * llcConfig.cache_line_size : 0;
+
+    pair<int64_t, int64_t> ifmap_dims = topology->get_layer_ifmap_dims(layer_id);
+    pair<int64_t, int64_t> filter_dims = topology->get_layer_filter_dims(layer_id);
+    pair<int64_t, int64_t> strides = topology->get_layer_strides(layer_id);
+
+    stringstream key;
+    key << "layer " << topology->get_layer_type(layer_id)
+        << " " << ifmap_dims.first << "x" << ifmap_dims.second
+        << " " << filter_dims.first << "x" << filter_dims.second
+        << " " << topology->get_layer_num_channels(layer_id)
+        << " " << topology->get_layer_num_filters(layer_id)
+        << " " << strides.first << "x" << strides.second
+        << " " << topology->get_layer_dataflow(layer_id)
+        << " " << topology->is_layer_gemm(layer_id)
+        << topology->is_layer_ifmap_col_major(layer_id)
+        << topology->is_layer_filter_col_major(layer_id)
+        << " pes " << num_pes;
+    key << " offsets";
+    for (int64_t offset : offsets.ifmap_offset)
+        key << " " << offset - shift;
+    key << " " << offsets.filter_offset - shift << " " << offsets.ofmap_offset - shift;
+    key << " array " << arr_dims.arr_h << "x" << arr_dims.arr_w
+        << " sram " << mem_sizes.ifmap_kb << " " << mem_sizes.filter_kb << " " << mem_sizes.ofmap_kb
+        << " bw " << config->get_bandwidth()
+        << " word " << config->get_word_size()
+        << " batch " << config->get_batch_size()
+        << " prefetch " << config->is_prefetch_demand()
+        << " extrapolate " << config->get_fold_extrapolation() << " " << config->get_extrapolation_tolerance()
+        << " partition " << config->is_use_llc_partition()
+        << " llc " << llcConfig.cache_line_size << " " << llcConfig.hit_latency
+        << " " << llcConfig.is_always_hit << llcConfig.is_bypassing << " mshr " << llcConfig.num_mshr;
+    return key.str();
+}
+
+bool LayerResultCache::lookup(const string &key, LayerResult &result)
+{
+    ifstream ifs(get_file_name(key));
+    string stored_key;
+    if (!ifs.is_open() || !getline(ifs, stored_key) || stored_key != key) {
+        misses++;
+        return false;
+    }
+
+    int64_t num_pes;
+    ifs >> num_pes;
+    result.pe_total_cycles.assign(num_pes, 0);
+    result.pe_stall_cycles.assign(num_pes, 0);
+    for (int64_t i = 0; i < num_pes; i++)
+        ifs >> result.pe_total_cycles[i] >> result.pe_stall_cycles[i];
+
+    LLCStats &stats = result.llc_stats;
+    ifs >> stats.read_hit >> stats.read_miss_all >> stats.read_miss_conflict
+        >> stats.write_hit >> stats.write_miss_all >> stats.write_miss_conflict;
+    // Pool layers report nan, which operator>> does not parse
+    string mapping_eff, compute_util;
+    ifs >> mapping_eff >> compute_util;
+    result.mapping_eff = strtof(mapping_eff.c_str(), NULL);
+    result.compute_util = strtof(compute_util.c_str(), NULL);
+
+    if (ifs.fail()) {
+        cout << "Ignoring corrupt result cache entry " << get_file_name(key) << endl;
+        misses++;
+        return false;
+    }
+    hits++;
+    return true;
+}
+
+bool LayerResultCache::contains(const string &key)
+{
+    ifstream ifs(get_file_name(key));
+    string stored_key;
+    return ifs.is_open() && getline(ifs, stored_key) && stored_key == key;
+}
+
+void LayerResultCache::store(const string &key, const LayerResult &result)
+{
+    // Written aside and renamed, so concurrent runs never read a partial entry
+    string file_name = get_file_name(key);
+    string tmp_name = file_name + ".tmp" + to_string(std::hash<thread::id>()(this_thread::get_id()));
+
+    ofstream ofs(tmp_name);
+    if (!ofs.is_open()) {
+        cout << "Could not write result cache entry " << file_name << endl;
+        return;
+    }
+
+    ofs << key << endl;
+    ofs << result.pe_total_cycles.size();
+    for (size_t i = 0; i < result.pe_total_cycles.size(); i++)
+        ofs << " " << result.pe_total_cycles[i] << " " << result.pe_stall_cycles[i];
+    ofs << endl;
+
+    const LLCStats &stats = result.llc_stats;
+    ofs << stats.read_hit << " " << stats.read_miss_all << " " << stats.read_miss_conflict << " "
+        << stats.write_hit << " " << stats.write_miss_all << " " << stats.write_miss_conflict << endl;
+    ofs.precision(9);
+    ofs << result.mapping_eff << " " << result.compute_util << endl;
+    ofs.close();
+
+    rename(tmp_name.c_str(), file_name.c_str());
+}
+
+// FNV-1a of the key
+string LayerResultCache::get_file_name(const string &key)
+{
+    uint64_t hash_value = 14695981039346656037ULL;
+    for (char c : key) {
+        hash_value ^= (uint8_t)c;
+        hash_value *= 1099511628211ULL;
+    }
+
+    char hash_str[17];
+    snprintf(hash_str, sizeof(hash_str), "%016lx", hash_value);
+    return cache_dir + "/" + hash_str + ".layer";
+}
+
+#endif
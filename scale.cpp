@@ -16,16 +16,74 @@ int main(int argc, char* argv[])
         config = argv[2];
     }
 
+    // --sweep[=file]: simulate every per-layer dataflow combination instead
+    // --model=detailed|analytical|validate: overrides [run_presets] Model
+    // --trace=off|summary|full: overrides [run_presets] Trace
+    // --input=conv|gemm: topology format, gemm reads M,N,K layers
+    // --result-cache=dir: overrides [run_presets] ResultCache
+    // --extrapolate=N: overrides [run_presets] FoldExtrapolation
+    // --profile: per-layer host profile, like [run_presets] Profile = true
+    // --pipeline=N: overrides [run_presets] PipelineDepth
+    bool sweep = false;
+    string sweep_file = "";
+    string sim_model = "";
+    string trace_level = "";
+    string inp_type = "conv";
+    string result_cache_dir = "";
+    int fold_extrapolation = -1;
+    bool profiling = false;
+    int pipeline_depth = -1;
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--model=", 0) == 0) {
+            sim_model = arg.substr(8);
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            trace_level = arg.substr(8);
+        } else if (arg.rfind("--input=", 0) == 0) {
+            inp_type = arg.substr(8);
+        } else if (arg.rfind("--result-cache=", 0) == 0) {
+            result_cache_dir = arg.substr(15);
+        } else if (arg.rfind("--extrapolate=", 0) == 0) {
+            fold_extrapolation = atoi(arg.substr(14).c_str());
+        } else if (arg.rfind("--pipeline=", 0) == 0) {
+            pipeline_depth = atoi(arg.substr(11).c_str());
+        } else if (arg == "--profile") {
+            profiling = true;
+        } else if (arg == "--sweep") {
+            sweep = true;
+        } else if (arg.rfind("--sweep=", 0) == 0) {
+            sweep = true;
+            sweep_file = arg.substr(8);
+        }
+    }
+
     char* logpath = "./test_runs";
-    char* inp_type = "conv";
 
     bool gemm_input = false;
     if (inp_type == "gemm")
         gemm_input = true;
+    else if (inp_type != "conv")
+        cout << "Unknown input type " << inp_type << ", reading a conv topology" << endl;
 
 
     ScaleSim* scaleSim = new ScaleSim(true, config, topology, gemm_input);
-    scaleSim->run_scale(logpath);
+    if (sim_model != "")
+        scaleSim->set_sim_model(sim_model);
+    if (trace_level != "")
+        scaleSim->set_trace_level(trace_level);
+    if (result_cache_dir != "")
+        scaleSim->set_result_cache_dir(result_cache_dir);
+    if (fold_extrapolation >= 0)
+        scaleSim->set_fold_extrapolation(fold_extrapolation);
+    if (profiling)
+        scaleSim->set_profiling(true);
+    if (pipeline_depth >= 0)
+        scaleSim->set_pipeline_depth(pipeline_depth);
+
+    if (sweep)
+        scaleSim->run_sweep(logpath, sweep_file);
+    else
+        scaleSim->run_scale(logpath);
 
     return 0;
 }
\ No newline at end of file
@@ -35,8 +35,19 @@ typedef struct {
     string partition;
     bool is_always_hit;
     bool is_bypassing;
+    int num_mshr;
 } LlcConfig;
 
+typedef struct {
+    int num_channels;
+    int num_banks;
+    int64_t row_buffer_bytes;
+    int64_t row_hit_latency;
+    int64_t row_miss_latency;
+    int64_t row_conflict_latency;
+    int64_t bytes_per_cycle;
+} DramConfig;
+
 class Config
 {
 public:
@@ -46,11 +57,14 @@ public:
     MemSizes get_mem_sizes() { return memSizes; }
     MemOffsets get_mem_offsets() { return memOffsets; }
     LlcConfig get_llc_config() { return llcConfig; }
+    DramConfig get_dram_config() { return dramConfig; }
     
     string get_run_name() {return run_name; }
     string get_dataflow() {return df;}
     int64_t get_unified() {return unified;}
     int64_t get_mem_banks() {return memory_banks;}
+    string get_bank_interleave() {return bank_interleave;}
+    MemoryMap *get_memory_map() {return memory_map;}
     int64_t get_bandwidth() {return bandwidth;}
     string get_topology_path() {return topofile;}
     int64_t get_batch_size() {return batch_size;}
@@ -59,6 +73,21 @@ public:
     bool is_use_llc_partition() {return use_llc_partition; }
     int get_num_pe() {return num_pe; }
     bool is_tensor_main_order() {return tensor_main_order; }
+    int get_sim_threads() {return sim_threads; }
+    void set_sim_threads(int sim_threads) {this->sim_threads = sim_threads; }
+    int get_pipeline_depth() {return pipeline_depth; }
+    void set_pipeline_depth(int pipeline_depth) {this->pipeline_depth = pipeline_depth; }
+    string get_sim_model() {return sim_model; }
+    void set_sim_model(string sim_model) {this->sim_model = sim_model; }
+    string get_trace_level() {return trace_level; }
+    void set_trace_level(string trace_level) {this->trace_level = trace_level; }
+    string get_result_cache_dir() {return result_cache_dir; }
+    void set_result_cache_dir(string result_cache_dir) {this->result_cache_dir = result_cache_dir; }
+    int get_fold_extrapolation() {return fold_extrapolation; }
+    void set_fold_extrapolation(int fold_extrapolation) {this->fold_extrapolation = fold_extrapolation; }
+    float get_extrapolation_tolerance() {return extrapolation_tolerance; }
+    bool is_profiling() {return profiling; }
+    void set_profiling(bool profiling) {this->profiling = profiling; }
 
 private:
     string run_name;
@@ -67,6 +96,7 @@ private:
     MemSizes memSizes;
     MemOffsets memOffsets;
     LlcConfig llcConfig;
+    DramConfig dramConfig;
 
     string df;
     int64_t unified;
@@ -74,12 +104,22 @@ private:
     string topofile;
     int64_t bandwidth;
     int64_t memory_banks;
+    string bank_interleave;
+    int64_t bank_page_size;
     int64_t word_size;
     int64_t batch_size;
     bool prefetch_demand;
     bool use_llc_partition;
     int num_pe;
     bool tensor_main_order;
+    int sim_threads;
+    int pipeline_depth;
+    string sim_model;
+    string trace_level;
+    string result_cache_dir;
+    int fold_extrapolation;
+    float extrapolation_tolerance;
+    bool profiling;
 
     int llc_size;
     int llc_assoc;
@@ -113,15 +153,37 @@ Config::Config()
     topofile = "";
     bandwidth = 32;
     memory_banks = 1;
+    bank_interleave = "line";
+    bank_page_size = 4096;
     word_size = 4;
     batch_size = 1;
     num_pe = 1;
+    sim_threads = 1;
+    pipeline_depth = 0;
+    sim_model = "detailed";
+    trace_level = "off";
+    result_cache_dir = "";
+    fold_extrapolation = 0;
+    extrapolation_tolerance = 0.02;
+    profiling = false;
 
     llcConfig.total_size_bytes = 1 * 1024 * 1024;
     llcConfig.cache_line_size = 64;
     llcConfig.hit_latency = 1;
     llcConfig.set_associativity = 4;
     llcConfig.partition = "16";
+    llcConfig.is_always_hit = false;
+    llcConfig.is_bypassing = false;
+    llcConfig.num_mshr = 0;
+
+    // A fixed 40-cycle latency per miss
+    dramConfig.num_channels = 1;
+    dramConfig.num_banks = 1;
+    dramConfig.row_buffer_bytes = 2048;
+    dramConfig.row_hit_latency = 40;
+    dramConfig.row_miss_latency = 40;
+    dramConfig.row_conflict_latency = 40;
+    dramConfig.bytes_per_cycle = 0;
 
     memory_map = new MemoryMap();
 
@@ -151,6 +213,9 @@ void Config::read_conf_file(char *conf_file_in)
     unified = m_data.get<int64_t>("architecture_presets.Unified");
 
     memory_banks = m_data.get<int64_t>("architecture_presets.MemoryBanks");
+    // Spreading of addresses over the memory banks: line, page, or tensor; optional
+    bank_interleave = m_data.get<string>("architecture_presets.BankInterleave", "line");
+    bank_page_size = m_data.get<int64_t>("architecture_presets.BankPageSize", 4096);
     word_size = m_data.get<int64_t>("architecture_presets.WordSize");
     batch_size = m_data.get<int64_t>("architecture_presets.BatchSize");
 
@@ -167,8 +232,37 @@ void Config::read_conf_file(char *conf_file_in)
     llcConfig.partition = m_data.get<string>("llc.Partition");
     llcConfig.is_always_hit = m_data.get<bool>("llc.AlwaysHit");
     llcConfig.is_bypassing = m_data.get<bool>("llc.Bypassing");
+    // Outstanding misses the LLC overlaps, optional; 0 serializes every miss
+    llcConfig.num_mshr = m_data.get<int>("llc.MSHRs", 0);
+
+    // DRAM timing, optional; without a [dram] section every miss takes 40 cycles
+    dramConfig.num_channels = m_data.get<int>("dram.Channels", 1);
+    dramConfig.num_banks = m_data.get<int>("dram.Banks", 1);
+    dramConfig.row_buffer_bytes = m_data.get<int64_t>("dram.RowBufferSize", 2048);
+    dramConfig.row_miss_latency = m_data.get<int64_t>("dram.RowMissLatency", 40);
+    dramConfig.row_hit_latency = m_data.get<int64_t>("dram.RowHitLatency", dramConfig.row_miss_latency);
+    dramConfig.row_conflict_latency = m_data.get<int64_t>("dram.RowConflictLatency", dramConfig.row_miss_latency);
+    dramConfig.bytes_per_cycle = m_data.get<int64_t>("dram.BytesPerCycle", 0);
+
+    // Host threads used to simulate the PEs of a layer, optional
+    sim_threads = m_data.get<int>("run_presets.SimThreads", 1);
+    // Layers prepared ahead on a host thread while the current one is serviced, 0 for none
+    pipeline_depth = m_data.get<int>("run_presets.PipelineDepth", 0);
+    // detailed, analytical, or validate (both, with a comparison report)
+    sim_model = m_data.get<string>("run_presets.Model", "detailed");
+    // Demand trace: off, summary, or full (binary files, read with trace_reader)
+    trace_level = m_data.get<string>("run_presets.Trace", "off");
+    // Directory of the per-layer result cache, used with [llc] AlwaysHit or Bypassing; empty for none
+    result_cache_dir = m_data.get<string>("run_presets.ResultCache", "");
+    // Folds that must agree before the rest of a layer is extrapolated, 0 simulates every fold;
+    // optional, as is the relative tolerance they must agree within
+    fold_extrapolation = m_data.get<int>("run_presets.FoldExtrapolation", 0);
+    extrapolation_tolerance = m_data.get<float>("run_presets.ExtrapolationTolerance", 0.02);
+    // Host time and memory of every layer phase, written to <run_name>_profile.json
+    profiling = m_data.get<bool>("run_presets.Profile", false);
 
     memory_map->set_single_bank_params(memOffsets.filter_offset, memOffsets.ofmap_offset);
+    memory_map->set_bank_params(memory_banks, bank_interleave, llcConfig.cache_line_size, bank_page_size);
 }
 
 
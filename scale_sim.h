@@ -5,6 +5,7 @@
 #include <iostream>
 
 #include "simulator.h"
+#include "sweep.h"
 #include "scale_config.h"
 #include "topology_utils.h"
 
@@ -14,6 +15,13 @@ public:
     ScaleSim(bool verbose, char* config, char* topology, bool input_type_gemm);
     void set_params(char* config_file, char* topology_file);
     void run_scale(char* top_path);
+    void run_sweep(char* top_path, string sweep_file);
+    void set_sim_model(string sim_model) { config->set_sim_model(sim_model); }
+    void set_trace_level(string trace_level) { config->set_trace_level(trace_level); }
+    void set_result_cache_dir(string result_cache_dir) { config->set_result_cache_dir(result_cache_dir); }
+    void set_fold_extrapolation(int fold_extrapolation) { config->set_fold_extrapolation(fold_extrapolation); }
+    void set_profiling(bool profiling) { config->set_profiling(profiling); }
+    void set_pipeline_depth(int pipeline_depth) { config->set_pipeline_depth(pipeline_depth); }
 
 private:
     void run_once();
@@ -56,7 +64,7 @@ void ScaleSim::set_params(char* config_file, char* topology_file)
     this->config_file = config_file;
     this->topology_file = topology_file;
     config->read_conf_file(this->config_file);
-    topology->load_arrays(config, this->topology_file, config->is_prefetch_demand());
+    topology->load_arrays(config, this->topology_file, config->is_prefetch_demand(), read_gemm_inputs);
 }
 
 void ScaleSim::run_scale(char* top_path)
@@ -66,6 +74,25 @@ void ScaleSim::run_scale(char* top_path)
     this->run_once();
 }
 
+void ScaleSim::run_sweep(char* top_path, string sweep_file)
+{
+    this->top_path = top_path;
+    if (sweep_file == "")
+        sweep_file = config->get_run_name() + "_sweep.csv";
+
+    if (verbose_flag)
+    {
+        print_run_configs();
+    }
+
+    DataflowSweep sweep;
+    sweep.set_params(config, topology, top_path, sweep_file);
+    sweep.run();
+
+    run_done_flag = true;
+    logs_generated_flag = true;
+}
+
 void ScaleSim::run_once()
 {
     if (verbose_flag)
@@ -93,6 +120,10 @@ void ScaleSim::print_run_configs()
         df_string = "Weight Stationary";
     else if (df == "is")
         df_string = "Input Stationary";
+    else if (df == "auto")
+        df_string = "CADO, per layer";
+    else if (df == "auto-comp")
+        df_string = "Fewest compute cycles, per layer";
 
     printf("====================================================\n");
     printf("******************* SCALE SIM **********************\n");
@@ -110,8 +141,18 @@ void ScaleSim::print_run_configs()
     printf("Dataflow: \t%s\n", df_string.c_str());
     printf("CSV file path: \t%s\n", this->config->get_topology_path().c_str());
     printf("Number of Remote Memory Banks: \t%ld\n", this->config->get_mem_banks());
+    if (this->config->get_mem_banks() > 1)
+        printf("Bank interleaving: \t%s\n", this->config->get_bank_interleave().c_str());
 
     printf("Bandwidth: \t%ld\n", this->config->get_bandwidth());
+    printf("Timing model: \t%s\n", this->config->get_sim_model().c_str());
+    printf("Demand trace: \t%s\n", this->config->get_trace_level().c_str());
+    if (this->config->get_result_cache_dir() != "")
+        printf("Result cache: \t%s\n", this->config->get_result_cache_dir().c_str());
+    if (this->config->get_fold_extrapolation() > 0)
+        printf("Fold extrapolation: \tafter %d steady folds, tolerance %.3f\n", this->config->get_fold_extrapolation(), this->config->get_extrapolation_tolerance());
+    if (this->config->is_profiling())
+        printf("Host profile: \t%s_profile.json\n", this->config->get_run_name().c_str());
     printf("====================================================\n");
 }
 
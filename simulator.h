@@ -5,29 +5,79 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <chrono>
+#include <future>
+#include <memory>
 
 #include "scale_config.h"
 #include "topology_utils.h"
 #include "layer_sim.h"
+#include "analytical_model.h"
+#include "layer_scheduler.h"
 
 #include "memory/double_buffer_scratchpad_mem.h"
 
 using namespace std;
+using namespace std::chrono;
+
+// Simulator state after some layers: the LLC, the cycle counters of every
+// PE's buffers and the per-layer results so far
+typedef struct
+{
+    LLCState llc_state;
+    vector<BufferState> buffer_states;
+    vector<ComputeStats> layer_compute_stats;
+    vector<LLCStats> layer_llc_stats;
+    vector<vector<MemoryBankStats>> layer_bank_stats;
+    vector<int64_t> layer_host_us;
+    vector<vector<int64_t>> layer_pe_cycles;
+} SimulatorCheckpoint;
 
 class Simulator
 {
 public:
     Simulator();
+    ~Simulator();
+    Simulator(const Simulator &) = delete;
+    Simulator& operator=(const Simulator &) = delete;
     void set_params(Config *config, Topology *topology, char* top_path, bool verbose_flag);
     void run();
 
+    // Per-layer results of the last run; cycles and LLC stats are cumulative
+    // over the layers run so far, as in the printed report
+    vector<ComputeStats> get_layer_compute_stats() { return layer_compute_stats; }
+    vector<LLCStats> get_layer_llc_stats() { return layer_llc_stats; }
+
+    // Layer by layer detailed simulation, for drivers that fork the state:
+    // start_layers, then run_layer in layer order, with checkpoint/restore
+    // between layers. Layers read their dataflow from the topology when run.
+    void start_layers();
+    void run_layer(int64_t layer_id);
+    SimulatorCheckpoint checkpoint();
+    void restore(const SimulatorCheckpoint &checkpoint);
+
 private:
     void generate_reports();
+    void report_layer(ComputeStats comp_items, LLCStats llc_stats);
+    void run_detailed();
+    void run_layers_pipelined(int pipeline_depth);
+    LayerSim *create_layer_sim(int64_t layer_id);
+    void run_layer_sim(LayerSim *layerSim);
+    void run_analytical();
+    void generate_validation_report();
+    void generate_bank_report();
+    void generate_schedule_report();
+    int64_t get_llc_misses(LLCStats stats) { return stats.read_miss_all + stats.write_miss_all; }
+    int64_t get_llc_accesses(LLCStats stats) { return stats.read_hit + stats.write_hit + get_llc_misses(stats); }
     void get_total_cycles();
 
     Config *config;
     Topology *topology;
     vector<DoubleBuffer*> memory_system;
+    ThreadPool *thread_pool;
+    TraceSink *trace_sink;
+    LayerResultCache *result_cache;
+    HostProfiler *profiler;
 
     ofstream ofs;
     
@@ -37,6 +87,12 @@ private:
     int64_t num_layers;
 
     vector<LayerSim *> single_layer_sim_object_list;
+    vector<ComputeStats> layer_compute_stats;
+    vector<LLCStats> layer_llc_stats;
+    vector<vector<MemoryBankStats>> layer_bank_stats;
+    vector<int64_t> layer_host_us;
+    // Cycles of each layer on each PE of its PE list
+    vector<vector<int64_t>> layer_pe_cycles;
 
     bool params_set_flag;
     bool all_layer_run_done;
@@ -45,10 +101,24 @@ private:
 Simulator::Simulator()
 {
     num_layers = 0;
+    thread_pool = NULL;
+    trace_sink = NULL;
+    result_cache = NULL;
+    profiler = NULL;
     params_set_flag = false;
     all_layer_run_done = false;
 }
 
+Simulator::~Simulator()
+{
+    for (auto buffer : memory_system)
+        delete buffer;
+    delete thread_pool;
+    delete trace_sink;
+    delete result_cache;
+    delete profiler;
+}
+
 void Simulator::set_params(Config *config, Topology *topology, char* top_path, bool verbose_flag)
 {
     this->config = config;
@@ -115,6 +185,25 @@ void Simulator::set_params(Config *config, Topology *topology, char* top_path, b
         }        
         memory_system.push_back(buffer);
     }
+
+    int sim_threads = min(config->get_sim_threads(), num_pe);
+    if (sim_threads > 1) {
+        cout << "simulating " << num_pe << " PEs on " << sim_threads << " threads" << endl;
+        thread_pool = new ThreadPool(sim_threads);
+    }
+
+    trace_sink = create_trace_sink(parse_trace_level(config->get_trace_level()), config->get_run_name());
+
+    string result_cache_dir = config->get_result_cache_dir();
+    if (result_cache_dir != "") {
+        if (LayerResultCache::is_cacheable(config))
+            result_cache = new LayerResultCache(result_cache_dir);
+        else
+            cout << "Result cache needs [llc] AlwaysHit or Bypassing, layers depend on the LLC state. Not caching" << endl;
+    }
+
+    if (config->is_profiling())
+        profiler = new HostProfiler();
     params_set_flag = true;
 }
 
@@ -136,81 +225,397 @@ void Simulator::run()
     }
 
 
+    layer_compute_stats.clear();
+    layer_llc_stats.clear();
+    layer_pe_cycles.clear();
+
+    if (config->get_sim_model() == "analytical")
+        run_analytical();
+    else
+        run_detailed();
+
+    if (config->get_num_pe() > 1)
+        generate_schedule_report();
+
+    all_layer_run_done = true;
+    // generate_reports();
+    if (verbose) {
+        ofs.close();
+    }
+    
+}
+
+void Simulator::run_detailed()
+{
+    start_layers();
+    int pipeline_depth = config->get_pipeline_depth();
+    if (pipeline_depth > 0 && num_layers > 1) {
+        run_layers_pipelined(pipeline_depth);
+    } else {
+        for (int64_t i = 0; i < num_layers; i++)
+            run_layer(i);
+    }
+
+    if (config->get_fold_extrapolation() > 0) {
+        int64_t extrapolated_folds = 0;
+        int64_t total_folds = 0;
+        int64_t stall_spread = 0;
+        int64_t warmed_layers = 0;
+        for (auto buffer : memory_system) {
+            extrapolated_folds += buffer->get_fold_extrapolator()->get_extrapolated_folds();
+            total_folds += buffer->get_fold_extrapolator()->get_total_folds();
+            stall_spread += buffer->get_fold_extrapolator()->get_stall_spread();
+            warmed_layers += buffer->get_fold_extrapolator()->get_warmed_layers();
+        }
+        printf("Fold extrapolation: %ld of %ld folds extrapolated, stall cycle spread estimate %ld, %ld layer runs started from a warmed LLC\n",
+            extrapolated_folds, total_folds, stall_spread, warmed_layers);
+    }
+
+    if (result_cache != NULL)
+        printf("Result cache %s: %ld layers reused, %ld simulated\n", result_cache->get_cache_dir().c_str(), result_cache->get_hits(), result_cache->get_misses());
+
+    if (profiler != NULL) {
+        profiler->print_summary();
+        profiler->write_json(config->get_run_name() + "_profile.json");
+    }
+
+    if (config->get_sim_model() == "validate")
+        generate_validation_report();
+    if (config->get_mem_banks() > 1)
+        generate_bank_report();
+}
+
+void Simulator::start_layers()
+{
+    layer_compute_stats.clear();
+    layer_llc_stats.clear();
+    layer_host_us.clear();
+    layer_bank_stats.clear();
+    layer_pe_cycles.clear();
+}
+
+void Simulator::run_layer(int64_t layer_id)
+{
+    if (profiler != NULL)
+        profiler->begin_layer(topology->get_layer_name(layer_id), layer_id);
+
+    LayerSim *layerSim = create_layer_sim(layer_id);
+    run_layer_sim(layerSim);
+    delete layerSim;
+}
+
+// While layer i is serviced, a host thread prepares the layers after it, at
+// most pipeline_depth of them, which bounds the memory they hold. Preparing
+// only reads the config, the topology and the buffer sizes; tensor placement
+// and everything touching the LLC or the buffers stays on this thread in
+// layer order, so the results match the serial run. A profile counts the
+// preparation of a layer towards the layer serviced meanwhile.
+void Simulator::run_layers_pipelined(int pipeline_depth)
+{
+    ThreadPool prepare_pool(1);
+    vector<LayerSim *> layer_sims(num_layers, NULL);
+    vector<future<void>> prepared(num_layers);
+    int64_t next_layer = 0;
+
+    for (int64_t i = 0; i < num_layers; i++) {
+        for (; next_layer < num_layers && next_layer <= i + pipeline_depth; next_layer++) {
+            LayerSim *layerSim = create_layer_sim(next_layer);
+            layer_sims[next_layer] = layerSim;
+            // A layer the result cache holds is not simulated
+            if (layerSim->has_cached_result())
+                continue;
+            auto prepare = make_shared<packaged_task<void()>>([layerSim] { layerSim->prepare(); });
+            prepared[next_layer] = prepare->get_future();
+            prepare_pool.submit([prepare] { (*prepare)(); });
+        }
+
+        if (profiler != NULL)
+            profiler->begin_layer(topology->get_layer_name(i), i);
+        if (prepared[i].valid())
+            prepared[i].get();
+        run_layer_sim(layer_sims[i]);
+        delete layer_sims[i];
+        layer_sims[i] = NULL;
+    }
+}
+
+LayerSim *Simulator::create_layer_sim(int64_t layer_id)
+{
+    LayerSim *layerSim = new LayerSim();
+    {
+        ScopedPhaseTimer timer(profiler, HostPhase::SET_PARAMS);
+        layerSim->set_params(layer_id, config, topology, verbose, memory_system);
+    }
+    layerSim->set_thread_pool(thread_pool);
+    layerSim->set_trace_sink(trace_sink);
+    layerSim->set_result_cache(result_cache);
+    layerSim->set_profiler(profiler);
+    return layerSim;
+}
+
+void Simulator::run_layer_sim(LayerSim *layerSim)
+{
+    int64_t layer_id = layerSim->get_layer_id();
+    // single_layer_sim_object_list.push_back(layerSim);
+    if (verbose)
+    {
+        printf("\nRunning Layer %ld\n", layer_id);
+    }
+    // single_layer_sim_object_list[layer_id]->run();
+    vector<int> pe_list = topology->get_layer_pe_list(layer_id);
+    vector<int64_t> pe_cycles;
+    for (int pe : pe_list)
+        pe_cycles.push_back(-memory_system[pe]->get_total_compute_cycles());
+
+    auto layer_start = high_resolution_clock::now();
+    layerSim->run();
+    layer_host_us.push_back(duration_cast<microseconds>(high_resolution_clock::now() - layer_start).count());
+
+    for (int i = 0; i < pe_list.size(); i++)
+        pe_cycles[i] += memory_system[pe_list[i]]->get_total_compute_cycles();
+    layer_pe_cycles.push_back(pe_cycles);
+
+    // auto comp_items = single_layer_sim_object_list[layer_id]->get_compute_report_items();
+    auto comp_items = layerSim->get_compute_report_items();
+    // auto llc_stats = single_layer_sim_object_list[layer_id]->get_llc_stats();
+    auto llc_stats = layerSim->get_llc_stats();
+    layer_compute_stats.push_back(comp_items);
+    layer_llc_stats.push_back(llc_stats);
+    if (config->get_mem_banks() > 1)
+        layer_bank_stats.push_back(memory_system[0]->getLLC()->get_dram()->get_bank_stats());
+
+    if (verbose) {
+        report_layer(comp_items, llc_stats);
+    }
+
+    if (profiler != NULL)
+        profiler->end_layer();
+
+    // delete(single_layer_sim_object_list[layer_id]);
+
+    // delete(single_layer_sim_object_list[layer_id]->operandMatrix);
+    // delete(single_layer_sim_object_list[layer_id]->compute_system);
+    // delete(layerSim);
+}
+
+SimulatorCheckpoint Simulator::checkpoint()
+{
+    SimulatorCheckpoint checkpoint;
+    memory_system[0]->getLLC()->save_state(checkpoint.llc_state);
+    for (auto buffer : memory_system)
+        checkpoint.buffer_states.push_back(buffer->get_state());
+    checkpoint.layer_compute_stats = layer_compute_stats;
+    checkpoint.layer_llc_stats = layer_llc_stats;
+    checkpoint.layer_bank_stats = layer_bank_stats;
+    checkpoint.layer_host_us = layer_host_us;
+    checkpoint.layer_pe_cycles = layer_pe_cycles;
+    return checkpoint;
+}
+
+void Simulator::restore(const SimulatorCheckpoint &checkpoint)
+{
+    memory_system[0]->getLLC()->restore_state(checkpoint.llc_state);
+    for (size_t i = 0; i < memory_system.size(); i++)
+        memory_system[i]->set_state(checkpoint.buffer_states[i]);
+    layer_compute_stats = checkpoint.layer_compute_stats;
+    layer_llc_stats = checkpoint.layer_llc_stats;
+    layer_bank_stats = checkpoint.layer_bank_stats;
+    layer_host_us = checkpoint.layer_host_us;
+    layer_pe_cycles = checkpoint.layer_pe_cycles;
+}
+
+void Simulator::run_analytical()
+{
+    AnalyticalModel model;
+    model.set_params(config, topology);
+
+    // Accumulate like the detailed reports, which sum over the layers run so far
+    ComputeStats comp_items = {0, 0, 0.0f, 0.0f};
+    LLCStats llc_stats = {0, 0, 0, 0, 0, 0};
+
     for (int64_t i = 0; i < num_layers; i++)
     {
-        LayerSim layerSim;
-        layerSim.set_params(i, config, topology, verbose, memory_system);
-        // single_layer_sim_object_list.push_back(layerSim);
         if (verbose)
-        {
-            // int64_t layer_id = single_layer_sim_object_list[i]->get_layer_id();
-            int64_t layer_id = layerSim.get_layer_id();
-            printf("\nRunning Layer %ld\n", layer_id);
-        }
-        // single_layer_sim_object_list[i]->run();
-        layerSim.run();
+            printf("\nRunning Layer %ld\n", i);
+
+        AnalyticalLayerStats layer_stats = model.run_layer(i);
+
+        comp_items.comp_cycles += layer_stats.comp_cycles;
+        comp_items.stall_cycles += layer_stats.stall_cycles;
+        comp_items.util = layer_stats.util;
+        comp_items.mapping_eff = layer_stats.mapping_eff;
+
+        llc_stats.read_hit += layer_stats.llc_reads - layer_stats.llc_read_misses;
+        llc_stats.read_miss_conflict += layer_stats.llc_read_misses;
+        llc_stats.read_miss_all += layer_stats.llc_read_misses;
+        llc_stats.write_hit += layer_stats.llc_writes - layer_stats.llc_write_misses;
+        llc_stats.write_miss_conflict += layer_stats.llc_write_misses;
+        llc_stats.write_miss_all += layer_stats.llc_write_misses;
+
+        layer_compute_stats.push_back(comp_items);
+        layer_llc_stats.push_back(llc_stats);
+        // The PEs of a layer split its work evenly
+        int64_t num_layer_pes = topology->get_layer_pe_list(i).size();
+        layer_pe_cycles.push_back(vector<int64_t>(num_layer_pes, layer_stats.comp_cycles / num_layer_pes));
 
         if (verbose) {
-            // auto comp_items = single_layer_sim_object_list[i]->get_compute_report_items();
-            auto comp_items = layerSim.get_compute_report_items();
-            int64_t comp_cycles = comp_items.comp_cycles;
-            int64_t stall_cycles = comp_items.stall_cycles;
-            float util = comp_items.util;
-            float mapping_eff = comp_items.mapping_eff;
-            printf("Compute cycles: %ld\n", comp_cycles);
-            printf("Stall cycles: %ld\n", stall_cycles);
-            printf("Overall utilization: %.2f\n", util);
-            printf("Mapping efficiency: %.2f\n", mapping_eff);
-
-            // auto llc_stats = single_layer_sim_object_list[i]->get_llc_stats();
-            auto llc_stats = layerSim.get_llc_stats();
-
-            int64_t read_hit = llc_stats.read_hit;
-            int64_t read_miss_conflict = llc_stats.read_miss_conflict;
-            int64_t read_miss_all = llc_stats.read_miss_all;
-
-            int64_t write_hit = llc_stats.write_hit;
-            int64_t write_miss_conflict = llc_stats.write_miss_conflict;
-            int64_t write_miss_all = llc_stats.write_miss_all;
-
-            string llc_str = "";
-            llc_str += to_string(read_hit);
-            llc_str += ",";
-            llc_str += to_string(read_miss_conflict);
-            llc_str += ",";
-            llc_str += to_string(read_miss_all);
-            llc_str += ",";
-            llc_str += to_string(write_hit);
-            llc_str += ",";
-            llc_str += to_string(write_miss_conflict);
-            llc_str += ",";
-            llc_str += to_string(write_miss_all);
-
-            ofs << llc_str << endl;
-
-            // auto avg_bw_items = single_layer_obj.get_bandwidth_report_items();
-            // float avg_ifmap_bw = avg_bw_items.avg_ifmap_bw;
-            // float avg_filter_bw = avg_bw_items.avg_filter_bw;
-            // float avg_ofmap_bw = avg_bw_items.avg_ofmap_bw;
-
-            // printf("Average IFMAP DRAM BW: %.3f words/cycle\n", avg_ifmap_bw);
-            // printf("Average Filter DRAM BW: %.3f words/cycle\n", avg_filter_bw);
-            // printf("Average OFMAP DRAM BW: %.3f words/cycle\n", avg_ofmap_bw);
+            printf("Folds: %ld, fold rows: %ld, fill/drain cycles: %ld\n", layer_stats.num_folds, layer_stats.fold_rows, layer_stats.fill_drain_cycles);
+            report_layer(comp_items, llc_stats);
+        }
+    }
+}
+
+// Per-layer detailed results next to the analytical estimate of the same
+// layer, with the host time each one took.
+void Simulator::generate_validation_report()
+{
+    AnalyticalModel model;
+    model.set_params(config, topology);
+
+    string file_name = config->get_run_name() + "_validation.csv";
+    ofstream report(file_name);
+    report << "Layer name,Dataflow,Detailed cycles,Analytical cycles,Cycle error %,Detailed stall cycles,Analytical stall cycles,"
+           << "Detailed LLC accesses,Analytical LLC accesses,Detailed LLC misses,Analytical LLC misses,Detailed us,Analytical us" << endl;
+
+    float total_abs_err = 0.0f;
+    int64_t detailed_total = 0;
+    int64_t analytical_total = 0;
+
+    for (int64_t i = 0; i < num_layers; i++)
+    {
+        auto layer_start = high_resolution_clock::now();
+        AnalyticalLayerStats layer_stats = model.run_layer(i);
+        int64_t analytical_us = duration_cast<microseconds>(high_resolution_clock::now() - layer_start).count();
+
+        // Detailed stats are cumulative, take the difference to the previous layer
+        int64_t detailed_cycles = layer_compute_stats[i].comp_cycles;
+        int64_t detailed_stalls = layer_compute_stats[i].stall_cycles;
+        int64_t detailed_misses = get_llc_misses(layer_llc_stats[i]);
+        int64_t detailed_accesses = get_llc_accesses(layer_llc_stats[i]);
+        if (i > 0) {
+            detailed_cycles -= layer_compute_stats[i - 1].comp_cycles;
+            detailed_stalls -= layer_compute_stats[i - 1].stall_cycles;
+            detailed_misses -= get_llc_misses(layer_llc_stats[i - 1]);
+            detailed_accesses -= get_llc_accesses(layer_llc_stats[i - 1]);
         }
 
-        // delete(single_layer_sim_object_list[i]);
+        float err = detailed_cycles > 0 ? (float)(layer_stats.comp_cycles - detailed_cycles) * 100 / detailed_cycles : 0.0f;
+        total_abs_err += fabs(err);
+        detailed_total += detailed_cycles;
+        analytical_total += layer_stats.comp_cycles;
+
+        report << topology->get_layer_name(i) << "," << topology->get_layer_dataflow(i) << ","
+               << detailed_cycles << "," << layer_stats.comp_cycles << "," << err << ","
+               << detailed_stalls << "," << layer_stats.stall_cycles << ","
+               << detailed_accesses << "," << layer_stats.llc_reads + layer_stats.llc_writes << ","
+               << detailed_misses << "," << layer_stats.llc_read_misses + layer_stats.llc_write_misses << ","
+               << layer_host_us[i] << "," << analytical_us << endl;
+    }
+    report.close();
+
+    float total_err = detailed_total > 0 ? (float)(analytical_total - detailed_total) * 100 / detailed_total : 0.0f;
+    printf("Validation report written to %s\n", file_name.c_str());
+    printf("Analytical model: mean abs layer error %.2f%%, total cycle error %.2f%%\n", num_layers > 0 ? total_abs_err / num_layers : 0.0f, total_err);
+}
 
-        // delete(single_layer_sim_object_list[i]->operandMatrix);
-        // delete(single_layer_sim_object_list[i]->compute_system);
-        // delete(layerSim);
+// Traffic of each memory bank per layer. Utilization is the share of the
+// layer's cycles the bank had a miss in service; stall cycles are the
+// cycles misses waited for a busy bank or channel.
+void Simulator::generate_bank_report()
+{
+    string file_name = config->get_run_name() + "_banks.csv";
+    ofstream report(file_name);
+    report << "Layer name,Bank,Requests,Stall cycles,Busy cycles,Utilization %" << endl;
+
+    int64_t num_banks = config->get_mem_banks();
+    for (int64_t i = 0; i < num_layers; i++)
+    {
+        // Stats are cumulative, take the difference to the previous layer
+        int64_t layer_cycles = layer_compute_stats[i].comp_cycles;
+        if (i > 0)
+            layer_cycles -= layer_compute_stats[i - 1].comp_cycles;
+
+        for (int64_t bank = 0; bank < num_banks; bank++)
+        {
+            MemoryBankStats stats = layer_bank_stats[i][bank];
+            if (i > 0) {
+                stats.requests -= layer_bank_stats[i - 1][bank].requests;
+                stats.stall_cycles -= layer_bank_stats[i - 1][bank].stall_cycles;
+                stats.busy_cycles -= layer_bank_stats[i - 1][bank].busy_cycles;
+            }
+            float util = layer_cycles > 0 ? (float)stats.busy_cycles * 100 / layer_cycles : 0.0f;
+            report << topology->get_layer_name(i) << "," << bank << "," << stats.requests << ","
+                   << stats.stall_cycles << "," << stats.busy_cycles << "," << util << endl;
+        }
     }
+    report.close();
 
-    all_layer_run_done = true;
-    // generate_reports();
-    if (verbose) {
-        ofs.close();
+    printf("Memory bank report written to %s\n", file_name.c_str());
+    if (num_layers > 0) {
+        for (int64_t bank = 0; bank < num_banks; bank++)
+            printf("Memory bank %ld: %ld requests, %ld stall cycles\n", bank,
+                layer_bank_stats.back()[bank].requests, layer_bank_stats.back()[bank].stall_cycles);
     }
-    
+}
+
+// Per-PE timelines of the layers scheduled as a DAG over the PEs
+void Simulator::generate_schedule_report()
+{
+    if (layer_pe_cycles.size() != num_layers)
+        return;
+
+    LayerScheduler scheduler;
+    scheduler.set_params(topology, config->get_num_pe());
+    for (int64_t i = 0; i < num_layers; i++)
+        scheduler.set_layer_cycles(i, layer_pe_cycles[i]);
+    scheduler.schedule();
+
+    scheduler.print_summary();
+    scheduler.write_report(config->get_run_name() + "_schedule.csv");
+}
+
+void Simulator::report_layer(ComputeStats comp_items, LLCStats llc_stats)
+{
+    int64_t comp_cycles = comp_items.comp_cycles;
+    int64_t stall_cycles = comp_items.stall_cycles;
+    float util = comp_items.util;
+    float mapping_eff = comp_items.mapping_eff;
+    printf("Compute cycles: %ld\n", comp_cycles);
+    printf("Stall cycles: %ld\n", stall_cycles);
+    printf("Overall utilization: %.2f\n", util);
+    printf("Mapping efficiency: %.2f\n", mapping_eff);
+
+    int64_t read_hit = llc_stats.read_hit;
+    int64_t read_miss_conflict = llc_stats.read_miss_conflict;
+    int64_t read_miss_all = llc_stats.read_miss_all;
+
+    int64_t write_hit = llc_stats.write_hit;
+    int64_t write_miss_conflict = llc_stats.write_miss_conflict;
+    int64_t write_miss_all = llc_stats.write_miss_all;
+
+    string llc_str = "";
+    llc_str += to_string(read_hit);
+    llc_str += ",";
+    llc_str += to_string(read_miss_conflict);
+    llc_str += ",";
+    llc_str += to_string(read_miss_all);
+    llc_str += ",";
+    llc_str += to_string(write_hit);
+    llc_str += ",";
+    llc_str += to_string(write_miss_conflict);
+    llc_str += ",";
+    llc_str += to_string(write_miss_all);
+
+    ofs << llc_str << endl;
+
+    // auto avg_bw_items = single_layer_obj.get_bandwidth_report_items();
+    // float avg_ifmap_bw = avg_bw_items.avg_ifmap_bw;
+    // float avg_filter_bw = avg_bw_items.avg_filter_bw;
+    // float avg_ofmap_bw = avg_bw_items.avg_ofmap_bw;
+
+    // printf("Average IFMAP DRAM BW: %.3f words/cycle\n", avg_ifmap_bw);
+    // printf("Average Filter DRAM BW: %.3f words/cycle\n", avg_filter_bw);
+    // printf("Average OFMAP DRAM BW: %.3f words/cycle\n", avg_ofmap_bw);
 }
 
 void Simulator::generate_reports()
@@ -220,9 +625,9 @@ void Simulator::generate_reports()
     myfile.open (file_name);
     myfile << "Layer name,ifmap_op_mat_H,ifmap_op_mat_W,filter_op_mat_H,filter_op_mat_W,ofmap_op_mat_H,ofmap_op_mat_W" << endl;
     for (int64_t i = 0; i < num_layers; i++) {
-        xt::xarray<int64_t> ifmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ifmap_matrix();
-        xt::xarray<int64_t> filter_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_filter_matrix();
-        xt::xarray<int64_t> ofmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ofmap_matrix();  
+        OperandView ifmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ifmap_view();
+        OperandView filter_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_filter_view();
+        OperandView ofmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ofmap_view();
 
         string layer_name = topology->get_layer_name(i);
 
@@ -253,9 +658,9 @@ void Simulator::generate_reports()
     myfile.open (file_name);
     myfile << "group,,IS,OS,WS" << endl;
     for (int64_t i = 0; i < num_layers; i++) {
-        xt::xarray<int64_t> ifmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ifmap_matrix();
-        xt::xarray<int64_t> filter_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_filter_matrix();
-        xt::xarray<int64_t> ofmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ofmap_matrix();  
+        OperandView ifmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ifmap_view();
+        OperandView filter_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_filter_view();
+        OperandView ofmap_op_mat = single_layer_sim_object_list[i]->getOperandMatrix()->get_ofmap_view();
 
         string layer_name = topology->get_layer_name(i);
 
@@ -0,0 +1,255 @@
+#ifndef _sweep_h
+#define _sweep_h
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <atomic>
+
+#include "scale_config.h"
+#include "topology_utils.h"
+#include "simulator.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// Simulates every combination of os/ws/is over the CONV layers of a topology
+// in one process. The config and topology are parsed once. Combinations
+// sharing their first layers share the simulation of those layers: the
+// dataflow tree is walked depth first and the simulator state is forked
+// after every swept layer, so 3^N combinations cost about 1.5 * 3^N layer
+// simulations instead of N * 3^N. The subtrees below the first few swept
+// layers run on [run_presets] SimThreads threads, each with its own LLC, so
+// the results do not depend on the thread count. One row per combination is
+// written to the results table.
+class DataflowSweep
+{
+public:
+    DataflowSweep();
+    void set_params(Config *config, Topology *topology, char* top_path, string sweep_file);
+    void run();
+
+private:
+    void run_subtree(int64_t prefix_id);
+    // Walks the dataflows of sweep layers k and up, from the state after the
+    // layers before sweep layer k; combination_id holds the earlier choices
+    void explore(Simulator &simulator, Topology &combination_topology, int64_t k, int64_t combination_id);
+    void run_layers(Simulator &simulator, int64_t start_layer, int64_t end_layer);
+    // First layer after the sweep layers before k
+    int64_t get_layers_before(int64_t k);
+    string get_dataflow(int64_t combination_id, int64_t sweep_layer_id);
+    void write_results();
+
+    Config *config;
+    Config combination_config;
+    Topology *topology;
+    char* top_path;
+    string sweep_file;
+
+    vector<int64_t> sweep_layers;
+    int64_t num_combinations;
+    // Sweep layers whose dataflows are fixed per thread task
+    int64_t num_prefix_layers;
+    atomic<int64_t> simulated_layers;
+
+    vector<vector<ComputeStats>> compute_results;
+    vector<vector<LLCStats>> llc_results;
+
+    // Same order as brute-force/generate.py, the first layer varies fastest
+    string dataflow_list[3] = {"os", "ws", "is"};
+};
+
+DataflowSweep::DataflowSweep()
+{
+    num_combinations = 0;
+    num_prefix_layers = 0;
+    simulated_layers = 0;
+}
+
+void DataflowSweep::set_params(Config *config, Topology *topology, char* top_path, string sweep_file)
+{
+    this->config = config;
+    this->topology = topology;
+    this->top_path = top_path;
+    this->sweep_file = sweep_file;
+
+    // Threads are spent on combinations, each simulation runs its PEs serially
+    combination_config = *config;
+    combination_config.set_sim_threads(1);
+    // Combinations would overwrite each other's trace files and profiles
+    combination_config.set_trace_level("off");
+    combination_config.set_profiling(false);
+    if (combination_config.get_sim_model() == "validate")
+        combination_config.set_sim_model("detailed");
+
+    sweep_layers.clear();
+    num_combinations = 1;
+    for (int64_t i = 0; i < topology->get_num_layers(); i++) {
+        if (topology->get_layer_type(i) == CONV) {
+            sweep_layers.push_back(i);
+            num_combinations *= 3;
+        }
+    }
+
+    compute_results.assign(num_combinations, vector<ComputeStats>());
+    llc_results.assign(num_combinations, vector<LLCStats>());
+
+    // Enough subtrees to keep every thread busy
+    num_prefix_layers = 0;
+    int64_t num_subtrees = 1;
+    while (num_subtrees < config->get_sim_threads() && num_prefix_layers < sweep_layers.size()) {
+        num_prefix_layers++;
+        num_subtrees *= 3;
+    }
+
+    // Tensor bank placement is shared by all simulations, fix it before they run
+    for (int64_t i = 0; i < topology->get_num_layers(); i++)
+        LayerSim::place_tensors(config, topology, i);
+}
+
+int64_t DataflowSweep::get_layers_before(int64_t k)
+{
+    return k < sweep_layers.size() ? sweep_layers[k] : topology->get_num_layers();
+}
+
+string DataflowSweep::get_dataflow(int64_t combination_id, int64_t sweep_layer_id)
+{
+    for (int64_t k = 0; k < sweep_layer_id; k++)
+        combination_id /= 3;
+    return dataflow_list[combination_id % 3];
+}
+
+void DataflowSweep::run_subtree(int64_t prefix_id)
+{
+    Topology combination_topology = *topology;
+    for (int64_t k = 0; k < num_prefix_layers; k++)
+        combination_topology.set_layer_dataflow(sweep_layers[k], get_dataflow(prefix_id, k));
+
+    Simulator simulator;
+    simulator.set_params(&combination_config, &combination_topology, top_path, false);
+    simulator.start_layers();
+    run_layers(simulator, 0, get_layers_before(num_prefix_layers));
+    explore(simulator, combination_topology, num_prefix_layers, prefix_id);
+}
+
+void DataflowSweep::explore(Simulator &simulator, Topology &combination_topology, int64_t k, int64_t combination_id)
+{
+    if (k == sweep_layers.size()) {
+        compute_results[combination_id] = simulator.get_layer_compute_stats();
+        llc_results[combination_id] = simulator.get_layer_llc_stats();
+        return;
+    }
+
+    int64_t digit_weight = 1;
+    for (int64_t i = 0; i < k; i++)
+        digit_weight *= 3;
+
+    SimulatorCheckpoint checkpoint = simulator.checkpoint();
+    for (int d = 0; d < 3; d++) {
+        if (d > 0)
+            simulator.restore(checkpoint);
+        combination_topology.set_layer_dataflow(sweep_layers[k], dataflow_list[d]);
+        run_layers(simulator, sweep_layers[k], get_layers_before(k + 1));
+        explore(simulator, combination_topology, k + 1, combination_id + d * digit_weight);
+    }
+}
+
+void DataflowSweep::run_layers(Simulator &simulator, int64_t start_layer, int64_t end_layer)
+{
+    for (int64_t i = start_layer; i < end_layer; i++)
+        simulator.run_layer(i);
+    simulated_layers += end_layer - start_layer;
+}
+
+void DataflowSweep::run()
+{
+    int sim_threads = config->get_sim_threads();
+    printf("Sweeping %ld dataflow combinations of %ld layers on %d threads\n", num_combinations, sweep_layers.size(), sim_threads);
+
+    // The per-run logs of concurrent simulations are interleaved and
+    // meaningless, only the results table is kept
+    ofstream null_stream("/dev/null");
+    streambuf *cout_buf = cout.rdbuf(null_stream.rdbuf());
+
+    int64_t num_subtrees = 1;
+    for (int64_t k = 0; k < num_prefix_layers; k++)
+        num_subtrees *= 3;
+
+    if (sim_threads > 1) {
+        ThreadPool thread_pool(sim_threads);
+        for (int64_t i = 0; i < num_subtrees; i++)
+            thread_pool.submit([this, i] { run_subtree(i); });
+        thread_pool.wait();
+    } else {
+        for (int64_t i = 0; i < num_subtrees; i++)
+            run_subtree(i);
+    }
+
+    cout.rdbuf(cout_buf);
+
+    printf("Simulated %ld layers for %ld combinations of %ld layers\n", (int64_t)simulated_layers, num_combinations, topology->get_num_layers());
+
+    write_results();
+}
+
+void DataflowSweep::write_results()
+{
+    int64_t num_layers = topology->get_num_layers();
+
+    ofstream ofs(sweep_file);
+    ofs << "Dataflows";
+    for (int64_t k = 0; k < sweep_layers.size(); k++)
+        ofs << "," << topology->get_layer_name(sweep_layers[k]);
+    ofs << ",Compute cycles,Stall cycles,Total cycles,readHit,readMissConflict,readMissAll,writeHit,writeMissConflict,writeMissAll";
+    for (int64_t i = 0; i < num_layers; i++)
+        ofs << "," << topology->get_layer_name(i) << " cycles";
+    ofs << endl;
+
+    int64_t best_combination_id = 0;
+    int64_t best_total_cycles = -1;
+
+    for (int64_t c = 0; c < num_combinations; c++) {
+        vector<ComputeStats> &comp_items = compute_results[c];
+        if (comp_items.empty())
+            continue;
+
+        // Cycles are reported cumulatively, the last layer holds the totals
+        int64_t total_cycles = comp_items.back().comp_cycles;
+        int64_t stall_cycles = comp_items.back().stall_cycles;
+        LLCStats llc_stats = llc_results[c].back();
+
+        string dataflows = "";
+        for (int64_t k = 0; k < sweep_layers.size(); k++)
+            dataflows += get_dataflow(c, k);
+
+        ofs << dataflows;
+        for (int64_t k = 0; k < sweep_layers.size(); k++)
+            ofs << "," << get_dataflow(c, k);
+        ofs << "," << total_cycles - stall_cycles << "," << stall_cycles << "," << total_cycles;
+        ofs << "," << llc_stats.read_hit << "," << llc_stats.read_miss_conflict << "," << llc_stats.read_miss_all;
+        ofs << "," << llc_stats.write_hit << "," << llc_stats.write_miss_conflict << "," << llc_stats.write_miss_all;
+
+        int64_t last_cycles = 0;
+        for (int64_t i = 0; i < comp_items.size(); i++) {
+            ofs << "," << comp_items[i].comp_cycles - last_cycles;
+            last_cycles = comp_items[i].comp_cycles;
+        }
+        ofs << endl;
+
+        if (best_total_cycles == -1 || total_cycles < best_total_cycles) {
+            best_total_cycles = total_cycles;
+            best_combination_id = c;
+        }
+    }
+    ofs.close();
+
+    string best_dataflows = "";
+    for (int64_t k = 0; k < sweep_layers.size(); k++)
+        best_dataflows += get_dataflow(best_combination_id, k);
+
+    printf("Sweep results written to %s\n", sweep_file.c_str());
+    printf("Best dataflows: %s, total cycles: %ld\n", best_dataflows.c_str(), best_total_cycles);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef _thread_pool_h
+#define _thread_pool_h
+
+#include <vector>
+#include <queue>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// Fixed set of worker threads draining a FIFO of tasks. wait() blocks until
+// every submitted task has finished.
+class ThreadPool
+{
+public:
+    ThreadPool(int num_threads);
+    ~ThreadPool();
+    void submit(function<void()> task);
+    void wait();
+    int get_num_threads() { return workers.size(); }
+
+private:
+    void worker();
+
+    vector<thread> workers;
+    queue<function<void()>> tasks;
+
+    mutex queue_mutex;
+    condition_variable task_cv;
+    condition_variable done_cv;
+
+    int64_t num_pending;
+    bool stopping;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+{
+    num_pending = 0;
+    stopping = false;
+
+    for (int i = 0; i < num_threads; i++)
+        workers.push_back(thread(&ThreadPool::worker, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    task_cv.notify_all();
+
+    for (auto &t : workers)
+        t.join();
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        tasks.push(task);
+        num_pending++;
+    }
+    task_cv.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    unique_lock<mutex> lock(queue_mutex);
+    done_cv.wait(lock, [this] { return num_pending == 0; });
+}
+
+void ThreadPool::worker()
+{
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            task_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty())
+                return;
+            task = tasks.front();
+            tasks.pop();
+        }
+
+        task();
+
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            num_pending--;
+            if (num_pending == 0)
+                done_cv.notify_all();
+        }
+    }
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <string>
+#include <cmath>
+#include <algorithm>
 #include "csv.h"
 
 #include "scale_config.h"
@@ -42,6 +44,14 @@ typedef struct
     int64_t filter_offset_end;
     int64_t ofmap_offset_end;
     vector<int> pe_list;
+    // Layers this one reads its ifmap or filter from
+    vector<int> producers;
+
+    // Operand layouts, as an M x K ifmap and a K x N filter. Conv layers are
+    // im2col'd: row-major ifmap and one window-sized column per filter.
+    bool is_gemm;
+    bool ifmap_col_major;
+    bool filter_col_major;
 } LayerInfo;
 
 typedef struct
@@ -61,6 +71,10 @@ typedef struct
 
 // Layer name, IFMAP Height, IFMAP Width, Filter Height, Filter Width, Channels, Num Filter, Stride Height, Stride Width, IFMAP Offset, Filter Offset, OFMAP Offset,
 // Conv1, 224, 224, 11, 11, 3, 96, 4, 4, 0, 10000000, 20000000,
+// GEMM topologies (mnk_inputs) are described at load_arrays_gemm
+//
+// A Dataflow of auto or auto-comp, in the topology or in the config of a
+// unified run, is replaced at load time by the choice of select_dataflow.
 
 class Topology
 {
@@ -87,7 +101,15 @@ public:
     int64_t get_layer_type(int64_t layer_id) { return topo_arrays[layer_id].type; }
     string get_layer_name(int64_t layer_id) { return topo_arrays[layer_id].name; }
     string get_layer_dataflow(int64_t layer_id) {return topo_arrays[layer_id].dataflow;}
+    void set_layer_dataflow(int64_t layer_id, string dataflow) {topo_arrays[layer_id].dataflow = dataflow;}
     vector<int> get_layer_pe_list(int64_t layer_id) { return topo_arrays[layer_id].pe_list; }
+    vector<int> get_layer_producers(int64_t layer_id) { return topo_arrays[layer_id].producers; }
+    // The CADO dataflow of a layer, or with cache_aware false the one with the
+    // fewest compute cycles (generateCADO and generateCOMP of CADOSys/generate.py)
+    string select_dataflow(int64_t layer_id, bool cache_aware);
+    bool is_layer_gemm(int64_t layer_id) { return topo_arrays[layer_id].is_gemm; }
+    bool is_layer_ifmap_col_major(int64_t layer_id) { return topo_arrays[layer_id].ifmap_col_major; }
+    bool is_layer_filter_col_major(int64_t layer_id) { return topo_arrays[layer_id].filter_col_major; }
 
 private:
     Config *config;
@@ -102,8 +124,14 @@ private:
     bool topo_calc_hyper_param_flag = false;
     bool topo_calc_spatiotemp_params_flag = false;
 
-    void load_arrays_gemm(char *topofile);
+    void load_arrays_gemm(char *topofile, bool is_prefetch);
     void load_arrays_conv(char *topofile, bool is_prefetch);
+
+    vector<int> parse_id_list(string ids);
+    void resolve_auto_dataflows();
+    bool parse_gemm_layout(string layer_name, string layout);
+    void place_layer(LayerInfo &info, CalcLayerInfo &calcinfo, vector<int> ifmap_source_list, vector<int> filter_source_list,
+                     bool is_tensor_main_order, bool is_prefetch_demand, int64_t &initial_ifmap_offset);
 };
 
 Topology::Topology()
@@ -123,7 +151,7 @@ void Topology::load_arrays(Config *config, char *topofile, bool is_prefetch_dema
     this->config = config;
     if (mnk_inputs)
     {
-        load_arrays_gemm(topofile);
+        load_arrays_gemm(topofile, is_prefetch_demand);
     }
     else
     {
@@ -131,21 +159,84 @@ void Topology::load_arrays(Config *config, char *topofile, bool is_prefetch_dema
     }
 }
 
-void Topology::load_arrays_gemm(char *topofile)
+// Layer name, M, N, K, A Source, B Source, PE, Dataflow, A Layout, B Layout
+// QKT, 8, 8, 1024, 0, 1, 0, ws, row, col
+//
+// C (M x N) = A (M x K) x B (K x N). A is read as the ifmap, B as the filter
+// and C is written row-major as the ofmap. A Layout and B Layout are row or
+// col and default to row; Dataflow defaults to the config's dataflow and is
+// ignored in unified runs, like for conv topologies.
+void Topology::load_arrays_gemm(char *topofile, bool is_prefetch_demand)
 {
-    return;
+    int64_t initial_ifmap_offset = config->get_mem_offsets().ifmap_offset;
+    int64_t unified = config->get_unified();
+    bool is_tensor_main_order = unified || config->is_tensor_main_order();
+
+    string name;
+    int64_t m;
+    int64_t n;
+    int64_t k;
+    string ifmap_sources;
+    string filter_sources;
+    string pes;
+    string dataflow;
+    string ifmap_layout;
+    string filter_layout;
+
+    csv::CSVReader<10> in(topofile);
+    in.read_header(csv::ignore_extra_column | csv::ignore_missing_column, "Layer name", "M", "N", "K", "A Source", "B Source", "PE",
+                "Dataflow", "A Layout", "B Layout");
+
+    while (true)
+    {
+        ifmap_sources = "-1";
+        filter_sources = "-1";
+        pes = "0";
+        dataflow = config->get_dataflow();
+        ifmap_layout = "row";
+        filter_layout = "row";
+        if (!in.read_row(name, m, n, k, ifmap_sources, filter_sources, pes, dataflow, ifmap_layout, filter_layout))
+            break;
+
+        // Same fields as a 1x1 convolution over an M x 1 ifmap with K
+        // channels and N filters, so stats and models need no GEMM case
+        LayerInfo info;
+
+        info.name = name;
+        info.type = CONV;
+        info.ifmap_height = m;
+        info.ifmap_width = 1;
+        info.filter_height = 1;
+        info.filter_width = 1;
+        info.channels = k;
+        info.num_filer = n;
+        info.stride_height = 1;
+        info.stride_width = 1;
+        info.dataflow = unified ? config->get_dataflow() : dataflow;
+        info.pe_list = parse_id_list(pes);
+
+        info.is_gemm = true;
+        info.ifmap_col_major = parse_gemm_layout(name, ifmap_layout);
+        info.filter_col_major = parse_gemm_layout(name, filter_layout);
+
+        CalcLayerInfo calcinfo;
+        calcinfo.ofmap_height = m;
+        calcinfo.ofmap_width = 1;
+        calcinfo.num_mac = m * n * k;
+        calcinfo.window_size = k;
+        calc_topo_arrays.push_back(calcinfo);
+
+        place_layer(info, calcinfo, parse_id_list(ifmap_sources), parse_id_list(filter_sources), is_tensor_main_order, is_prefetch_demand, initial_ifmap_offset);
+        topo_arrays.push_back(info);
+    }
+
+    num_layers = topo_arrays.size();
+    resolve_auto_dataflows();
 }
 
 void Topology::load_arrays_conv(char *topofile, bool is_prefetch_demand)
 {
-    auto memoffset = config->get_mem_offsets();
-
-    int64_t initial_ifmap_offset = memoffset.ifmap_offset;
-    int64_t initial_filter_offset = memoffset.filter_offset;
-    int64_t initial_ofmap_offset = memoffset.ofmap_offset;
-
-    int64_t word_size = config->get_word_size();
-    int64_t batch_size = config->get_batch_size();
+    int64_t initial_ifmap_offset = config->get_mem_offsets().ifmap_offset;
 
     bool is_tensor_main_order = config->is_tensor_main_order();
 
@@ -165,346 +256,254 @@ void Topology::load_arrays_conv(char *topofile, bool is_prefetch_demand)
     string filter_sources;
     string pes;
 
-    int64_t filter_offset;
-    int64_t ifmap_offset;
-    int64_t ofmap_offset;
-
-    int64_t ifmap_demand_offset;
-    int64_t filter_demand_offset;
-
-    int64_t filter_offset_end;
-    int64_t ifmap_offset_end;
-    int64_t ofmap_offset_end;
-
-    int64_t ifmap_demand_offset_end;
-    int64_t filter_demand_offset_end;
-
     int64_t unified = config->get_unified();
 
+    csv::CSVReader<14> in(topofile);
     if (!unified) {
-        csv::CSVReader<14> in(topofile);
         in.read_header(csv::ignore_extra_column, "Layer name", "Layer Type", "IFMAP Height", "IFMAP Width", "Filter Height", "Filter Width", "Channels",
                     "Num Filter", "Stride Height", "Stride Width", "IFMAP Source", "Filter Source", "PE", "Dataflow");
+    } else {
+        // The dataflow column is optional and ignored, every layer uses the config's dataflow
+        in.read_header(csv::ignore_extra_column | csv::ignore_missing_column, "Layer name", "Layer Type", "IFMAP Height", "IFMAP Width", "Filter Height", "Filter Width", "Channels",
+                    "Num Filter", "Stride Height", "Stride Width", "IFMAP Source", "Filter Source", "PE", "Dataflow");
+        // Unified runs always place the layers in tensor main order
+        is_tensor_main_order = true;
+    }
 
-        while (in.read_row(name, type, ifmap_height, ifmap_width, filter_height, filter_width, channels, num_filer, stride_height, stride_width, ifmap_sources, filter_sources, pes, dataflow))
-        {
-            LayerInfo info;
-
-            info.name = name;
-            info.type = type;
-            info.ifmap_height = ifmap_height;
-            info.ifmap_width = ifmap_width;
-            info.filter_height = filter_height;
-            info.filter_width = filter_width;
-            info.channels = channels;
-            info.num_filer = num_filer;
-            info.stride_height = stride_height;
-            info.stride_width = stride_height;
-            info.dataflow = dataflow;
-
-            CalcLayerInfo calcinfo;
-            // calcinfo.ofmap_height = (info.ifmap_height - info.filter_height + info.stride_height + info.stride_height - 1) / info.stride_height;
-            // calcinfo.ofmap_width = (info.ifmap_width - info.filter_width + info.stride_width + info.stride_width - 1) / info.stride_width;
-
-            calcinfo.ofmap_height = info.ifmap_height / info.stride_height;
-            calcinfo.ofmap_width = info.ifmap_width / info.stride_width;
-
-            calcinfo.num_mac = calcinfo.ofmap_height * calcinfo.ofmap_width * info.filter_height * info.filter_width * info.channels * info.num_filer;
-            calcinfo.window_size = info.filter_height * info.filter_width * info.channels;
-            calc_topo_arrays.push_back(calcinfo);
-
-
-            vector<string> ifmap_source_str_list;
-            vector<int> ifmap_source_list;
-            stringstream str_ifmap_source(ifmap_sources);
-
-            while (str_ifmap_source.good())
-            {
-                string substr;
-                getline(str_ifmap_source, substr, '_');
-                ifmap_source_str_list.push_back(substr);
-            }
-
-            for (size_t i = 0; i < ifmap_source_str_list.size(); i++)
-            {
-                ifmap_source_list.push_back(stoi(ifmap_source_str_list[i]));
-            }
-
-
-            vector<string> filter_source_str_list;
-            vector<int> filter_source_list;
-            stringstream str_filter_source(filter_sources);
-
-            cout << "filter_sources is " << filter_sources << endl;
-
-            while (str_filter_source.good())
-            {
-                string substr;
-                getline(str_filter_source, substr, '_');
-                filter_source_str_list.push_back(substr);
-            }
-
-            for (size_t i = 0; i < filter_source_str_list.size(); i++)
-            {
-                filter_source_list.push_back(stoi(filter_source_str_list[i]));
-            }
-            
-            vector<string> pe_str_list;
-            vector<int> pe_list;
-            stringstream str_pe(pes);
-
-            while (str_pe.good())
-            {
-                string substr;
-                getline(str_pe, substr, '_');
-                pe_str_list.push_back(substr);
-            }
-
-            for (size_t i = 0; i < pe_str_list.size(); i++)
-            {
-                pe_list.push_back(stoi(pe_str_list[i]));
-            }
-
-            info.pe_list = pe_list;
-
-
-            vector<int64_t> ifmap_offset;
-
-            uint64_t ifmap_size = ifmap_height * ifmap_width * channels * word_size * batch_size * ifmap_source_list.size();
-            uint64_t filter_size = 0;
-            if (type == CONV)
-                filter_size = filter_height * filter_width * channels * num_filer * word_size;
-            uint64_t ofmap_size = calcinfo.ofmap_height * calcinfo.ofmap_width * num_filer * word_size * batch_size;
-
-            uint64_t ifmap_demand_size = calcinfo.ofmap_height * calcinfo.ofmap_width * num_filer * filter_height * filter_width * channels * word_size * batch_size;
-            uint64_t filter_demand_size = filter_height * filter_width * channels * num_filer * word_size * batch_size;
-
-            if (is_tensor_main_order) {
-                if (topo_arrays.size() == 0) {
-                    filter_offset = initial_filter_offset;
-                    ofmap_offset = initial_ifmap_offset + ifmap_size;
-                } else {
-                    filter_offset = topo_arrays[topo_arrays.size() - 1].filter_offset_end;
-                    ofmap_offset = topo_arrays[topo_arrays.size() - 1].ofmap_offset_end;
-                }
-
-                if (ifmap_source_list[0] == -1) {
-                    ifmap_offset.push_back(initial_ifmap_offset);
-                    initial_ifmap_offset += ifmap_size;
-                } else {
-                    for (size_t i = 0; i < ifmap_source_list.size(); i++)
-                    {
-                        ifmap_offset.push_back(topo_arrays[ifmap_source_list[i]].ofmap_offset);
-                    }
-                }
-
-                if (filter_source_list[0] != -1) {
-                    filter_offset = topo_arrays[filter_source_list[0]].ofmap_offset;
-                    filter_size = 0;
-                }
-
-                info.ifmap_offset = ifmap_offset;
-                info.filter_offset = filter_offset;
-                
-                if (is_prefetch_demand) {
-                    info.filter_demand_offset = info.filter_offset + filter_size;
-                    info.filter_offset_end = info.filter_demand_offset + filter_demand_size;
-
-                    info.ofmap_offset = ofmap_offset + ifmap_demand_size;
-                    info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
-                } else {
-                    info.filter_demand_offset = info.filter_offset;
-                    info.filter_offset_end = info.filter_offset + filter_size;
-
-                    info.ofmap_offset = ofmap_offset;
-                    info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
-                }
-            } else {
-                if (ifmap_source_list[0] == -1) {
-                    ifmap_offset.push_back(initial_ifmap_offset);
-                    initial_ifmap_offset += ifmap_size;
-                } else {
-                    for (size_t i = 0; i < ifmap_source_list.size(); i++)
-                    {
-                        ifmap_offset.push_back(topo_arrays[ifmap_source_list[i]].ofmap_offset);
-                    }
-                }
-
-                if (filter_source_list[0] != -1) {
-                    filter_offset = topo_arrays[filter_source_list[0]].ofmap_offset;
-                    ofmap_offset = filter_offset + filter_size;
-                    filter_size = 0;
-                } else {
-                    filter_offset = initial_ifmap_offset + ifmap_size;
-                    ofmap_offset = filter_offset + filter_size;
-                }
-                initial_ifmap_offset += filter_size;
-
-                info.ifmap_offset = ifmap_offset;
-                info.filter_offset = filter_offset;
-                
-                if (is_prefetch_demand) {
-                    info.filter_demand_offset = info.filter_offset + filter_size;
-                    info.filter_offset_end = info.filter_demand_offset + filter_demand_size;
-
-                    info.ofmap_offset = ofmap_offset + ifmap_demand_size;
-                    info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
-                } else {
-                    info.filter_demand_offset = info.filter_offset;
-                    info.filter_offset_end = info.filter_offset + filter_size;
-
-                    info.ofmap_offset = ofmap_offset;
-                    info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
-                }
-                initial_ifmap_offset += ofmap_size;
-            }
-            
-
-            topo_arrays.push_back(info);
+    while (in.read_row(name, type, ifmap_height, ifmap_width, filter_height, filter_width, channels, num_filer, stride_height, stride_width, ifmap_sources, filter_sources, pes, dataflow))
+    {
+        LayerInfo info;
+
+        info.name = name;
+        info.type = type;
+        info.ifmap_height = ifmap_height;
+        info.ifmap_width = ifmap_width;
+        info.filter_height = filter_height;
+        info.filter_width = filter_width;
+        info.channels = channels;
+        info.num_filer = num_filer;
+        info.stride_height = stride_height;
+        info.stride_width = stride_height;
+        info.dataflow = unified ? config->get_dataflow() : dataflow;
+
+        // im2col operands: ifmap rows are ofmap pixels, each filter is one
+        // window-sized column
+        info.is_gemm = false;
+        info.ifmap_col_major = false;
+        info.filter_col_major = true;
+
+        CalcLayerInfo calcinfo;
+        // calcinfo.ofmap_height = (info.ifmap_height - info.filter_height + info.stride_height + info.stride_height - 1) / info.stride_height;
+        // calcinfo.ofmap_width = (info.ifmap_width - info.filter_width + info.stride_width + info.stride_width - 1) / info.stride_width;
+
+        calcinfo.ofmap_height = info.ifmap_height / info.stride_height;
+        calcinfo.ofmap_width = info.ifmap_width / info.stride_width;
+
+        calcinfo.num_mac = calcinfo.ofmap_height * calcinfo.ofmap_width * info.filter_height * info.filter_width * info.channels * info.num_filer;
+        calcinfo.window_size = info.filter_height * info.filter_width * info.channels;
+        calc_topo_arrays.push_back(calcinfo);
+
+        cout << "filter_sources is " << filter_sources << endl;
+
+        info.pe_list = parse_id_list(pes);
+
+        place_layer(info, calcinfo, parse_id_list(ifmap_sources), parse_id_list(filter_sources), is_tensor_main_order, is_prefetch_demand, initial_ifmap_offset);
+        topo_arrays.push_back(info);
+    }
+
+    num_layers = topo_arrays.size();
+    resolve_auto_dataflows();
+}
+
+void Topology::resolve_auto_dataflows()
+{
+    for (int64_t i = 0; i < num_layers; i++) {
+        string dataflow = topo_arrays[i].dataflow;
+        if (dataflow != "auto" && dataflow != "auto-comp")
+            continue;
+        topo_arrays[i].dataflow = select_dataflow(i, dataflow == "auto");
+        cout << "Layer " << topo_arrays[i].name << " " << dataflow << " dataflow is " << topo_arrays[i].dataflow << endl;
+    }
+}
+
+// Operands as an M x K ifmap and a K x N filter. The compute choice is the
+// dataflow with the fewest folds times fold cycles; ties prefer ws, then os.
+// The CADO choice keeps it if its stationary working set fits the LLC minus
+// one way, otherwise takes the first dataflow whose working set fits, then
+// the compute choice or the second best one if a fold's tiles fit, and the
+// compute choice if nothing fits. Pooling layers always use os.
+string Topology::select_dataflow(int64_t layer_id, bool cache_aware)
+{
+    if (topo_arrays[layer_id].type == POOL)
+        return "os";
+
+    int64_t arr_h = config->get_array_dims().arr_h;
+    int64_t arr_w = config->get_array_dims().arr_w;
+    int64_t m = calc_topo_arrays[layer_id].ofmap_height * calc_topo_arrays[layer_id].ofmap_width * config->get_batch_size();
+    int64_t k = calc_topo_arrays[layer_id].window_size;
+    int64_t n = topo_arrays[layer_id].num_filer;
+
+    // Spatial rows x spatial columns x temporal dimension of each dataflow
+    string dataflows[3] = {"ws", "os", "is"};
+    int64_t dims[3][3] = {{k, n, m}, {m, n, k}, {k, m, n}};
+    int64_t ops[3];
+    for (int i = 0; i < 3; i++)
+        ops[i] = ((dims[i][0] + arr_h - 1) / arr_h) * ((dims[i][1] + arr_w - 1) / arr_w) * (dims[i][2] + arr_h - 1);
+
+    int best = 0;
+    for (int i = 1; i < 3; i++) {
+        if (ops[i] < ops[best])
+            best = i;
+    }
+    // The first dataflow whose cycles lie between the other two
+    int second = 2;
+    for (int i = 0; i < 2; i++) {
+        int64_t a = ops[(i + 1) % 3];
+        int64_t b = ops[(i + 2) % 3];
+        if ((ops[i] <= a && ops[i] >= b) || (ops[i] <= b && ops[i] >= a)) {
+            second = i;
+            break;
         }
-    } else {
-        csv::CSVReader<13> in(topofile);
-        in.read_header(csv::ignore_extra_column, "Layer name", "Layer Type", "IFMAP Height", "IFMAP Width", "Filter Height", "Filter Width", "Channels",
-                    "Num Filter", "Stride Height", "Stride Width", "IFMAP Source", "Filter Source", "PE");
+    }
+
+    if (!cache_aware)
+        return dataflows[best];
+
+    LlcConfig llc_config = config->get_llc_config();
+    double num_ways = pow(2, llc_config.set_associativity);
+    double cache_words = llc_config.total_size_bytes * (num_ways - 1) / num_ways / config->get_word_size();
+
+    // Working sets of a whole stationary operand and of one fold's tiles
+    double layer_words[3] = {(double)(n + arr_h) * m, (double)(n + arr_h) * k, (double)(k + arr_h) * n};
+    double fold_words[3] = {(double)(2 * m * arr_h + arr_h * arr_w), (double)(2 * k * arr_h + arr_h * arr_w), (double)(2 * n * arr_h + arr_h * arr_w)};
+
+    if (layer_words[best] <= cache_words)
+        return dataflows[best];
+    int fit_order[3] = {0, 2, 1};
+    for (int i : fit_order) {
+        if (layer_words[i] <= cache_words)
+            return dataflows[i];
+    }
+    if (fold_words[best] <= cache_words)
+        return dataflows[best];
+    if (fold_words[second] <= cache_words)
+        return dataflows[second];
+    return dataflows[best];
+}
+
+// "0_1_2" -> {0, 1, 2}
+vector<int> Topology::parse_id_list(string ids)
+{
+    vector<int> id_list;
+    stringstream str_ids(ids);
+
+    while (str_ids.good())
+    {
+        string substr;
+        getline(str_ids, substr, '_');
+        id_list.push_back(stoi(substr));
+    }
+    return id_list;
+}
+
+bool Topology::parse_gemm_layout(string layer_name, string layout)
+{
+    if (layout == "col")
+        return true;
+    if (layout != "row")
+        cout << "Unknown operand layout " << layout << " in layer " << layer_name << ", using row" << endl;
+    return false;
+}
+
+// Assigns the operand offsets of a layer. Layers without a source read their
+// ifmap from a fresh region, otherwise they read the ofmaps of their sources;
+// a filter source reads the filter from that layer's ofmap.
+void Topology::place_layer(LayerInfo &info, CalcLayerInfo &calcinfo, vector<int> ifmap_source_list, vector<int> filter_source_list,
+                           bool is_tensor_main_order, bool is_prefetch_demand, int64_t &initial_ifmap_offset)
+{
+    auto memoffset = config->get_mem_offsets();
+    int64_t initial_filter_offset = memoffset.filter_offset;
+
+    int64_t word_size = config->get_word_size();
+    int64_t batch_size = config->get_batch_size();
+
+    int64_t filter_offset;
+    int64_t ofmap_offset;
+    vector<int64_t> ifmap_offset;
 
-        while (in.read_row(name, type, ifmap_height, ifmap_width, filter_height, filter_width, channels, num_filer, stride_height, stride_width, ifmap_sources, filter_sources, pes))
+    uint64_t ifmap_size = info.ifmap_height * info.ifmap_width * info.channels * word_size * batch_size * ifmap_source_list.size();
+    uint64_t filter_size = 0;
+    if (info.type == CONV)
+        filter_size = info.filter_height * info.filter_width * info.channels * info.num_filer * word_size;
+    uint64_t ofmap_size = calcinfo.ofmap_height * calcinfo.ofmap_width * info.num_filer * word_size * batch_size;
+
+    uint64_t ifmap_demand_size = calcinfo.ofmap_height * calcinfo.ofmap_width * info.num_filer * info.filter_height * info.filter_width * info.channels * word_size * batch_size;
+    uint64_t filter_demand_size = info.filter_height * info.filter_width * info.channels * info.num_filer * word_size * batch_size;
+
+    if (is_tensor_main_order) {
+        if (topo_arrays.size() == 0) {
+            filter_offset = initial_filter_offset;
+            ofmap_offset = initial_ifmap_offset + ifmap_size;
+        } else {
+            filter_offset = topo_arrays[topo_arrays.size() - 1].filter_offset_end;
+            ofmap_offset = topo_arrays[topo_arrays.size() - 1].ofmap_offset_end;
+        }
+    }
+
+    if (ifmap_source_list[0] == -1) {
+        ifmap_offset.push_back(initial_ifmap_offset);
+        initial_ifmap_offset += ifmap_size;
+    } else {
+        for (size_t i = 0; i < ifmap_source_list.size(); i++)
         {
-            LayerInfo info;
-
-            info.name = name;
-            info.type = type;
-            info.ifmap_height = ifmap_height;
-            info.ifmap_width = ifmap_width;
-            info.filter_height = filter_height;
-            info.filter_width = filter_width;
-            info.channels = channels;
-            info.num_filer = num_filer;
-            info.stride_height = stride_height;
-            info.stride_width = stride_height;
-            info.dataflow = config->get_dataflow();
-
-            CalcLayerInfo calcinfo;
-
-            calcinfo.ofmap_height = info.ifmap_height / info.stride_height;
-            calcinfo.ofmap_width = info.ifmap_width / info.stride_width;
-
-            calcinfo.num_mac = calcinfo.ofmap_height * calcinfo.ofmap_width * info.filter_height * info.filter_width * info.channels * info.num_filer;
-            calcinfo.window_size = info.filter_height * info.filter_width * info.channels;
-            calc_topo_arrays.push_back(calcinfo);
-
-
-            vector<string> ifmap_source_str_list;
-            vector<int> ifmap_source_list;
-            stringstream str_ifmap_source(ifmap_sources);
-
-            while (str_ifmap_source.good())
-            {
-                string substr;
-                getline(str_ifmap_source, substr, '_');
-                ifmap_source_str_list.push_back(substr);
-            }
-
-            for (size_t i = 0; i < ifmap_source_str_list.size(); i++)
-            {
-                ifmap_source_list.push_back(stoi(ifmap_source_str_list[i]));
-            }
-
-
-            vector<string> filter_source_str_list;
-            vector<int> filter_source_list;
-            stringstream str_filter_source(filter_sources);
-
-            cout << "filter_sources is " << filter_sources << endl;
-
-            while (str_filter_source.good())
-            {
-                string substr;
-                getline(str_filter_source, substr, '_');
-                filter_source_str_list.push_back(substr);
-            }
-
-            for (size_t i = 0; i < filter_source_str_list.size(); i++)
-            {
-                filter_source_list.push_back(stoi(filter_source_str_list[i]));
-            }
-            
-            vector<string> pe_str_list;
-            vector<int> pe_list;
-            stringstream str_pe(pes);
-
-            while (str_pe.good())
-            {
-                string substr;
-                getline(str_pe, substr, '_');
-                pe_str_list.push_back(substr);
-            }
-
-            for (size_t i = 0; i < pe_str_list.size(); i++)
-            {
-                pe_list.push_back(stoi(pe_str_list[i]));
-            }
-
-            info.pe_list = pe_list;
-
-
-            vector<int64_t> ifmap_offset;
-
-            uint64_t ifmap_size = ifmap_height * ifmap_width * channels * word_size * batch_size * ifmap_source_list.size();
-            uint64_t filter_size = 0;
-            if (type == CONV)
-                filter_size = filter_height * filter_width * channels * num_filer * word_size;
-            uint64_t ofmap_size = calcinfo.ofmap_height * calcinfo.ofmap_width * num_filer * word_size * batch_size;
-
-            uint64_t ifmap_demand_size = calcinfo.ofmap_height * calcinfo.ofmap_width * num_filer * filter_height * filter_width * channels * word_size * batch_size;
-            uint64_t filter_demand_size = filter_height * filter_width * channels * num_filer * word_size * batch_size;
-
-            if (topo_arrays.size() == 0) {
-                filter_offset = initial_filter_offset;
-                ofmap_offset = initial_ifmap_offset + ifmap_size;
-            } else {
-                filter_offset = topo_arrays[topo_arrays.size() - 1].filter_offset_end;
-                ofmap_offset = topo_arrays[topo_arrays.size() - 1].ofmap_offset_end;
-            }
-
-            if (ifmap_source_list[0] == -1) {
-                ifmap_offset.push_back(initial_ifmap_offset);
-                initial_ifmap_offset += ifmap_size;
-            } else {
-                for (size_t i = 0; i < ifmap_source_list.size(); i++)
-                {
-                    ifmap_offset.push_back(topo_arrays[ifmap_source_list[i]].ofmap_offset);
-                }
-            }
-
-            if (filter_source_list[0] != -1) {
-                filter_offset = topo_arrays[filter_source_list[0]].ofmap_offset;
-                filter_size = 0;
-            }
-
-            info.ifmap_offset = ifmap_offset;
-            info.filter_offset = filter_offset;
-            
-            if (is_prefetch_demand) {
-                info.filter_demand_offset = info.filter_offset + filter_size;
-                info.filter_offset_end = info.filter_demand_offset + filter_demand_size;
-
-                info.ofmap_offset = ofmap_offset + ifmap_demand_size;
-                info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
-            } else {
-                info.filter_demand_offset = info.filter_offset;
-                info.filter_offset_end = info.filter_offset + filter_size;
-
-                info.ofmap_offset = ofmap_offset;
-                info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
-            }
-
-            topo_arrays.push_back(info);
+            ifmap_offset.push_back(topo_arrays[ifmap_source_list[i]].ofmap_offset);
         }
     }
 
-    
+    if (is_tensor_main_order) {
+        if (filter_source_list[0] != -1) {
+            filter_offset = topo_arrays[filter_source_list[0]].ofmap_offset;
+            filter_size = 0;
+        }
+    } else {
+        if (filter_source_list[0] != -1) {
+            filter_offset = topo_arrays[filter_source_list[0]].ofmap_offset;
+            ofmap_offset = filter_offset + filter_size;
+            filter_size = 0;
+        } else {
+            filter_offset = initial_ifmap_offset + ifmap_size;
+            ofmap_offset = filter_offset + filter_size;
+        }
+        initial_ifmap_offset += filter_size;
+    }
 
-    num_layers = topo_arrays.size();
+    info.ifmap_offset = ifmap_offset;
+    info.filter_offset = filter_offset;
+
+    info.producers.clear();
+    for (int source : ifmap_source_list) {
+        if (source != -1)
+            info.producers.push_back(source);
+    }
+    if (filter_source_list[0] != -1 && find(info.producers.begin(), info.producers.end(), filter_source_list[0]) == info.producers.end())
+        info.producers.push_back(filter_source_list[0]);
+
+    if (is_prefetch_demand) {
+        info.filter_demand_offset = info.filter_offset + filter_size;
+        info.filter_offset_end = info.filter_demand_offset + filter_demand_size;
+
+        info.ofmap_offset = ofmap_offset + ifmap_demand_size;
+        info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
+    } else {
+        info.filter_demand_offset = info.filter_offset;
+        info.filter_offset_end = info.filter_offset + filter_size;
+
+        info.ofmap_offset = ofmap_offset;
+        info.ofmap_offset_end = info.ofmap_offset + ofmap_size;
+    }
+
+    if (!is_tensor_main_order)
+        initial_ifmap_offset += ofmap_size;
 }
 
 OffsetInfo Topology::get_layer_offsets(int64_t layer_id)
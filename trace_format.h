@@ -0,0 +1,199 @@
+#ifndef _trace_format_h
+#define _trace_format_h
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+
+using namespace std;
+
+// Binary demand trace of one operand of one layer.
+//
+// file   := magic "CADOTRC1", varint name_len, name bytes, varint operand, stream*
+// stream := varint pe, varint num_folds, varint fold_rows, varint fold_cols,
+//           num_folds * fold_rows * fold_cols elements, row-major
+// elem   := varint 0 for a null request (-1), otherwise
+//           varint zigzag(addr - prev_addr) + 1; prev_addr starts at 0 in
+//           every stream and only advances on non-null elements
+//
+// Demand rows walk the operands with small strides, so most elements take
+// one or two bytes.
+
+typedef struct
+{
+    int64_t pe;
+    int64_t num_folds;
+    int64_t fold_rows;
+    int64_t fold_cols;
+} TraceStreamHeader;
+
+class TraceFileWriter
+{
+public:
+    TraceFileWriter();
+    bool open(string file_name, string layer_name, int operand);
+    void close();
+
+    void begin_stream(TraceStreamHeader header);
+    void write_elem(int64_t addr);
+
+private:
+    void write_varint(uint64_t value);
+
+    ofstream ofs;
+    int64_t prev_addr;
+};
+
+class TraceFileReader
+{
+public:
+    TraceFileReader();
+    bool open(string file_name);
+    string get_layer_name() { return layer_name; }
+    int get_operand() { return operand; }
+
+    // Returns false at the end of the file
+    bool next_stream(TraceStreamHeader &header);
+    int64_t read_elem();
+
+private:
+    bool read_varint(uint64_t &value);
+
+    ifstream ifs;
+    string layer_name;
+    int operand;
+    int64_t prev_addr;
+};
+
+const char trace_magic[8] = {'C', 'A', 'D', 'O', 'T', 'R', 'C', '1'};
+
+TraceFileWriter::TraceFileWriter()
+{
+    prev_addr = 0;
+}
+
+bool TraceFileWriter::open(string file_name, string layer_name, int operand)
+{
+    ofs.open(file_name, ios::binary | ios::trunc);
+    if (!ofs.is_open())
+        return false;
+
+    ofs.write(trace_magic, sizeof(trace_magic));
+    write_varint(layer_name.size());
+    ofs.write(layer_name.data(), layer_name.size());
+    write_varint(operand);
+    return true;
+}
+
+void TraceFileWriter::close()
+{
+    if (ofs.is_open())
+        ofs.close();
+}
+
+void TraceFileWriter::begin_stream(TraceStreamHeader header)
+{
+    write_varint(header.pe);
+    write_varint(header.num_folds);
+    write_varint(header.fold_rows);
+    write_varint(header.fold_cols);
+    prev_addr = 0;
+}
+
+void TraceFileWriter::write_elem(int64_t addr)
+{
+    if (addr == -1) {
+        write_varint(0);
+        return;
+    }
+
+    int64_t delta = addr - prev_addr;
+    uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    write_varint(zigzag + 1);
+    prev_addr = addr;
+}
+
+void TraceFileWriter::write_varint(uint64_t value)
+{
+    char buf[10];
+    int len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (char)value;
+    ofs.write(buf, len);
+}
+
+TraceFileReader::TraceFileReader()
+{
+    operand = 0;
+    prev_addr = 0;
+}
+
+bool TraceFileReader::open(string file_name)
+{
+    ifs.open(file_name, ios::binary);
+    if (!ifs.is_open())
+        return false;
+
+    char magic[8];
+    ifs.read(magic, sizeof(magic));
+    if (!ifs || string(magic, 8) != string(trace_magic, 8))
+        return false;
+
+    uint64_t name_len, op;
+    if (!read_varint(name_len))
+        return false;
+    layer_name.resize(name_len);
+    ifs.read(&layer_name[0], name_len);
+    if (!read_varint(op))
+        return false;
+    operand = (int)op;
+    return true;
+}
+
+bool TraceFileReader::next_stream(TraceStreamHeader &header)
+{
+    uint64_t pe, num_folds, fold_rows, fold_cols;
+    if (!read_varint(pe))
+        return false;
+    if (!read_varint(num_folds) || !read_varint(fold_rows) || !read_varint(fold_cols))
+        return false;
+
+    header.pe = pe;
+    header.num_folds = num_folds;
+    header.fold_rows = fold_rows;
+    header.fold_cols = fold_cols;
+    prev_addr = 0;
+    return true;
+}
+
+int64_t TraceFileReader::read_elem()
+{
+    uint64_t value;
+    if (!read_varint(value) || value == 0)
+        return -1;
+
+    uint64_t zigzag = value - 1;
+    int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    prev_addr += delta;
+    return prev_addr;
+}
+
+bool TraceFileReader::read_varint(uint64_t &value)
+{
+    value = 0;
+    int shift = 0;
+    int byte;
+    while ((byte = ifs.get()) != EOF) {
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+        shift += 7;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include <iostream>
+#include <string>
+
+#include "trace_format.h"
+
+// Prints a demand trace written with [run_presets] Trace = full.
+// Usage: trace_reader <file.trace> [--rows]
+// Without --rows only the per-PE stream summaries are printed.
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <file.trace> [--rows]" << endl;
+        return 1;
+    }
+
+    string file_name = argv[1];
+    bool print_rows = (argc > 2 && string(argv[2]) == "--rows");
+
+    TraceFileReader reader;
+    if (!reader.open(file_name)) {
+        cout << "Could not read trace file " << file_name << endl;
+        return 1;
+    }
+
+    string operand_names[3] = {"ifmap", "filter", "ofmap"};
+    int operand = reader.get_operand();
+    printf("Layer %s, operand %s\n", reader.get_layer_name().c_str(), (operand >= 0 && operand < 3) ? operand_names[operand].c_str() : "unknown");
+
+    TraceStreamHeader header;
+    while (reader.next_stream(header)) {
+        int64_t num_rows = header.num_folds * header.fold_rows;
+        int64_t num_requests = 0;
+        int64_t min_addr = -1;
+        int64_t max_addr = -1;
+
+        printf("pe %ld: %ld folds of %ld x %ld\n", header.pe, header.num_folds, header.fold_rows, header.fold_cols);
+        for (int64_t row = 0; row < num_rows; row++) {
+            for (int64_t col = 0; col < header.fold_cols; col++) {
+                int64_t addr = reader.read_elem();
+                if (print_rows)
+                    printf(col == 0 ? "%ld" : ",%ld", addr);
+                if (addr == -1)
+                    continue;
+                num_requests++;
+                min_addr = (min_addr == -1 || addr < min_addr) ? addr : min_addr;
+                max_addr = (addr > max_addr) ? addr : max_addr;
+            }
+            if (print_rows)
+                printf("\n");
+        }
+        printf("pe %ld: %ld rows, %ld requests, addresses [%ld, %ld]\n", header.pe, num_rows, num_requests, min_addr, max_addr);
+    }
+
+    return 0;
+}
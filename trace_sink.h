@@ -0,0 +1,166 @@
+#ifndef _trace_sink_h
+#define _trace_sink_h
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "compute/demand_stream.h"
+#include "trace_format.h"
+
+using namespace std;
+
+// [run_presets] Trace: off, summary or full
+enum class TraceLevel
+{
+    OFF,        // nothing is traced, no extra demand pass
+    SUMMARY,    // one line per operand and PE: rows, requests, address range
+    FULL        // binary per-operand trace files, see trace_format.h
+};
+
+TraceLevel parse_trace_level(string level)
+{
+    if (level == "summary")
+        return TraceLevel::SUMMARY;
+    if (level == "full")
+        return TraceLevel::FULL;
+    if (level != "off")
+        cout << "Unknown trace level " << level << ", tracing is off" << endl;
+    return TraceLevel::OFF;
+}
+
+string get_operand_name(Operand operand)
+{
+    if (operand == Operand::IFMAP)
+        return "ifmap";
+    if (operand == Operand::FILTER)
+        return "filter";
+    return "ofmap";
+}
+
+// Receives the demand streams of every PE of a layer, one operand at a time.
+class TraceSink
+{
+public:
+    virtual ~TraceSink() {}
+    virtual void begin_layer(string layer_name) = 0;
+    virtual void write_stream(Operand operand, int pe, DemandStream *stream) = 0;
+    virtual void end_layer() = 0;
+};
+
+class SummaryTraceSink : public TraceSink
+{
+public:
+    void begin_layer(string layer_name) { this->layer_name = layer_name; }
+    void write_stream(Operand operand, int pe, DemandStream *stream);
+    void end_layer() {}
+
+private:
+    string layer_name;
+    PaddedDemand fold_buf;
+};
+
+class BinaryTraceSink : public TraceSink
+{
+public:
+    BinaryTraceSink(string run_name);
+    void begin_layer(string layer_name);
+    void write_stream(Operand operand, int pe, DemandStream *stream);
+    void end_layer();
+
+private:
+    string run_name;
+    string layer_name;
+    TraceFileWriter writers[3];
+    bool writer_open[3];
+    PaddedDemand fold_buf;
+};
+
+// Returns NULL when tracing is off
+TraceSink* create_trace_sink(TraceLevel level, string run_name)
+{
+    if (level == TraceLevel::SUMMARY)
+        return new SummaryTraceSink();
+    if (level == TraceLevel::FULL)
+        return new BinaryTraceSink(run_name);
+    return NULL;
+}
+
+void SummaryTraceSink::write_stream(Operand operand, int pe, DemandStream *stream)
+{
+    int64_t num_requests = 0;
+    int64_t min_addr = -1;
+    int64_t max_addr = -1;
+
+    for (int64_t fold_id = 0; fold_id < stream->get_num_folds(); fold_id++) {
+        const PaddedDemand &fold = stream->get_fold(fold_id, fold_buf);
+        const int64_t *block = fold.get_block_data();
+        for (int64_t i = 0; i < fold.get_block_elems(); i++) {
+            int64_t addr = block[i];
+            if (addr == -1)
+                continue;
+            num_requests++;
+            min_addr = (min_addr == -1) ? addr : min(min_addr, addr);
+            max_addr = max(max_addr, addr);
+        }
+    }
+
+    printf("Trace %s %s pe %d: %ld rows, %ld requests, addresses [%ld, %ld]\n",
+        layer_name.c_str(), get_operand_name(operand).c_str(), pe, stream->get_num_rows(), num_requests, min_addr, max_addr);
+}
+
+BinaryTraceSink::BinaryTraceSink(string run_name)
+{
+    this->run_name = run_name;
+    for (int i = 0; i < 3; i++)
+        writer_open[i] = false;
+}
+
+void BinaryTraceSink::begin_layer(string layer_name)
+{
+    this->layer_name = layer_name;
+}
+
+void BinaryTraceSink::write_stream(Operand operand, int pe, DemandStream *stream)
+{
+    int op = (int)operand;
+    if (!writer_open[op]) {
+        string file_name = run_name + "_" + layer_name + "_" + get_operand_name(operand) + ".trace";
+        writer_open[op] = writers[op].open(file_name, layer_name, op);
+        if (!writer_open[op]) {
+            cout << "Could not open trace file " << file_name << endl;
+            return;
+        }
+    }
+
+    TraceStreamHeader header;
+    header.pe = pe;
+    header.num_folds = stream->get_num_folds();
+    header.fold_rows = stream->get_fold_rows();
+    header.fold_cols = 0;
+
+    for (int64_t fold_id = 0; fold_id < header.num_folds; fold_id++) {
+        const PaddedDemand &fold = stream->get_fold(fold_id, fold_buf);
+        if (fold_id == 0) {
+            header.fold_cols = fold.get_num_cols();
+            writers[op].begin_stream(header);
+        }
+        for (int64_t row = 0; row < fold.get_num_rows(); row++)
+            for (int64_t col = 0; col < fold.get_num_cols(); col++)
+                writers[op].write_elem(fold.get(row, col));
+    }
+    if (header.num_folds == 0)
+        writers[op].begin_stream(header);
+}
+
+void BinaryTraceSink::end_layer()
+{
+    for (int i = 0; i < 3; i++) {
+        if (writer_open[i])
+            writers[i].close();
+        writer_open[i] = false;
+    }
+}
+
+#endif